@@ -0,0 +1,38 @@
+#!/bin/sh
+# Compile a generated function with a long body, to check that the parser
+# and the rest of the compiler keep up with it, both with the default flags
+# and with everything on.
+# usage: stress.sh <compiler> [statements]
+set -e
+
+COMPILER=$1
+COUNT=${2:-100000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+awk -v n="$COUNT" 'BEGIN {
+	print "int main() {"
+	print "  int a = 0, b = 1, c = 2, i = 0;"
+	for (i = 0; i < n; ++i)
+		if (i % 4 == 0)
+			printf "  a = a + b * %d;\n", i % 7
+		else if (i % 4 == 1)
+			printf "  if (a > %d) b = b + 1; else c = c - a;\n", i
+		else if (i % 4 == 2)
+			printf "  c = (a - c) / %d;\n", i % 5 + 1
+		else
+			printf "  i = 0; while (i < %d) { i = i + 1;" \
+			       " if (c > i) continue; b = b + c;" \
+			       " if (b > %d) break; }\n", i % 9 + 1, i
+	print "  return a + b + c;"
+	print "}"
+}' > "$DIR/stress.sysy"
+
+for FLAGS in "" "-O2 -march=rv32imc"; do
+	rm -f "$DIR/stress.S"
+	# word splitting of the flags is intended
+	"$COMPILER" -riscv "$DIR/stress.sysy" -o "$DIR/stress.S" $FLAGS \
+		-time-report > /dev/null
+	grep -q '^main:' "$DIR/stress.S"
+	echo "stress: $COUNT statements compiled with flags \"$FLAGS\""
+done
@@ -0,0 +1,151 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm.h"
+
+static const char *const REG_NAMES[REG_COUNT] = {
+	"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+	"s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+	"a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+	"s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+
+/* parsing & printing */
+static void parse_line(const char *line, struct insn_t *insn)
+{
+	memset(insn, 0, sizeof(*insn));
+
+	const char *begin = line;
+	while (*begin == ' ' || *begin == '\t')
+		++begin;
+
+	size_t len = strlen(begin);
+	if (begin == line && len > 0 && begin[len - 1] == ':')
+	{
+		insn->kind = INSN_LABEL;
+		insn->op = strndup(begin, len - 1);
+		return;
+	}
+	if (len == 0 || *begin == '.')
+	{
+		insn->kind = INSN_DIRECTIVE;
+		insn->op = strdup(line);
+		return;
+	}
+
+	insn->kind = INSN_OP;
+	size_t op_len = strcspn(begin, " ");
+	insn->op = strndup(begin, op_len);
+
+	const char *arg = begin + op_len;
+	while (*arg == ' ')
+		++arg;
+	while (*arg)
+	{
+		assert(insn->argc < OPERAND_MAX);
+
+		size_t arg_len = strcspn(arg, ",");
+		insn->args[insn->argc++] = strndup(arg, arg_len);
+
+		arg += arg_len;
+		while (*arg == ',' || *arg == ' ')
+			++arg;
+	}
+}
+
+static void print_insn(const struct insn_t *insn, FILE *output)
+{
+	switch (insn->kind)
+	{
+	case INSN_LABEL:
+		fprintf(output, "%s:\n", insn->op);
+		break;
+	case INSN_DIRECTIVE:
+		fprintf(output, "%s\n", insn->op);
+		break;
+	case INSN_OP:
+		fprintf(output, "  %s", insn->op);
+		for (uint32_t i = 0; i < insn->argc; ++i)
+			fprintf(output, "%s%s", i == 0 ? " " : ", ",
+				insn->args[i]);
+		fprintf(output, "\n");
+		break;
+	}
+}
+
+/* public defn.s */
+struct insn_t *asm_parse(const char *text, uint32_t *len)
+{
+	uint32_t capacity = 64;
+	struct insn_t *insns = malloc(sizeof(*insns) * capacity);
+	*len = 0;
+
+	while (*text)
+	{
+		size_t line_len = strcspn(text, "\n");
+		char *line = strndup(text, line_len);
+
+		if (*len == capacity)
+		{
+			capacity *= 2;
+			insns = realloc(insns, sizeof(*insns) * capacity);
+		}
+		parse_line(line, &insns[(*len)++]);
+		free(line);
+
+		text += line_len;
+		if (*text == '\n')
+			++text;
+	}
+
+	return insns;
+}
+
+void asm_free(struct insn_t *insns, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; ++i)
+	{
+		free(insns[i].op);
+		for (uint32_t j = 0; j < insns[i].argc; ++j)
+			free(insns[i].args[j]);
+	}
+	free(insns);
+}
+
+void asm_print(const struct insn_t *insns, uint32_t len, FILE *output)
+{
+	for (uint32_t i = 0; i < len; ++i)
+		if (!insns[i].dead)
+			print_insn(&insns[i], output);
+}
+
+int32_t asm_reg(const char *name)
+{
+	for (int32_t i = 0; i < REG_COUNT; ++i)
+		if (strcmp(name, REG_NAMES[i]) == 0)
+			return i;
+
+	return REG_NONE;
+}
+
+const char *asm_reg_name(int32_t reg)
+{
+	assert(reg >= 0 && reg < REG_COUNT);
+
+	return REG_NAMES[reg];
+}
+
+int32_t asm_base(const char *address)
+{
+	const char *open = strchr(address, '(');
+	if (!open)
+		return REG_NONE;
+
+	size_t len = strcspn(open + 1, ")");
+	char *base = strndup(open + 1, len);
+	int32_t reg = asm_reg(base);
+	free(base);
+
+	return reg;
+}
@@ -0,0 +1,47 @@
+/**
+ * asm.h
+ * Lines of RISC-V assembly, for the passes working on it.
+ */
+
+#ifndef _ASM_H_
+#define _ASM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define OPERAND_MAX 3
+#define REG_COUNT 32
+#define REG_NONE -1
+
+/* a line of assembly */
+struct insn_t {
+	enum {
+		INSN_LABEL,
+		INSN_DIRECTIVE,
+		INSN_OP,
+	} kind;
+	bool dead;
+	// label name, whole line of directive, or mnemonic
+	char *op;
+	uint32_t argc;
+	char *args[OPERAND_MAX];
+};
+
+/* Split assembly text into lines.
+ * @return array of `*len` lines, to be freed by `asm_free()`. */
+struct insn_t *asm_parse(const char *text, uint32_t *len);
+void asm_free(struct insn_t *insns, uint32_t len);
+
+/* Print lines that aren't dead. */
+void asm_print(const struct insn_t *insns, uint32_t len, FILE *output);
+
+/* ABI name <-> register number. REG_NONE if `name` isn't a register */
+int32_t asm_reg(const char *name);
+const char *asm_reg_name(int32_t reg);
+
+/* Base register of `off(reg)` operands.
+ * @return REG_NONE for operands of other kinds. */
+int32_t asm_base(const char *address);
+
+#endif//_ASM_H_
@@ -6,8 +6,6 @@
 #include "ast.h"
 #include "macros.h"
 
-extern int yylineno;
-
 static const char *AST_KIND_S[] = {
 #if 0
 	"YYEMPTY",
@@ -74,14 +72,14 @@ static const char *AST_KIND_S[] = {
 	"ConstExp",
 };
 
-struct node_t *ast_nterm(enum ast_kind_e kind, int count, ...)
+struct node_t *ast_nterm(int lineno, enum ast_kind_e kind, int count, ...)
 {
 	assert(kind > AST_YYACCEPT);
 
 	struct node_data_t data = {
 		.kind = kind,
 		.terminal = false,
-		.lineno = yylineno,
+		.lineno = lineno,
 	};
 	struct node_t *new = node_new(data, count);
 
@@ -12,27 +12,88 @@
 #define ALIGNMENT alignof(max_align_t)
 #define aligned(ptr) ((void *)((uintptr_t)(ptr) & -ALIGNMENT))
 
+/* a chunk is filled from its end down to the header */
+struct chunk_t {
+	struct chunk_t *prev;
+	size_t size;
+	alignas(max_align_t) char buf[];
+};
+
 /* opaque type definition */
 struct _bump_t {
-	/* well this is uh... kinda hacky. i can't think of any other way to
-	 * make these members overlap tho. */
-	union {
-		void *ptr;
-		char buf[];
-	};
+	void *ptr;
+	// chunk being allocated from; earlier ones are full
+	struct chunk_t *chunk;
+	// bytes taken up by the earlier ones
+	size_t used_before;
+	size_t chunk_size;
 };
 
+/* tool functions */
+static struct chunk_t *chunk_new(struct chunk_t *prev, size_t size)
+{
+	struct chunk_t *new = aligned_alloc(sysconf(_SC_PAGESIZE), size);
+	new->prev = prev;
+	new->size = size;
+
+	return new;
+}
+
+static char *chunk_end(struct chunk_t *chunk)
+{
+	return (char *)chunk + chunk->size;
+}
+
+/* a unit that outgrows the arena gets another chunk rather than an
+ * overflow. the first is kept through resets */
+static void grow(bump_t bump, size_t size)
+{
+	size_t chunk_size = bump->chunk_size;
+	size_t needed = offsetof(struct chunk_t, buf) + 2 * ALIGNMENT + size;
+	while (chunk_size < needed)
+		chunk_size *= 2;
+
+	bump->used_before += chunk_end(bump->chunk) - (char *)bump->ptr;
+	bump->chunk = chunk_new(bump->chunk, chunk_size);
+	bump->ptr = chunk_end(bump->chunk);
+}
+
 /* exported functions */
 bump_t bump_new(size_t size)
 {
-	struct _bump_t *new = aligned_alloc(sysconf(_SC_PAGESIZE), size);
-	new->ptr = new->buf + size;
+	struct _bump_t *new = malloc(sizeof(struct _bump_t));
+	new->chunk = chunk_new(NULL, size);
+	new->chunk_size = size;
+	bump_reset(new);
 
 	return new;
 }
 
+void bump_reset(bump_t bump)
+{
+	while (bump->chunk->prev)
+	{
+		struct chunk_t *prev = bump->chunk->prev;
+		free(bump->chunk);
+		bump->chunk = prev;
+	}
+
+	bump->ptr = chunk_end(bump->chunk);
+	bump->used_before = 0;
+}
+
+size_t bump_used(bump_t bump)
+{
+	return bump->used_before + (chunk_end(bump->chunk) - (char *)bump->ptr);
+}
+
 void bump_delete(bump_t bump)
 {
+	for (struct chunk_t *chunk = bump->chunk, *prev; chunk; chunk = prev)
+	{
+		prev = chunk->prev;
+		free(chunk);
+	}
 	free(bump);
 }
 
@@ -44,9 +105,13 @@ void *bump_malloc(bump_t bump, size_t size)
 {
 	assert(bump);
 
+	size_t room = (char *)bump->ptr - bump->chunk->buf;
+	if (room < size + 2 * ALIGNMENT)
+		grow(bump, size);
+
 	void *alloc = aligned((char *)bump->ptr - size);
 	bump->ptr = (char *)alloc - ALIGNMENT;
-	assert((uintptr_t)bump->ptr > (uintptr_t)bump->buf);
+	assert((uintptr_t)bump->ptr >= (uintptr_t)bump->chunk->buf);
 
 	*(size_t *)bump->ptr = size;
 
@@ -68,8 +133,9 @@ void *bump_realloc(bump_t bump, void *ptr, size_t new_size)
 	assert(bump);
 	assert(ptr);
 
+	size_t old_size = *(size_t *)((char *)ptr - ALIGNMENT);
 	void *alloc = bump_malloc(bump, new_size);
-	memcpy(alloc, ptr, *(size_t *)((char *)alloc - ALIGNMENT));
+	memcpy(alloc, ptr, old_size < new_size ? old_size : new_size);
 
 	return alloc;
 }
@@ -10,8 +10,14 @@
 
 typedef struct _bump_t *bump_t;
 
+/* Make an arena of chunks of `size` bytes, another of which is added
+ * whenever it runs out. */
 bump_t bump_new(size_t size);
 void bump_delete(bump_t bump);
+/* Free everything at once. Pages touched so far stay mapped. */
+void bump_reset(bump_t bump);
+/* @return bytes taken up since creation or the last reset. */
+size_t bump_used(bump_t bump);
 
 void *bump_malloc(bump_t bump, size_t size);
 void *bump_calloc(bump_t bump, size_t num, size_t size);
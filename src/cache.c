@@ -0,0 +1,279 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "macros.h"
+
+#define PATH_LEN 4096
+
+/* an entry found while trimming */
+struct entry_t {
+	char *path;
+	off_t size;
+	struct timespec used;
+};
+
+/* state variables */
+static char *m_dir;
+static size_t m_size = 256 MiB;
+static struct hash_t m_base;
+static _Atomic uint32_t m_hits[CACHE_KIND_COUNT];
+static _Atomic uint32_t m_misses[CACHE_KIND_COUNT];
+static _Atomic uint32_t m_evictions;
+
+static const char *const KIND_NAMES[CACHE_KIND_COUNT] = {
+	"unit", "function",
+};
+
+/* tool functions */
+static void entry_path(char *path, const struct hash_t *key)
+{
+	snprintf(path, PATH_LEN, "%s/%02x/%014" PRIx64 "%016" PRIx64, m_dir,
+		 (unsigned)(key->a >> 56), key->a & 0xffffffffffffffu, key->b);
+}
+
+static bool read_all(int fd, char *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = read(fd, data, len);
+		if (n <= 0)
+			return false;
+		data += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static bool write_all(int fd, const char *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write(fd, data, len);
+		if (n <= 0)
+			return false;
+		data += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static int compare_used(const void *lhs, const void *rhs)
+{
+	const struct timespec *l = &((const struct entry_t *)lhs)->used;
+	const struct timespec *r = &((const struct entry_t *)rhs)->used;
+
+	if (l->tv_sec != r->tv_sec)
+		return (l->tv_sec > r->tv_sec) - (l->tv_sec < r->tv_sec);
+	return (l->tv_nsec > r->tv_nsec) - (l->tv_nsec < r->tv_nsec);
+}
+
+/* public defn.s */
+void hash_init(struct hash_t *hash)
+{
+	hash->a = 14695981039346656037u;
+	hash->b = 0x6a09e667f3bcc909u;
+}
+
+void hash_bytes(struct hash_t *hash, const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+
+	/* FNV-1a, and a multiply-rotate one with a different constant */
+	for (size_t i = 0; i < len; ++i)
+	{
+		hash->a = (hash->a ^ bytes[i]) * 1099511628211u;
+		hash->b = (hash->b ^ bytes[i]) * 0x9e3779b97f4a7c15u;
+		hash->b = hash->b << 23 | hash->b >> 41;
+	}
+}
+
+void hash_u32(struct hash_t *hash, uint32_t value)
+{
+	hash_bytes(hash, &value, sizeof(value));
+}
+
+void hash_str(struct hash_t *hash, const char *str)
+{
+	if (!str)
+		hash_u32(hash, UINT32_MAX);
+	else
+		hash_bytes(hash, str, strlen(str) + 1);
+}
+
+bool cache_set_dir(const char *dir)
+{
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+		return false;
+
+	free(m_dir);
+	m_dir = strdup(dir);
+	return true;
+}
+
+void cache_set_size(size_t size)
+{
+	m_size = size;
+}
+
+void cache_set_flags(const char *flags)
+{
+	hash_init(&m_base);
+	hash_str(&m_base, flags);
+
+	/* a rebuilt compiler may generate different code */
+	struct stat st;
+	if (stat("/proc/self/exe", &st) == 0)
+	{
+		hash_bytes(&m_base, &st.st_ino, sizeof(st.st_ino));
+		hash_bytes(&m_base, &st.st_size, sizeof(st.st_size));
+		hash_bytes(&m_base, &st.st_mtim, sizeof(st.st_mtim));
+	}
+}
+
+bool cache_enabled(void)
+{
+	return m_dir != NULL;
+}
+
+void cache_key(struct hash_t *key)
+{
+	*key = m_base;
+}
+
+char *cache_get(enum cache_kind_e kind, const struct hash_t *key,
+		size_t *len)
+{
+	char path[PATH_LEN];
+	entry_path(path, key);
+
+	char *data = NULL;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		goto miss;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		goto miss_close;
+
+	/* one extra byte, so that empty entries aren't NULL */
+	data = malloc(st.st_size + 1);
+	if (!read_all(fd, data, st.st_size))
+	{
+		free(data);
+		data = NULL;
+		goto miss_close;
+	}
+	*len = st.st_size;
+
+	/* mark it as recently used */
+	futimens(fd, NULL);
+	close(fd);
+
+	++m_hits[kind];
+	return data;
+
+miss_close:
+	close(fd);
+miss:
+	++m_misses[kind];
+	return NULL;
+}
+
+void cache_put(const struct hash_t *key, const char *data, size_t len)
+{
+	char path[PATH_LEN];
+	snprintf(path, PATH_LEN, "%s/%02x", m_dir, (unsigned)(key->a >> 56));
+	if (mkdir(path, 0755) != 0 && errno != EEXIST)
+		return;
+
+	/* entries show up whole or not at all, even with other compilers
+	 * writing to the same directory */
+	char temp[PATH_LEN];
+	snprintf(temp, PATH_LEN, "%s/.tmp.XXXXXX", path);
+	int fd = mkstemp(temp);
+	if (fd < 0)
+		return;
+
+	bool ok = write_all(fd, data, len);
+	ok = close(fd) == 0 && ok;
+
+	entry_path(path, key);
+	if (!ok || rename(temp, path) != 0)
+		unlink(temp);
+}
+
+void cache_trim(void)
+{
+	size_t capacity = 1024, len = 0;
+	struct entry_t *entries = malloc(sizeof(*entries) * capacity);
+	size_t total = 0;
+
+	char path[PATH_LEN];
+	for (unsigned i = 0; i < 256; ++i)
+	{
+		snprintf(path, PATH_LEN, "%s/%02x", m_dir, i);
+		DIR *dir = opendir(path);
+		if (!dir)
+			continue;
+
+		for (struct dirent *it; (it = readdir(dir));)
+		{
+			if (it->d_name[0] == '.')
+				continue;
+
+			char file[PATH_LEN];
+			snprintf(file, PATH_LEN, "%s/%s", path, it->d_name);
+			struct stat st;
+			if (stat(file, &st) != 0)
+				continue;
+
+			if (len == capacity)
+			{
+				capacity *= 2;
+				entries = realloc(entries,
+						  sizeof(*entries) * capacity);
+			}
+			entries[len++] = (struct entry_t) {
+				.path = strdup(file),
+				.size = st.st_size,
+				.used = st.st_mtim,
+			};
+			total += st.st_size;
+		}
+
+		closedir(dir);
+	}
+
+	/* oldest first */
+	if (total > m_size)
+		qsort(entries, len, sizeof(struct entry_t), compare_used);
+	for (size_t i = 0; i < len && total > m_size; ++i)
+		if (unlink(entries[i].path) == 0)
+		{
+			total -= entries[i].size;
+			++m_evictions;
+		}
+
+	for (size_t i = 0; i < len; ++i)
+		free(entries[i].path);
+	free(entries);
+}
+
+void cache_report(FILE *output)
+{
+	fprintf(output, "cache:\n");
+	fprintf(output, "  %-16s %8s %8s\n", "kind", "hits", "misses");
+	for (uint32_t i = 0; i < CACHE_KIND_COUNT; ++i)
+		fprintf(output, "  %-16s %8u %8u\n", KIND_NAMES[i],
+			m_hits[i], m_misses[i]);
+	fprintf(output, "  %-16s %8u\n", "evicted", m_evictions);
+}
@@ -0,0 +1,74 @@
+/**
+ * cache.h
+ * On-disk cache of compilation results.
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "koopa.h"
+
+/* what an entry holds */
+enum cache_kind_e {
+	// output of a whole unit, keyed by its source
+	CACHE_UNIT,
+	// assembly of a function, keyed by its tokens and the signatures of
+	// globals they refer to
+	CACHE_FUNCTION,
+	CACHE_KIND_COUNT,
+};
+
+/* two independent 64-bit lanes, so collisions are out of the question in
+ * practice */
+struct hash_t {
+	uint64_t a;
+	uint64_t b;
+};
+
+void hash_init(struct hash_t *hash);
+void hash_bytes(struct hash_t *hash, const void *data, size_t len);
+void hash_u32(struct hash_t *hash, uint32_t value);
+// NULL is told apart from ""
+void hash_str(struct hash_t *hash, const char *str);
+
+/* a function definition, looked up before it's compiled */
+struct cache_function_t {
+	struct hash_t key;
+	// what it's become in IR, if anything yet. left unset if there's no
+	// telling from the key what its code is
+	koopa_raw_function_t raw;
+	// assembly on a hit, to be `free()`d; NULL otherwise
+	char *text;
+	size_t len;
+};
+
+/* Keep entries under `dir`, which is created if missing.
+ * @return false if it can't be. */
+bool cache_set_dir(const char *dir);
+/* Evict least recently used entries beyond `size` bytes. */
+void cache_set_size(size_t size);
+/* Options that change the output go into every key. */
+void cache_set_flags(const char *flags);
+bool cache_enabled(void);
+
+/* Start a key with the flags and the identity of the compiler itself. */
+void cache_key(struct hash_t *key);
+
+/* @return contents of the entry with `len` set, to be `free()`d; NULL if
+ * there's none. */
+char *cache_get(enum cache_kind_e kind, const struct hash_t *key,
+		size_t *len);
+void cache_put(const struct hash_t *key, const char *data, size_t len);
+
+/* Evict entries down to the size limit. */
+void cache_trim(void);
+
+/* Print hits and misses of each kind of entries, and evictions. */
+void cache_report(FILE *output);
+
+#endif//_CACHE_H_
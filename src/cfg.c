@@ -0,0 +1,525 @@
+#pragma clang diagnostic ignored \
+	"-Wincompatible-pointer-types-discards-qualifiers"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "koopaext.h"
+#include "macros.h"
+
+/* tool functions */
+static void add_edge(struct cfg_t *cfg, uint32_t from, uint32_t to)
+{
+	vector_u32_push(cfg->succs[from], to);
+	vector_u32_push(cfg->preds[to], from);
+}
+
+static void build_edges(struct cfg_t *cfg)
+{
+	for (uint32_t i = 0; i < cfg->len; ++i)
+	{
+		koopa_raw_basic_block_t basic_block = cfg->bbs[i];
+		koopa_raw_value_t last = slice_back(&basic_block->insts);
+
+		switch (last ? last->kind.tag : KOOPA_RVT_RETURN)
+		{
+		case KOOPA_RVT_BRANCH:
+			add_edge(cfg, i, cfg_index(cfg,
+				 last->kind.data.branch.true_bb));
+			add_edge(cfg, i, cfg_index(cfg,
+				 last->kind.data.branch.false_bb));
+			break;
+		case KOOPA_RVT_JUMP:
+			add_edge(cfg, i, cfg_index(cfg,
+				 last->kind.data.jump.target));
+			break;
+		default:
+			/* returns, or falls off the end */
+			add_edge(cfg, i, cfg->len);
+		}
+	}
+}
+
+/* postorder depth-first search, iteratively since functions can be huge */
+static void postorder(struct cfg_t *cfg, uint32_t root,
+		      struct vector_u32_t **edges, const uint32_t *filter,
+		      struct vector_u32_t *order)
+{
+	uint32_t *visited = calloc(cfg->len + 1, sizeof(uint32_t));
+	struct vector_u32_t *stack = vector_u32_new(16);
+	struct vector_u32_t *iters = vector_u32_new(16);
+
+	visited[root] = true;
+	vector_u32_push(stack, root);
+	vector_u32_push(iters, 0);
+	while (stack->size > 0)
+	{
+		uint32_t node = vector_u32_back(stack);
+		uint32_t *iter = &iters->data[iters->size - 1];
+
+		if (*iter == edges[node]->size)
+		{
+			vector_u32_push(order, node);
+			vector_u32_pop(stack);
+			vector_u32_pop(iters);
+			continue;
+		}
+
+		uint32_t next = edges[node]->data[(*iter)++];
+		if (visited[next] || (filter && filter[next] == CFG_NONE))
+			continue;
+
+		visited[next] = true;
+		vector_u32_push(stack, next);
+		vector_u32_push(iters, 0);
+	}
+
+	vector_u32_delete(iters);
+	vector_u32_delete(stack);
+	free(visited);
+}
+
+/* "A Simple, Fast Dominance Algorithm", Cooper, Harvey & Kennedy */
+static uint32_t intersect(const uint32_t *idom, const uint32_t *number,
+			  uint32_t a, uint32_t b)
+{
+	while (a != b)
+	{
+		while (number[a] < number[b])
+			a = idom[a];
+		while (number[b] < number[a])
+			b = idom[b];
+	}
+	return a;
+}
+
+static void dominators(struct cfg_t *cfg, uint32_t root,
+		       struct vector_u32_t **preds,
+		       struct vector_u32_t *order, uint32_t *idom)
+{
+	/* postorder numbers; higher is closer to root */
+	uint32_t *number = malloc(sizeof(uint32_t) * (cfg->len + 1));
+	for (uint32_t i = 0; i <= cfg->len; ++i)
+	{
+		idom[i] = CFG_NONE;
+		number[i] = CFG_NONE;
+	}
+	for (uint32_t i = 0; i < order->size; ++i)
+		number[order->data[i]] = i;
+
+	idom[root] = root;
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+
+		/* reverse postorder */
+		for (uint32_t i = order->size - 1; i-- > 0; )
+		{
+			uint32_t node = order->data[i];
+			uint32_t new = CFG_NONE;
+
+			for (uint32_t j = 0; j < preds[node]->size; ++j)
+			{
+				uint32_t pred = preds[node]->data[j];
+				if (idom[pred] == CFG_NONE)
+					continue;
+
+				new = (new == CFG_NONE)
+				      ? pred
+				      : intersect(idom, number, pred, new);
+			}
+
+			if (idom[node] != new)
+			{
+				idom[node] = new;
+				changed = true;
+			}
+		}
+	}
+
+	free(number);
+}
+
+/* number the (post-)dominator tree depth-first. `a` dominates `b` iff the
+ * interval of `a` encloses that of `b`, which saves walking up the tree */
+static void number_tree(const struct cfg_t *cfg, uint32_t root,
+			const uint32_t *idom, uint32_t *enter, uint32_t *leave)
+{
+	uint32_t len = cfg->len + 1;
+	uint32_t *child = malloc(sizeof(uint32_t) * len);
+	uint32_t *sibling = malloc(sizeof(uint32_t) * len);
+	for (uint32_t i = 0; i < len; ++i)
+	{
+		child[i] = CFG_NONE;
+		enter[i] = CFG_NONE;
+		leave[i] = CFG_NONE;
+	}
+	for (uint32_t i = len; i-- > 0; )
+		if (idom[i] != CFG_NONE && i != root)
+		{
+			sibling[i] = child[idom[i]];
+			child[idom[i]] = i;
+		}
+
+	uint32_t clock = 0;
+	struct vector_u32_t *stack = vector_u32_new(16);
+	enter[root] = clock++;
+	vector_u32_push(stack, root);
+	while (stack->size > 0)
+	{
+		uint32_t node = vector_u32_back(stack);
+		uint32_t next = child[node];
+
+		if (next == CFG_NONE)
+		{
+			leave[node] = clock++;
+			vector_u32_pop(stack);
+			continue;
+		}
+
+		child[node] = sibling[next];
+		enter[next] = clock++;
+		vector_u32_push(stack, next);
+	}
+
+	vector_u32_delete(stack);
+	free(sibling);
+	free(child);
+}
+
+static void natural_loops(struct cfg_t *cfg, bool assign_headers)
+{
+	struct vector_u32_t *stack = vector_u32_new(16);
+	struct vector_u32_t *body = vector_u32_new(16);
+	uint32_t *in_body = calloc(cfg->len, sizeof(uint32_t));
+
+	for (uint32_t h = 0; h < cfg->len; ++h)
+	{
+		if (!cfg_reachable(cfg, h))
+			continue;
+
+		/* sources of back edges */
+		for (uint32_t i = 0; i < cfg->preds[h]->size; ++i)
+		{
+			uint32_t pred = cfg->preds[h]->data[i];
+			if (!in_body[pred] && cfg_reachable(cfg, pred)
+			    && cfg_dominates(cfg, h, pred))
+			{
+				in_body[pred] = true;
+				vector_u32_push(stack, pred);
+				vector_u32_push(body, pred);
+			}
+		}
+		if (stack->size == 0)
+			continue;
+
+		/* walk backwards until the header */
+		if (!in_body[h])
+		{
+			in_body[h] = true;
+			vector_u32_push(body, h);
+		}
+		while (stack->size > 0)
+		{
+			uint32_t node = vector_u32_pop(stack);
+			if (node == h)
+				continue;
+
+			for (uint32_t i = 0; i < cfg->preds[node]->size; ++i)
+			{
+				uint32_t pred = cfg->preds[node]->data[i];
+				if (!in_body[pred] && cfg_reachable(cfg, pred))
+				{
+					in_body[pred] = true;
+					vector_u32_push(stack, pred);
+					vector_u32_push(body, pred);
+				}
+			}
+		}
+
+		for (uint32_t i = 0; i < body->size; ++i)
+		{
+			uint32_t node = body->data[i];
+			uint32_t *header = &cfg->header[node];
+			in_body[node] = false;
+
+			if (!assign_headers)
+				++cfg->depth[node];
+			else if (*header == CFG_NONE
+				 || cfg->depth[h] > cfg->depth[*header])
+				*header = h;
+		}
+		body->size = 0;
+	}
+
+	free(in_body);
+	vector_u32_delete(body);
+	vector_u32_delete(stack);
+}
+
+/* static branch prediction: loops iterate 8 times, and loop exits are taken
+ * once out of 8 */
+#define LOOP_SCALE 3
+#define LOOP_DEPTH_MAX 6
+#define PROB_ONE 8
+
+struct edge_t {
+	uint32_t from;
+	uint32_t to;
+	uint64_t weight;
+};
+
+static bool stays_in_loop(const struct cfg_t *cfg, uint32_t from, uint32_t to)
+{
+	if (cfg->header[from] == CFG_NONE)
+		return true;
+
+	return cfg->depth[to] >= cfg->depth[from]
+	       && cfg_dominates(cfg, cfg->header[from], to);
+}
+
+static uint64_t edge_weight(const struct cfg_t *cfg, uint32_t from,
+			    uint32_t to)
+{
+	uint64_t freq = 1ull << (LOOP_SCALE
+				 * min(cfg->depth[from], LOOP_DEPTH_MAX));
+	struct vector_u32_t *succs = cfg->succs[from];
+
+	if (succs->size == 1)
+		return freq * PROB_ONE;
+
+	uint32_t staying = 0;
+	for (uint32_t i = 0; i < succs->size; ++i)
+		staying += stays_in_loop(cfg, from, succs->data[i]);
+
+	/* all or none of them leave the loop */
+	if (staying == 0 || staying == succs->size)
+		return freq * PROB_ONE / succs->size;
+
+	return freq * (stays_in_loop(cfg, from, to) ? PROB_ONE - 1 : 1);
+}
+
+static int edge_compare(const void *a, const void *b)
+{
+	const struct edge_t *lhs = a, *rhs = b;
+
+	if (lhs->weight != rhs->weight)
+		return lhs->weight < rhs->weight ? 1 : -1;
+	if (lhs->from != rhs->from)
+		return lhs->from < rhs->from ? -1 : 1;
+	return lhs->to < rhs->to ? -1 : (lhs->to > rhs->to);
+}
+
+/* exported functions */
+struct cfg_t *cfg_new(koopa_raw_function_t function)
+{
+	assert(function->bbs.len > 0);
+
+	struct cfg_t *new = malloc(sizeof(*new));
+	uint32_t len = new->len = function->bbs.len;
+	new->bbs = (const koopa_raw_basic_block_t *)function->bbs.buffer;
+	new->indices = htable_ptru32_new();
+	for (uint32_t i = 0; i < len; ++i)
+		htable_insert(new->indices, (void *)new->bbs[i], i);
+
+	new->succs = malloc(sizeof(*new->succs) * (len + 1));
+	new->preds = malloc(sizeof(*new->preds) * (len + 1));
+	for (uint32_t i = 0; i <= len; ++i)
+	{
+		new->succs[i] = vector_u32_new(2);
+		new->preds[i] = vector_u32_new(2);
+	}
+	build_edges(new);
+
+	/* dominators */
+	struct vector_u32_t *order = vector_u32_new(len + 1);
+	postorder(new, 0, new->succs, NULL, order);
+	new->idom = malloc(sizeof(uint32_t) * (len + 1));
+	dominators(new, 0, new->preds, order, new->idom);
+	new->dom_enter = malloc(sizeof(uint32_t) * (len + 1));
+	new->dom_leave = malloc(sizeof(uint32_t) * (len + 1));
+	number_tree(new, 0, new->idom, new->dom_enter, new->dom_leave);
+
+	new->rpo = vector_u32_new(order->size);
+	for (uint32_t i = order->size; i-- > 0; )
+		vector_u32_push(new->rpo, order->data[i]);
+
+	/* post-dominators, with unreachable blocks filtered out */
+	order->size = 0;
+	postorder(new, len, new->preds, new->idom, order);
+	new->ipdom = malloc(sizeof(uint32_t) * (len + 1));
+	dominators(new, len, new->succs, order, new->ipdom);
+	new->pdom_enter = malloc(sizeof(uint32_t) * (len + 1));
+	new->pdom_leave = malloc(sizeof(uint32_t) * (len + 1));
+	number_tree(new, len, new->ipdom, new->pdom_enter, new->pdom_leave);
+	vector_u32_delete(order);
+
+	/* loops */
+	new->header = malloc(sizeof(uint32_t) * len);
+	new->depth = calloc(len, sizeof(uint32_t));
+	for (uint32_t i = 0; i < len; ++i)
+		new->header[i] = CFG_NONE;
+	natural_loops(new, false);
+	natural_loops(new, true);
+
+	return new;
+}
+
+void cfg_delete(struct cfg_t *cfg)
+{
+	if (!cfg)
+		return;
+
+	free(cfg->depth);
+	free(cfg->header);
+	free(cfg->pdom_leave);
+	free(cfg->pdom_enter);
+	free(cfg->ipdom);
+	free(cfg->dom_leave);
+	free(cfg->dom_enter);
+	free(cfg->idom);
+	vector_u32_delete(cfg->rpo);
+	for (uint32_t i = 0; i <= cfg->len; ++i)
+	{
+		vector_u32_delete(cfg->preds[i]);
+		vector_u32_delete(cfg->succs[i]);
+	}
+	free(cfg->preds);
+	free(cfg->succs);
+	htable_ptru32_delete(cfg->indices);
+	free(cfg);
+}
+
+uint32_t cfg_index(const struct cfg_t *cfg,
+		   koopa_raw_basic_block_t basic_block)
+{
+	uint32_t *it = htable_lookup(cfg->indices, (void *)basic_block);
+	assert(it);
+
+	return *it;
+}
+
+bool cfg_reachable(const struct cfg_t *cfg, uint32_t bb)
+{
+	return cfg->idom[bb] != CFG_NONE;
+}
+
+bool cfg_dominates(const struct cfg_t *cfg, uint32_t a, uint32_t b)
+{
+	if (cfg->idom[a] == CFG_NONE || cfg->idom[b] == CFG_NONE)
+		return false;
+
+	return cfg->dom_enter[a] <= cfg->dom_enter[b]
+	       && cfg->dom_leave[b] <= cfg->dom_leave[a];
+}
+
+bool cfg_postdominates(const struct cfg_t *cfg, uint32_t a, uint32_t b)
+{
+	if (cfg->ipdom[a] == CFG_NONE || cfg->ipdom[b] == CFG_NONE)
+		return false;
+
+	return cfg->pdom_enter[a] <= cfg->pdom_enter[b]
+	       && cfg->pdom_leave[b] <= cfg->pdom_leave[a];
+}
+
+uint32_t cfg_common_dominator(const struct cfg_t *cfg, uint32_t a, uint32_t b)
+{
+	if (cfg->idom[a] == CFG_NONE || cfg->idom[b] == CFG_NONE)
+		return CFG_NONE;
+
+	while (!cfg_dominates(cfg, a, b))
+		a = cfg->idom[a];
+	return a;
+}
+
+uint32_t cfg_common_postdominator(const struct cfg_t *cfg, uint32_t a,
+				  uint32_t b)
+{
+	if (cfg->ipdom[a] == CFG_NONE || cfg->ipdom[b] == CFG_NONE)
+		return CFG_NONE;
+
+	while (!cfg_postdominates(cfg, a, b))
+		a = cfg->ipdom[a];
+	return a;
+}
+
+/* "Profile Guided Code Positioning", Pettis & Hansen: chain blocks together
+ * along the heaviest edges first. a loop whose header tests the condition
+ * ends up rotated, with the header at the bottom, since the back edge into
+ * the header outweighs the edge entering the loop. */
+struct vector_u32_t *cfg_layout(const struct cfg_t *cfg)
+{
+	uint32_t len = cfg->len;
+
+	struct edge_t *edges = NULL;
+	uint32_t edge_count = 0, edge_capacity = 0;
+	for (uint32_t i = 0; i < len; ++i)
+	{
+		if (!cfg_reachable(cfg, i))
+			continue;
+
+		for (uint32_t j = 0; j < cfg->succs[i]->size; ++j)
+		{
+			uint32_t succ = cfg->succs[i]->data[j];
+			if (succ == len || succ == 0 || succ == i)
+				continue;
+
+			if (edge_count == edge_capacity)
+			{
+				edge_capacity = max(edge_capacity * 2, 16u);
+				edges = realloc(edges, sizeof(*edges)
+							* edge_capacity);
+			}
+			edges[edge_count++] = (struct edge_t) {
+				.from = i,
+				.to = succ,
+				.weight = edge_weight(cfg, i, succ),
+			};
+		}
+	}
+	qsort(edges, edge_count, sizeof(*edges), edge_compare);
+
+	uint32_t *next = malloc(sizeof(uint32_t) * len);
+	uint32_t *prev = malloc(sizeof(uint32_t) * len);
+	uint32_t *head = malloc(sizeof(uint32_t) * len);
+	for (uint32_t i = 0; i < len; ++i)
+	{
+		next[i] = prev[i] = CFG_NONE;
+		head[i] = i;
+	}
+
+	for (uint32_t i = 0; i < edge_count; ++i)
+	{
+		uint32_t from = edges[i].from, to = edges[i].to;
+
+		/* only tails join heads, and never into a cycle */
+		if (next[from] != CFG_NONE || prev[to] != CFG_NONE
+		    || head[from] == to)
+			continue;
+
+		next[from] = to;
+		prev[to] = from;
+		for (uint32_t node = to; node != CFG_NONE; node = next[node])
+			head[node] = head[from];
+	}
+
+	/* chains in original order, which puts the entry block first */
+	struct vector_u32_t *layout = vector_u32_new(len);
+	for (uint32_t i = 0; i < len; ++i)
+	{
+		if (!cfg_reachable(cfg, i) || prev[i] != CFG_NONE)
+			continue;
+
+		for (uint32_t node = i; node != CFG_NONE; node = next[node])
+			vector_u32_push(layout, node);
+	}
+
+	free(head);
+	free(prev);
+	free(next);
+	free(edges);
+	return layout;
+}
@@ -0,0 +1,63 @@
+/**
+ * cfg.h
+ * Control flow graph analyses.
+ */
+
+#ifndef _CFG_H_
+#define _CFG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hashtable.h"
+#include "koopa.h"
+#include "vector.h"
+
+#define CFG_NONE UINT32_MAX
+
+/* basic blocks are numbered in the order they appear in the function; the
+ * virtual exit node, which every returning block flows into, is numbered
+ * `len`. */
+struct cfg_t {
+	uint32_t len;
+	const koopa_raw_basic_block_t *bbs;
+	htable_ptru32_t indices;
+
+	struct vector_u32_t **succs;
+	struct vector_u32_t **preds;
+
+	/* reverse postorder of reachable blocks */
+	struct vector_u32_t *rpo;
+
+	/* CFG_NONE if unreachable, or can't reach the exit, respectively */
+	uint32_t *idom;
+	uint32_t *ipdom;
+	/* depth-first intervals of the trees, for dominance queries */
+	uint32_t *dom_enter, *dom_leave;
+	uint32_t *pdom_enter, *pdom_leave;
+
+	/* innermost natural loop containing each block */
+	uint32_t *header;
+	uint32_t *depth;
+};
+
+/* Build CFG of given function and run analyses over it. */
+struct cfg_t *cfg_new(koopa_raw_function_t function);
+void cfg_delete(struct cfg_t *cfg);
+
+uint32_t cfg_index(const struct cfg_t *cfg,
+		   koopa_raw_basic_block_t basic_block);
+bool cfg_reachable(const struct cfg_t *cfg, uint32_t bb);
+
+/* dominance queries. CFG_NONE for lack of common (post-)dominator */
+bool cfg_dominates(const struct cfg_t *cfg, uint32_t a, uint32_t b);
+bool cfg_postdominates(const struct cfg_t *cfg, uint32_t a, uint32_t b);
+uint32_t cfg_common_dominator(const struct cfg_t *cfg, uint32_t a, uint32_t b);
+uint32_t cfg_common_postdominator(const struct cfg_t *cfg, uint32_t a,
+				  uint32_t b);
+
+/* Order reachable blocks so that the likeliest successor of each block
+ * follows it whenever possible. The entry block comes first. */
+struct vector_u32_t *cfg_layout(const struct cfg_t *cfg);
+
+#endif//_CFG_H_
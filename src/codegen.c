@@ -8,16 +8,25 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "asm.h"
+#include "cache.h"
+#include "cfg.h"
 #include "hashtable.h"
 #include "codegen.h"
+#include "compress.h"
 #include "koopaext.h"
 #include "macros.h"
+#include "peephole.h"
+#include "pool.h"
+#include "schedule.h"
 #include "vector.h"
 #include "yield.h"
 
-/* Optional<Variant<ValuePtr, ValueIndex, StackOffset, GlobalAddress>> */
+/* Optional<Variant<ValuePtr, Location, StackOffset, GlobalAddress,
+ *                  Immediate>> */
 struct variant_t {
 	enum {
 		NONE = 0,
@@ -25,84 +34,137 @@ struct variant_t {
 		OUT,
 		STACK,
 		GLOBAL,
+		IMM,
 	} tag;
 	union {
 		koopa_raw_value_t value;
 		uint32_t out;
 		uint32_t stack;
 		koopa_raw_value_t global;
+		int32_t imm;
 	};
 };
 
+/* live range of a value inside its basic block, in instruction indices */
+struct live_t {
+	koopa_raw_value_t value;
+	uint32_t def;
+	uint32_t last;
+	uint32_t loc;
+};
+
+/* allocation result of a basic block */
+struct alloc_t {
+	uint32_t len;
+	// touches spill slots or callee-saved registers
+	bool framed;
+	// spill slot -> stack slot of the frame
+	uint32_t spill_count;
+	uint32_t *slots;
+	struct live_t lives[];
+};
+
 /* state variables */
-static FILE *m_output;
-static htable_ppuu32_t m_ht_outs;
-static htable_ptru32_t m_ht_stacks;
+static _Thread_local FILE *m_output;
+static bool m_compressed;
+static uint32_t m_jobs = 1;
+static _Thread_local htable_ppuu32_t m_ht_outs;
+static _Thread_local htable_ptru32_t m_ht_stacks;
+static _Thread_local htable_ptru32_t m_ht_locs;
+
+/* what a basic block does to the stack frame */
+enum frame_e {
+	FRAMELESS = 0,
+	FRAME_SETUP = 1 << 0,
+	FRAME_TEARDOWN = 1 << 1,
+};
 
 /* per-function context */
-static struct {
-	uint32_t var_count;
-	uint32_t val_count;
+static _Thread_local struct {
 	uint32_t arg_count;
-	uint32_t par_spill;
+	uint32_t slot_count;
+	uint32_t save_count;
+	uint32_t callee_saved;
 	uint32_t stack_size;
 	uint32_t bb_idx;
+	// basic block emitted right after the current one, CFG_NONE if none
+	uint32_t next_bb;
+	bool leaf;
+	struct cfg_t *cfg;
+	struct alloc_t **allocs;
+	// enum frame_e for each basic block
+	struct vector_u32_t *frames;
+	struct vector_u32_t *layout;
 } m_fn;
 
 /* per-basic block context */
-static struct {
-	uint32_t reg_idx;
-	uint32_t out_idx;
+static _Thread_local struct {
+	uint32_t pos;
+	uint32_t dest;
 } m_bb;
 
 /* emitters */
 #define emit(format, ...) \
 	fprintf(m_output, format __VA_OPT__(,) __VA_ARGS__)
 
-/* register limits */
-// t5, t6 reserved for spilling
-#define T_MAX (7 - 2)
+/* locations. numbers below REG_COUNT are x-registers, the rest are spill
+ * slots */
+#define REG_COUNT 32
+#define LOC_NONE UINT32_MAX
+#define A0 10
+#define T5 30
+#define T6 31
 #define A_MAX 8
-#define R_MAX (T_MAX + A_MAX)
+
+#define is_slot(loc) ((loc) >= REG_COUNT)
+#define is_callee_saved(loc) \
+	((loc) == 8 || (loc) == 9 || ((loc) >= 18 && (loc) <= 27))
+
+static const char *const REG_NAMES[REG_COUNT] = {
+	"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+	"s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+	"a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+	"s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+
+/* allocation order. t5, t6 are reserved for spilling; a0 and up are taken
+ * last since calls need them for arguments */
+static const uint8_t CALLER_SAVED[] = {
+	5, 6, 7, 28, 29, 17, 16, 15, 14, 13, 12, 11, 10,
+};
+// in loops with RVC, x8-x15 first, as most compressed forms only take those
+static const uint8_t CALLER_SAVED_RVC[] = {
+	15, 14, 13, 12, 11, 10, 5, 6, 7, 28, 29, 17, 16,
+};
+static const uint8_t CALLEE_SAVED[] = {
+	8, 9, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27,
+};
 
 /* getters */
-#define saved_regs min(m_fn.val_count, R_MAX)
-#define spill_vals max(m_fn.val_count, R_MAX) - R_MAX
-#define regst_args min(m_fn.arg_count, A_MAX)
-#define spill_args max(m_fn.arg_count, A_MAX) - A_MAX
-
-#define m_out_sp \
-	((m_bb.out_idx - R_MAX + m_fn.var_count + saved_regs + spill_args) \
-	 * sizeof(int32_t))
-#define reg_sp \
-	((reg_idx - R_MAX + m_fn.var_count + saved_regs + spill_args) \
-	 * sizeof(int32_t))
-#define variant_sp \
-	((variant->out - R_MAX + m_fn.var_count + saved_regs + spill_args) \
-	 * sizeof(int32_t))
+#define spill_args (max(m_fn.arg_count, A_MAX) - A_MAX)
+
+/* (high)
+ * 1. return address;
+ * 2. callee-saved registers;
+ * 3. stack slots, shared by local variables and spilled values;
+ * 4. caller-saved registers live across calls;
+ * 5. spilled arguments;
+ * (low) */
+#define save_sp(i) ((spill_args + (i)) * sizeof(int32_t))
+#define frame_sp(i) ((spill_args + m_fn.save_count + (i)) * sizeof(int32_t))
+#define slot_sp(loc) \
+	frame_sp(m_fn.allocs[m_fn.bb_idx]->slots[(loc) - REG_COUNT])
+#define callee_sp(i) frame_sp(m_fn.slot_count + (i))
 
 static void oper(const char *op, bool self_repeat)
 {
+	const char *dest = is_slot(m_bb.dest) ? "t5" : REG_NAMES[m_bb.dest];
+
 	if (self_repeat)
-	{
-		if (m_bb.out_idx < T_MAX)
-			emit("  %s t%d, t%d\n", op, m_bb.out_idx, m_bb.out_idx);
-		else if (m_bb.out_idx < R_MAX - regst_args)
-			emit("  %s a%d, a%d\n", op,
-			     m_bb.out_idx - T_MAX + m_fn.arg_count,
-			     m_bb.out_idx - T_MAX + m_fn.arg_count);
-		else
-			emit("  %s t5, t5\n", op);
-	}
+		emit("  %s %s, %s\n", op, dest, dest);
 	else
 	{
-		if (m_bb.out_idx < T_MAX)
-			emit("  %s t%d, ", op, m_bb.out_idx);
-		else if (m_bb.out_idx < R_MAX - regst_args)
-			emit("  %s a%d, ", op,
-			     m_bb.out_idx - T_MAX + m_fn.arg_count);
-		else
-			emit("  %s t5, ", op);
+		emit("  %s %s, ", op, dest);
 
 		while (m_yield_end != 0)
 		{
@@ -114,49 +176,24 @@ static void oper(const char *op, bool self_repeat)
 		}
 	}
 
-	if (m_bb.out_idx >= R_MAX - regst_args)
-		emit("  sw t5, %lu(sp)\n", m_out_sp);
+	if (is_slot(m_bb.dest))
+		emit("  sw t5, %lu(sp)\n", slot_sp(m_bb.dest));
 }
 
 static void opnd(struct variant_t *variant)
 {
-	uint32_t reg_idx = def(m_bb.reg_idx);
 	def(variant);
 
 	switch (variant->tag)
 	{
 	case VALUE:
 		/* immediate */
-		if (variant->value->kind.tag == KOOPA_RVT_INTEGER)
-		{
-			uint32_t value =
-				variant->value->kind.data.integer.value;
-
-			if (value == 0)
-				yield(emit("x0"));
-
-			if (reg_idx < T_MAX)
-				emit("  li t%d, %d\n", reg_idx, value);
-			else if (reg_idx < R_MAX - regst_args)
-				emit("  li a%d, %d\n",
-				     reg_idx - T_MAX + m_fn.arg_count, value);
-			else
-				emit("  li t%c, %d\n", '5' + m_yield_end,
-				     value);
-		}
-
-		/* register */
-		++m_bb.reg_idx;
+		assert(variant->value->kind.tag == KOOPA_RVT_INTEGER);
+		if (variant->value->kind.data.integer.value == 0)
+			yield(emit("zero"));
 
-		if (reg_idx < T_MAX)
-			yield(emit("t%d", use(m_bb.reg_idx)));
-		else if (reg_idx < R_MAX - regst_args)
-			yield(emit("a%d",
-				   use(m_bb.reg_idx) - T_MAX + m_fn.arg_count));
-
-		/* stack */
-		if (variant->value->kind.tag != KOOPA_RVT_INTEGER)
-			emit("  lw t%c, %lu(sp)\n", '5' + m_yield_end, reg_sp);
+		emit("  li t%c, %d\n", '5' + m_yield_end,
+		     variant->value->kind.data.integer.value);
 
 		if (m_yield_end == 0)
 			yield(emit("t5"));
@@ -164,13 +201,11 @@ static void opnd(struct variant_t *variant)
 			yield(emit("t6"));
 		break;
 	case OUT:
-		if (variant->out < T_MAX)
-			yield(emit("t%d", use(variant)->out));
-		else if (variant->out < R_MAX - regst_args)
-			yield(emit("a%d",
-				   use(variant)->out - T_MAX + m_fn.arg_count));
+		if (!is_slot(variant->out))
+			yield(emit("%s", REG_NAMES[use(variant)->out]));
 
-		emit("  lw t%c, %lu(sp)\n", '5' + m_yield_end, variant_sp);
+		emit("  lw t%c, %lu(sp)\n", '5' + m_yield_end,
+		     slot_sp(variant->out));
 
 		if (m_yield_end == 0)
 			yield(emit("t5"));
@@ -181,22 +216,6 @@ static void opnd(struct variant_t *variant)
 		yield(emit("%u(sp)", use(variant)->stack));
 		break;
 	case GLOBAL:
-		++m_bb.reg_idx;
-
-		if (reg_idx < T_MAX)
-		{
-			emit("  la t%d, %s\n", reg_idx,
-			     variant->global->name + 1);
-			yield(emit("0(t%d)", use(m_bb.reg_idx)));
-		}
-		else if (reg_idx < R_MAX - regst_args)
-		{
-			emit("  la a%d, %s\n", reg_idx - T_MAX + m_fn.arg_count,
-			     variant->global->name + 1);
-			yield(emit("0(a%d)",
-				   use(m_bb.reg_idx) - T_MAX + m_fn.arg_count));
-		}
-
 		emit("  la t%c, %s\n", '5' + m_yield_end,
 		     variant->global->name + 1);
 
@@ -204,6 +223,10 @@ static void opnd(struct variant_t *variant)
 			yield(emit("0(t5)"));
 		else if (m_yield_end == 1)
 			yield(emit("0(t6)"));
+		break;
+	case IMM:
+		yield(emit("%d", use(variant)->imm));
+		break;
 	default:
 		panic("value is NONE");
 	}
@@ -227,6 +250,161 @@ static void inst(const char *op, ...)
 	oper(op, false);
 }
 
+/* instruction selection */
+#define IMM_MIN (-2048)
+#define IMM_MAX 2047
+
+static bool as_imm(koopa_raw_value_t value, int32_t *imm)
+{
+	if (value->kind.tag != KOOPA_RVT_INTEGER)
+		return false;
+
+	int32_t integer = value->kind.data.integer.value;
+	if (integer < IMM_MIN || integer > IMM_MAX)
+		return false;
+
+	*imm = integer;
+	return true;
+}
+
+static bool is_commutative(koopa_raw_binary_op_t op)
+{
+	switch (op)
+	{
+	case KOOPA_RBO_NOT_EQ:
+	case KOOPA_RBO_EQ:
+	case KOOPA_RBO_ADD:
+	case KOOPA_RBO_MUL:
+	case KOOPA_RBO_AND:
+	case KOOPA_RBO_OR:
+	case KOOPA_RBO_XOR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static const char *branch_op(koopa_raw_binary_op_t op, bool inverse)
+{
+	if (inverse)
+		switch (op)
+		{
+		case KOOPA_RBO_NOT_EQ:
+			return "beq";
+		case KOOPA_RBO_EQ:
+			return "bne";
+		case KOOPA_RBO_GT:
+			return "ble";
+		case KOOPA_RBO_LT:
+			return "bge";
+		case KOOPA_RBO_GE:
+			return "blt";
+		case KOOPA_RBO_LE:
+			return "bgt";
+		default:
+			return NULL;
+		}
+
+
+	switch (op)
+	{
+	case KOOPA_RBO_NOT_EQ:
+		return "bne";
+	case KOOPA_RBO_EQ:
+		return "beq";
+	case KOOPA_RBO_GT:
+		return "bgt";
+	case KOOPA_RBO_LT:
+		return "blt";
+	case KOOPA_RBO_GE:
+		return "bge";
+	case KOOPA_RBO_LE:
+		return "ble";
+	default:
+		return NULL;
+	}
+}
+
+/* "Hacker's Delight", 10-4: magic number for signed division by d >= 2 */
+static void magic(uint32_t d, int32_t *multiplier, uint32_t *shift)
+{
+	const uint32_t two31 = 1u << 31;
+	uint32_t anc = two31 - 1 - two31 % d;
+	uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+	uint32_t q2 = two31 / d, r2 = two31 - q2 * d;
+	uint32_t p = 31, delta;
+
+	do
+	{
+		++p;
+		q1 <<= 1;
+		r1 <<= 1;
+		if (r1 >= anc)
+		{
+			++q1;
+			r1 -= anc;
+		}
+		q2 <<= 1;
+		r2 <<= 1;
+		if (r2 >= d)
+		{
+			++q2;
+			r2 -= d;
+		}
+		delta = d - r2;
+	}
+	while (q1 < delta || (q1 == delta && r1 == 0));
+
+	*multiplier = q2 + 1;
+	*shift = p - 32;
+}
+
+/* comparison right before the branch that consumes it, which is folded into
+ * the branch. NULL if there's none */
+static koopa_raw_value_t fused_cond(koopa_raw_basic_block_t basic_block)
+{
+	const koopa_raw_slice_t *insts = &basic_block->insts;
+	if (insts->len < 2)
+		return NULL;
+
+	koopa_raw_value_t last = insts->buffer[insts->len - 1];
+	koopa_raw_value_t cond = insts->buffer[insts->len - 2];
+	if (last->kind.tag != KOOPA_RVT_BRANCH
+	    || last->kind.data.branch.cond != cond
+	    || cond->kind.tag != KOOPA_RVT_BINARY
+	    || !branch_op(cond->kind.data.binary.op, false))
+		return NULL;
+
+	return cond;
+}
+
+/* register holding `variant`, loaded into `scratch` if it's not in one */
+static const char *operand_reg(const struct variant_t *variant,
+			       uint32_t scratch)
+{
+	switch (variant->tag)
+	{
+	case VALUE:
+		assert(variant->value->kind.tag == KOOPA_RVT_INTEGER);
+		if (variant->value->kind.data.integer.value == 0)
+			return "zero";
+
+		emit("  li %s, %d\n", REG_NAMES[scratch],
+		     variant->value->kind.data.integer.value);
+		return REG_NAMES[scratch];
+	case OUT:
+		if (!is_slot(variant->out))
+			return REG_NAMES[variant->out];
+
+		emit("  lw %s, %lu(sp)\n", REG_NAMES[scratch],
+		     slot_sp(variant->out));
+		return REG_NAMES[scratch];
+	default:
+		panic("value is not in a register");
+		return NULL;
+	}
+}
+
 /* declarations */
 static struct variant_t raw_value(koopa_raw_value_t raw);
 static void raw_basic_block(koopa_raw_basic_block_t basic_block);
@@ -234,8 +412,26 @@ static void raw_function(koopa_raw_function_t function);
 static void raw_type(koopa_raw_type_t type);
 
 /* register allocation */
-static void count_vars(koopa_raw_function_t function)
+static bool is_spilled_param(koopa_raw_value_t alloc)
 {
+	for (uint32_t i = 0; i < alloc->used_by.len; ++i)
+	{
+		koopa_raw_value_t user = alloc->used_by.buffer[i];
+		if (user->kind.tag != KOOPA_RVT_STORE)
+			continue;
+
+		koopa_raw_value_t value = user->kind.data.store.value;
+		if (value->kind.tag == KOOPA_RVT_FUNC_ARG_REF
+		    && value->kind.data.func_arg_ref.index >= A_MAX)
+			return true;
+	}
+
+	return false;
+}
+
+static uint32_t count_args(koopa_raw_function_t function)
+{
+	uint32_t arg_count = 0;
 	for (uint32_t i = 0; i < function->bbs.len; ++i)
 	{
 		koopa_raw_basic_block_t basic_block = function->bbs.buffer[i];
@@ -244,103 +440,656 @@ static void count_vars(koopa_raw_function_t function)
 		{
 			koopa_raw_value_t value = basic_block->insts.buffer[j];
 
-			if (value->kind.tag != KOOPA_RVT_ALLOC)
-				continue;
+			if (value->kind.tag == KOOPA_RVT_CALL)
+				arg_count = max(arg_count,
+						value->kind.data.call.args.len);
+		}
+	}
+
+	return arg_count;
+}
+
+static bool is_leaf(koopa_raw_function_t function)
+{
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		koopa_raw_basic_block_t basic_block = function->bbs.buffer[i];
+
+		for (uint32_t j = 0; j < basic_block->insts.len; ++j)
+		{
+			koopa_raw_value_t value = basic_block->insts.buffer[j];
+
+			if (value->kind.tag == KOOPA_RVT_CALL)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static void extend(struct alloc_t *alloc, koopa_raw_value_t value,
+		   uint32_t pos)
+{
+	/* indices of live ranges are kept in `m_ht_locs` until allocated */
+	uint32_t *it = htable_lookup(m_ht_locs, value);
+	if (!it || *it >= alloc->len || alloc->lives[*it].value != value)
+		return;
+
+	alloc->lives[*it].last = pos;
+}
+
+static void extend_uses(struct alloc_t *alloc, koopa_raw_value_t value,
+			uint32_t pos)
+{
+	const koopa_raw_value_kind_t *kind = &value->kind;
+
+	switch (kind->tag)
+	{
+	case KOOPA_RVT_LOAD:
+		extend(alloc, kind->data.load.src, pos);
+		break;
+	case KOOPA_RVT_STORE:
+		extend(alloc, kind->data.store.value, pos);
+		extend(alloc, kind->data.store.dest, pos);
+		break;
+	case KOOPA_RVT_BINARY:
+		extend(alloc, kind->data.binary.lhs, pos);
+		extend(alloc, kind->data.binary.rhs, pos);
+		break;
+	case KOOPA_RVT_BRANCH:
+		extend(alloc, kind->data.branch.cond, pos);
+		break;
+	case KOOPA_RVT_CALL:
+		for (uint32_t i = 0; i < kind->data.call.args.len; ++i)
+			extend(alloc, kind->data.call.args.buffer[i], pos);
+		break;
+	case KOOPA_RVT_RETURN:
+		if (kind->data.ret.value)
+			extend(alloc, kind->data.ret.value, pos);
+		break;
+	default:
+		break;
+	}
+}
+
+static uint32_t pick_reg(const uint8_t *order, size_t len,
+			 const uint32_t *ends, uint32_t reserved, uint32_t pos)
+{
+	for (size_t i = 0; i < len; ++i)
+		if (!(reserved & (1u << order[i])) && ends[order[i]] <= pos)
+			return order[i];
+
+	return LOC_NONE;
+}
+
+static uint32_t pick_slot(struct vector_u32_t *slot_ends, uint32_t from,
+			  uint32_t to)
+{
+	uint32_t slot = 0;
+	while (slot < slot_ends->size && slot_ends->data[slot] > from)
+		++slot;
+
+	if (slot == slot_ends->size)
+		vector_u32_push(slot_ends, to);
+	else
+		slot_ends->data[slot] = to;
+
+	return REG_COUNT + slot;
+}
+
+/* linear scan over the values of a basic block, which never outlive it.
+ * values live across calls go to callee-saved registers if possible, so that
+ * they are saved once in the prologue rather than around every call; the
+ * rest go to caller-saved ones, and only those of them still live after a
+ * call are saved around it. */
+static struct alloc_t *alloc_block(koopa_raw_basic_block_t basic_block,
+				   uint32_t reserved, bool compact)
+{
+	const uint8_t *caller_saved = compact ? CALLER_SAVED_RVC : CALLER_SAVED;
+
+	const koopa_raw_slice_t *insts = &basic_block->insts;
+	koopa_raw_value_t fused = fused_cond(basic_block);
+
+	uint32_t len = 0;
+	for (uint32_t i = 0; i < insts->len; ++i)
+		if (((koopa_raw_value_t)insts->buffer[i])->ty->tag
+		    == KOOPA_RTT_INT32)
+			++len;
+
+	struct alloc_t *alloc = malloc(sizeof(*alloc)
+				       + sizeof(struct live_t) * len);
+	alloc->len = 0;
+	alloc->framed = false;
+	alloc->slots = NULL;
+
+	/* live ranges, and number of calls before each instruction */
+	uint32_t *calls = malloc(sizeof(uint32_t) * (insts->len + 1));
+	calls[0] = 0;
+	for (uint32_t i = 0; i < insts->len; ++i)
+	{
+		koopa_raw_value_t value = insts->buffer[i];
+
+		/* operands of a fused comparison are used by the branch */
+		if (fused && value->kind.tag == KOOPA_RVT_BRANCH)
+			extend_uses(alloc, fused, i);
+		extend_uses(alloc, value, i);
+		calls[i + 1] = calls[i] + (value->kind.tag == KOOPA_RVT_CALL);
+
+		if (value->ty->tag != KOOPA_RTT_INT32 || value == fused)
+			continue;
+
+		htable_insert(m_ht_locs, value, alloc->len);
+		alloc->lives[alloc->len++] = (struct live_t) {
+			.value = value, .def = i, .last = i, .loc = LOC_NONE,
+		};
+	}
+
+	uint32_t ends[REG_COUNT] = { 0 };
+	struct live_t *owners[REG_COUNT] = { NULL };
+	struct vector_u32_t *slot_ends = vector_u32_new(0);
 
-			/* process spilled params later */
-			if (m_fn.var_count + m_fn.par_spill
-			    < function->params.len
-			    && m_fn.var_count + m_fn.par_spill >= A_MAX)
+	for (uint32_t i = 0; i < alloc->len; ++i)
+	{
+		struct live_t *live = &alloc->lives[i];
+		bool crosses = calls[live->last] > calls[live->def + 1];
+
+		uint32_t reg = crosses
+			? pick_reg(CALLEE_SAVED, sizeof(CALLEE_SAVED), ends,
+				   reserved, live->def)
+			: pick_reg(caller_saved, sizeof(CALLER_SAVED), ends,
+				   reserved, live->def);
+		if (reg == LOC_NONE)
+			reg = crosses
+				? pick_reg(caller_saved, sizeof(CALLER_SAVED),
+					   ends, reserved, live->def)
+				: pick_reg(CALLEE_SAVED, sizeof(CALLEE_SAVED),
+					   ends, reserved, live->def);
+
+		/* spill whichever ends last */
+		if (reg == LOC_NONE)
+		{
+			for (uint32_t r = 0; r < REG_COUNT; ++r)
+				if (owners[r] && !(reserved & (1u << r))
+				    && ends[r] > live->def
+				    && (reg == LOC_NONE || ends[r] > ends[reg]))
+					reg = r;
+
+			if (ends[reg] <= live->last)
 			{
-				++m_fn.par_spill;
+				live->loc = pick_slot(slot_ends, live->def,
+						      live->last);
 				continue;
 			}
 
-			uint32_t offset = sizeof(int32_t)
-					  * (saved_regs + spill_args
-					     + m_fn.var_count);
-			htable_insert(m_ht_stacks, value, offset);
-			++m_fn.var_count;
+			struct live_t *victim = owners[reg];
+			victim->loc = pick_slot(slot_ends, victim->def,
+						victim->last);
 		}
+
+		live->loc = reg;
+		ends[reg] = live->last;
+		owners[reg] = live;
 	}
+
+	/* caller-saved registers to save around each call */
+	for (uint32_t i = 0; i < insts->len; ++i)
+	{
+		koopa_raw_value_t value = insts->buffer[i];
+		if (value->kind.tag != KOOPA_RVT_CALL)
+			continue;
+
+		uint32_t save_count = 0;
+		for (uint32_t j = 0; j < alloc->len; ++j)
+		{
+			struct live_t *live = &alloc->lives[j];
+			if (live->def < i && i < live->last
+			    && !is_slot(live->loc)
+			    && !is_callee_saved(live->loc))
+				++save_count;
+		}
+		m_fn.save_count = max(m_fn.save_count, save_count);
+	}
+
+	for (uint32_t i = 0; i < alloc->len; ++i)
+	{
+		struct live_t *live = &alloc->lives[i];
+
+		*htable_lookup(m_ht_locs, live->value) = live->loc;
+		if (is_callee_saved(live->loc))
+		{
+			m_fn.callee_saved |= 1u << live->loc;
+			alloc->framed = true;
+		}
+	}
+	if (slot_ends->size > 0)
+		alloc->framed = true;
+	alloc->spill_count = slot_ends->size;
+
+	vector_u32_delete(slot_ends);
+	free(calls);
+	return alloc;
 }
 
-/* really need some kind of garbage collection */
-static struct vector_u32_t *m_val_counts;
-static void count_vals(void *basic_block)
+static void alloc_function(koopa_raw_function_t function)
 {
-	koopa_raw_basic_block_t _basic_block = basic_block;
+	/* outgoing arguments, and incoming ones until they're stored */
+	uint32_t args = min(m_fn.arg_count, A_MAX);
+	uint32_t params = min(function->params.len, A_MAX);
 
-	uint32_t val_count = 0;
-	for (uint32_t i = 0; i < _basic_block->insts.len; ++i)
+	m_fn.allocs = malloc(sizeof(*m_fn.allocs) * function->bbs.len);
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		uint32_t reserved = ((1u << max(args, i == 0 ? params : 0))
+				     - 1) << A0;
+		bool hot = m_fn.cfg->depth[i] > 0;
+		m_fn.allocs[i] = alloc_block(function->bbs.buffer[i],
+					     reserved, m_compressed && hot);
+	}
+}
+/* stack slots. local variables and spilled values share slots as long as
+ * they're never live at the same time. a variable is live from a store to
+ * the loads that may read it back, and a spilled value never outlives its
+ * basic block. */
+#define bit_words(n) (((n) + 31) / 32)
+#define bit_test(set, i) ((set)[(i) / 32] & (1u << ((i) % 32)))
+#define bit_set(set, i) ((set)[(i) / 32] |= 1u << ((i) % 32))
+#define bit_clear(set, i) ((set)[(i) / 32] &= ~(1u << ((i) % 32)))
+
+/* variables whose address never escapes loads and stores of its own */
+static bool is_private(koopa_raw_value_t alloc)
+{
+	for (uint32_t i = 0; i < alloc->used_by.len; ++i)
 	{
-		koopa_raw_value_t value = _basic_block->insts.buffer[i];
+		koopa_raw_value_t user = alloc->used_by.buffer[i];
+
+		if (user->kind.tag == KOOPA_RVT_LOAD)
+			continue;
+		if (user->kind.tag == KOOPA_RVT_STORE
+		    && user->kind.data.store.dest == alloc
+		    && user->kind.data.store.value != alloc)
+			continue;
 
-		if (value->ty->tag == KOOPA_RTT_INT32)
-			++val_count;
+		return false;
 	}
-	vector_u32_push(m_val_counts, val_count);
+
+	return true;
 }
 
-static struct vector_u32_t *m_arg_counts;
-static void count_args(void *basic_block)
+/* variable loaded or stored by given instruction, UINT32_MAX if none */
+static uint32_t var_of(koopa_raw_value_t value, htable_ptru32_t vars,
+		       bool *store)
 {
-	koopa_raw_basic_block_t _basic_block = basic_block;
+	koopa_raw_value_t var;
+	if (value->kind.tag == KOOPA_RVT_LOAD)
+		var = value->kind.data.load.src;
+	else if (value->kind.tag == KOOPA_RVT_STORE)
+		var = value->kind.data.store.dest;
+	else
+		return UINT32_MAX;
 
-	uint32_t arg_count = 0;
-	for (uint32_t i = 0; i < _basic_block->insts.len; ++i)
+	*store = value->kind.tag == KOOPA_RVT_STORE;
+	uint32_t *it = htable_lookup(vars, (void *)var);
+	return it ? *it : UINT32_MAX;
+}
+
+static void color_slots(void)
+{
+	const struct cfg_t *cfg = m_fn.cfg;
+	uint32_t len = cfg->len;
+
+	/* spilled params stay in the caller's frame */
+	struct vector_ptr_t *vars = vector_ptr_new(16);
+	htable_ptru32_t indices = htable_ptru32_new();
+	for (uint32_t i = 0; i < len; ++i)
+	{
+		koopa_raw_basic_block_t basic_block = cfg->bbs[i];
+
+		for (uint32_t j = 0; j < basic_block->insts.len; ++j)
+		{
+			koopa_raw_value_t value = basic_block->insts.buffer[j];
+
+			if (value->kind.tag != KOOPA_RVT_ALLOC
+			    || is_spilled_param(value))
+				continue;
+
+			htable_insert(indices, (void *)value, vars->size);
+			vector_ptr_push(vars, (void *)value);
+		}
+	}
+	uint32_t n = vars->size;
+	uint32_t words = bit_words(n);
+
+	/* a scan over all users each, so it's done once */
+	bool *private = malloc(sizeof(bool) * max(n, 1u));
+	for (uint32_t i = 0; i < n; ++i)
+		private[i] = is_private(vars->data[i]);
+
+	/* liveness: upward-exposed loads, and stores, of each block */
+	uint32_t *gen = calloc(len * words, sizeof(uint32_t));
+	uint32_t *kill = calloc(len * words, sizeof(uint32_t));
+	uint32_t *live_in = calloc(len * words, sizeof(uint32_t));
+	uint32_t *live_out = calloc(len * words, sizeof(uint32_t));
+	for (uint32_t i = 0; i < len; ++i)
+	{
+		const koopa_raw_slice_t *insts = &cfg->bbs[i]->insts;
+
+		for (uint32_t j = 0; j < insts->len; ++j)
+		{
+			bool store;
+			uint32_t var = var_of(insts->buffer[j], indices,
+					      &store);
+			if (var == UINT32_MAX)
+				continue;
+
+			if (store)
+				bit_set(&kill[i * words], var);
+			else if (!bit_test(&kill[i * words], var))
+				bit_set(&gen[i * words], var);
+		}
+	}
+
+	for (bool changed = true; changed; )
+	{
+		changed = false;
+		for (uint32_t i = len; i-- > 0; )
+		{
+			const struct vector_u32_t *succs = cfg->succs[i];
+
+			for (uint32_t w = 0; w < words; ++w)
+			{
+				uint32_t out = 0;
+				for (uint32_t j = 0; j < succs->size; ++j)
+					if (succs->data[j] < len)
+						out |= live_in[succs->data[j]
+							       * words + w];
+
+				uint32_t in = gen[i * words + w]
+					      | (out & ~kill[i * words + w]);
+				changed |= in != live_in[i * words + w];
+				live_out[i * words + w] = out;
+				live_in[i * words + w] = in;
+			}
+		}
+	}
+
+	/* interference: a store clobbers the slot of its variable while
+	 * anything else is still live */
+	uint32_t *interferes = calloc(n * words, sizeof(uint32_t));
+	uint32_t *live = malloc(sizeof(uint32_t) * max(words, 1u));
+	for (uint32_t i = 0; i < len; ++i)
+	{
+		const koopa_raw_slice_t *insts = &cfg->bbs[i]->insts;
+		memcpy(live, &live_out[i * words], sizeof(uint32_t) * words);
+
+		for (uint32_t j = insts->len; j-- > 0; )
+		{
+			bool store;
+			uint32_t var = var_of(insts->buffer[j], indices,
+					      &store);
+			if (var == UINT32_MAX)
+				continue;
+
+			if (!store)
+			{
+				bit_set(live, var);
+				continue;
+			}
+
+			bit_clear(live, var);
+			for (uint32_t other = 0; other < n; ++other)
+				if (bit_test(live, other))
+				{
+					bit_set(&interferes[var * words],
+						other);
+					bit_set(&interferes[other * words],
+						var);
+				}
+		}
+	}
+
+	/* greedy coloring in order of appearance. variables whose address
+	 * escapes get slots of their own */
+	uint32_t *colors = malloc(sizeof(uint32_t) * max(n, 1u));
+	uint32_t color_count = 0;
+	for (uint32_t i = 0; i < n; ++i)
+	{
+		colors[i] = color_count;
+		if (private[i])
+			for (uint32_t color = 0; color < color_count; ++color)
+			{
+				bool taken = false;
+				for (uint32_t j = 0; j < i && !taken; ++j)
+					taken = colors[j] == color
+						&& (bit_test(&interferes
+							     [i * words], j)
+						    || !private[j]);
+				if (!taken)
+				{
+					colors[i] = color;
+					break;
+				}
+			}
+
+		if (colors[i] == color_count)
+			++color_count;
+		htable_insert(m_ht_stacks, vars->data[i], frame_sp(colors[i]));
+	}
+
+	/* spill slots take whichever slots are idle throughout the block */
+	m_fn.slot_count = color_count;
+	bool *busy = malloc(sizeof(bool) * max(color_count, 1u));
+	for (uint32_t i = 0; i < len; ++i)
+	{
+		struct alloc_t *alloc = m_fn.allocs[i];
+		alloc->slots = malloc(sizeof(uint32_t)
+				      * max(alloc->spill_count, 1u));
+
+		memset(busy, 0, sizeof(bool) * color_count);
+		for (uint32_t j = 0; j < n; ++j)
+			if (!private[j]
+			    || bit_test(&live_in[i * words], j)
+			    || bit_test(&live_out[i * words], j)
+			    || bit_test(&gen[i * words], j)
+			    || bit_test(&kill[i * words], j))
+				busy[colors[j]] = true;
+
+		uint32_t color = 0;
+		uint32_t extra = color_count;
+		for (uint32_t j = 0; j < alloc->spill_count; ++j)
+		{
+			while (color < color_count && busy[color])
+				++color;
+			alloc->slots[j] = color < color_count ? color++
+							      : extra++;
+		}
+		m_fn.slot_count = max(m_fn.slot_count, extra);
+	}
+
+	free(busy);
+	free(private);
+	free(colors);
+	free(live);
+	free(interferes);
+	free(live_out);
+	free(live_in);
+	free(kill);
+	free(gen);
+	htable_ptru32_delete(indices);
+	vector_ptr_delete(vars);
+}
+
+
+/* frame analysis */
+static bool needs_frame(koopa_raw_basic_block_t basic_block)
+{
+	if (m_fn.allocs[cfg_index(m_fn.cfg, basic_block)]->framed)
+		return true;
+
+	for (uint32_t i = 0; i < basic_block->insts.len; ++i)
+	{
+		koopa_raw_value_t value = basic_block->insts.buffer[i];
+
+		switch (value->kind.tag)
+		{
+		case KOOPA_RVT_CALL:
+			/* return address, saved registers */
+			return true;
+		case KOOPA_RVT_LOAD:
+			if (value->kind.data.load.src->kind.tag
+			    == KOOPA_RVT_ALLOC)
+				return true;
+			break;
+		case KOOPA_RVT_STORE:
+			if (value->kind.data.store.dest->kind.tag
+			    == KOOPA_RVT_ALLOC)
+				return true;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return false;
+}
+/* shrink-wrapping, i.e. set the frame up as late as possible and tear it down
+ * as early as possible. the prologue goes to the top of the nearest common
+ * dominator of all basic blocks that need the frame, and the epilogue goes
+ * right before the terminator of their nearest common post-dominator. the two
+ * of them must enclose each other, and never sit inside a loop. */
+static void frame_analysis(void)
+{
+	struct cfg_t *cfg = m_fn.cfg;
+	uint32_t exit = cfg->len;
+
+	m_fn.frames = vector_u32_fill(cfg->len, FRAMELESS);
+
+	uint32_t save = CFG_NONE;
+	for (uint32_t i = 0; i < cfg->len; ++i)
+		if (cfg_reachable(cfg, i) && needs_frame(cfg->bbs[i]))
+			save = (save == CFG_NONE)
+			       ? i
+			       : cfg_common_dominator(cfg, save, i);
+
+	/* frameless */
+	if (save == CFG_NONE)
+		return;
+
+	uint32_t restore = save;
+	for (uint32_t i = 0; i < cfg->len && restore != CFG_NONE; ++i)
+		if (cfg_reachable(cfg, i) && needs_frame(cfg->bbs[i]))
+			restore = cfg_common_postdominator(cfg, restore, i);
+
+	while (restore != CFG_NONE)
+	{
+		uint32_t this_save = save, this_restore = restore;
+
+		if (!cfg_dominates(cfg, save, restore))
+			save = cfg_common_dominator(cfg, save, restore);
+		if (!cfg_postdominates(cfg, restore, save))
+			restore = cfg_common_postdominator(cfg, restore, save);
+		if (restore == CFG_NONE)
+			break;
+
+		/* hoist out of loops */
+		while (cfg->depth[save] > 0)
+			save = cfg->idom[cfg->header[save]];
+		while (restore != exit && cfg->depth[restore] > 0)
+			restore = cfg->ipdom[restore];
+
+		if (save == this_save && restore == this_restore)
+			break;
+	}
+
+	/* some path never returns, be conservative */
+	if (restore == CFG_NONE)
 	{
-		koopa_raw_value_t value = _basic_block->insts.buffer[i];
+		save = 0;
+		restore = exit;
+	}
 
-		if (value->kind.tag == KOOPA_RVT_CALL)
-			arg_count += value->kind.data.call.args.len;
+	m_fn.frames->data[save] |= FRAME_SETUP;
+	if (restore != exit)
+	{
+		m_fn.frames->data[restore] |= FRAME_TEARDOWN;
+		return;
 	}
-	vector_u32_push(m_arg_counts, arg_count);
+
+	/* torn down at every return */
+	for (uint32_t i = 0; i < cfg->preds[exit]->size; ++i)
+		m_fn.frames->data[cfg->preds[exit]->data[i]] |= FRAME_TEARDOWN;
+}
+
+static void frame_enter(void)
+{
+	if (m_fn.stack_size == 0)
+		return;
+
+	emit("  addi sp, sp, %d\n", -m_fn.stack_size);
+	if (!m_fn.leaf)
+		emit("  sw ra, %lu(sp)\n",
+		     m_fn.stack_size - sizeof(uint32_t));
+
+	uint32_t i = 0;
+	for (uint32_t r = 0; r < REG_COUNT; ++r)
+		if (m_fn.callee_saved & (1u << r))
+			emit("  sw %s, %lu(sp)\n", REG_NAMES[r],
+			     callee_sp(i++));
+}
+
+static void frame_leave(void)
+{
+	if (m_fn.stack_size == 0)
+		return;
+
+	uint32_t i = 0;
+	for (uint32_t r = 0; r < REG_COUNT; ++r)
+		if (m_fn.callee_saved & (1u << r))
+			emit("  lw %s, %lu(sp)\n", REG_NAMES[r],
+			     callee_sp(i++));
+
+	if (!m_fn.leaf)
+		emit("  lw ra, %lu(sp)\n",
+		     m_fn.stack_size - sizeof(uint32_t));
+	emit("  addi sp, sp, %d\n", m_fn.stack_size);
 }
 
 static void function_prologue(koopa_raw_function_t function)
 {
-	/* val_count <- List.map function_bbs count_vals
-	 *              |> List.fold_left max 0;; */
-	m_val_counts = vector_u32_new(function->bbs.len);
-	slice_iter(&function->bbs, count_vals);
-	for (size_t i = 0; i < m_val_counts->size; ++i)
-		m_fn.val_count = max(m_val_counts->data[i], m_fn.val_count);
-	vector_u32_delete(m_val_counts);
-
-	/* arg_count <- List.map function_bbs count_args
-	 *              |> List.fold_left max 0;; */
-	m_arg_counts = vector_u32_new(function->bbs.len);
-	slice_iter(&function->bbs, count_args);
-	for (size_t i = 0; i < m_arg_counts->size; ++i)
-		m_fn.arg_count = max(m_arg_counts->data[i], m_fn.arg_count);
-	vector_u32_delete(m_arg_counts);
-
-	count_vars(function);
-
-	/* (high)
-	 * 1. return address;
-	 * 2. spilled values;
-	 * 3. local variables;
-	 * 4. saved registers;
-	 * 5. spilled arguments;
-	 * (low) */
+	m_fn.leaf = is_leaf(function);
+	m_fn.arg_count = count_args(function);
+	m_fn.cfg = cfg_new(function);
+
+	alloc_function(function);
+	color_slots();
+
 	uint32_t total = 0;
-	// FIXME weird behavior reserving return address
-	total += 4;
-	total += spill_vals;
-	total += m_fn.var_count;
-	total += saved_regs;
+	/* leaf functions don't clobber `ra` */
+	if (!m_fn.leaf)
+		total += 1;
+	total += __builtin_popcount(m_fn.callee_saved);
+	total += m_fn.slot_count;
+	total += m_fn.save_count;
 	total += spill_args;
 
 	// align to 16 bytes
 	m_fn.stack_size = -(-(total * sizeof(int32_t)) & -16);
-	emit("  addi sp, sp, %d\n", -m_fn.stack_size);
-	emit("  sw ra, %lu(sp)\n", m_fn.stack_size - sizeof(uint32_t));
+
+	frame_analysis();
+	m_fn.layout = cfg_layout(m_fn.cfg);
 }
 
-static void function_epilogue()
+static void function_epilogue(koopa_raw_function_t function)
 {
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		free(m_fn.allocs[i]->slots);
+		free(m_fn.allocs[i]);
+	}
+	free(m_fn.allocs);
+	vector_u32_delete(m_fn.layout);
+	vector_u32_delete(m_fn.frames);
+	cfg_delete(m_fn.cfg);
+
 	memset(&m_fn, 0, sizeof(m_fn));
 	memset(&m_bb, 0, sizeof(m_bb));
 }
@@ -353,20 +1102,75 @@ static void raw_kind_load(koopa_raw_load_t *load)
 	inst("lw", &src, NULL);
 }
 
+static void branch_operand(struct variant_t *variant, uint32_t scratch)
+{
+	/* callee-saved registers are about to be restored */
+	if (m_fn.frames->data[m_fn.bb_idx] & FRAME_TEARDOWN
+	    && variant->tag == OUT && is_callee_saved(variant->out))
+	{
+		emit("  mv %s, %s\n", REG_NAMES[scratch],
+		     REG_NAMES[variant->out]);
+		variant->out = scratch;
+	}
+
+	opnd(variant);
+}
+
+static bool falls_through(koopa_raw_basic_block_t target)
+{
+	return m_fn.next_bb != CFG_NONE
+	       && m_fn.next_bb == cfg_index(m_fn.cfg, target);
+}
+
 static void raw_kind_branch(koopa_raw_branch_t *branch)
 {
-	struct variant_t cond = raw_value(branch->cond);
+	koopa_raw_value_t fused = fused_cond(m_fn.cfg->bbs[m_fn.bb_idx]);
+
+	/* branch to whichever target doesn't come next */
+	bool inverse = falls_through(branch->true_bb);
+	koopa_raw_basic_block_t target = inverse
+					 ? branch->false_bb
+					 : branch->true_bb;
+	koopa_raw_basic_block_t other = inverse
+					? branch->true_bb
+					: branch->false_bb;
+
+	if (fused)
+	{
+		koopa_raw_binary_t *binary = &fused->kind.data.binary;
+		struct variant_t lhs = raw_value(binary->lhs);
+		struct variant_t rhs = raw_value(binary->rhs);
+
+		branch_operand(&lhs, T5);
+		branch_operand(&rhs, T6);
+		if (m_fn.frames->data[m_fn.bb_idx] & FRAME_TEARDOWN)
+			frame_leave();
+		emit("  %s ", branch_op(binary->op, inverse));
+		next();
+		emit(", ");
+		next();
+	}
+	else
+	{
+		struct variant_t cond = raw_value(branch->cond);
 
-	opnd(&cond);
-	emit("  bnez ");
-	next();
-	emit(", %s\n", branch->true_bb->name + 1);
-	emit("  j %s\n", branch->false_bb->name + 1);
+		branch_operand(&cond, T5);
+		if (m_fn.frames->data[m_fn.bb_idx] & FRAME_TEARDOWN)
+			frame_leave();
+		emit(inverse ? "  beqz " : "  bnez ");
+		next();
+	}
+	emit(", %s\n", target->name + 1);
+	if (!falls_through(other))
+		emit("  j %s\n", other->name + 1);
 }
 
 static void raw_kind_jump(koopa_raw_jump_t *jump)
 {
-	emit("  j %s\n", jump->target->name + 1);
+	if (m_fn.frames->data[m_fn.bb_idx] & FRAME_TEARDOWN)
+		frame_leave();
+	if (!falls_through(jump->target))
+		emit("  j %s\n", jump->target->name + 1);
 }
 
 static void raw_kind_store(koopa_raw_store_t *store)
@@ -376,9 +1180,8 @@ static void raw_kind_store(koopa_raw_store_t *store)
 		uint32_t index = store->value->kind.data.func_arg_ref.index;
 
 		if (index < A_MAX)
-			emit("  sw a%u, %lu(sp)\n", index,
-			     sizeof(uint32_t) * (spill_args + saved_regs
-						 + index));
+			emit("  sw a%u, %u(sp)\n", index,
+			     *htable_lookup(m_ht_stacks, store->dest));
 		else
 			htable_insert(m_ht_stacks, store->dest,
 				      sizeof(uint32_t) * (index - A_MAX)
@@ -410,72 +1213,216 @@ static void raw_kind_return(koopa_raw_return_t *ret)
 		next();
 		emit("\n");
 	}
-	emit("  lw ra, %lu(sp)\n", m_fn.stack_size - sizeof(uint32_t));
-	emit("  addi sp, sp, %d\n", m_fn.stack_size);
+	if (m_fn.frames->data[m_fn.bb_idx] & FRAME_TEARDOWN)
+		frame_leave();
 	emit("  ret\n");
 }
 
+/* division by a constant that's not a power of two, as a multiplication by
+ * its magic number. `t5` and `t6` are free to use here since operands are
+ * loaded on demand. */
+static bool divide_const(const struct variant_t *lhs, koopa_raw_value_t rhs,
+			 bool mod)
+{
+	if (rhs->kind.tag != KOOPA_RVT_INTEGER)
+		return false;
+
+	int32_t c = rhs->kind.data.integer.value;
+	uint32_t d = c < 0 ? -(uint32_t)c : (uint32_t)c;
+	if (d < 3 || (d & (d - 1)) == 0)
+		return false;
+
+	int32_t multiplier;
+	uint32_t shift;
+	magic(d, &multiplier, &shift);
+
+	const char *dest = is_slot(m_bb.dest) ? "t5" : REG_NAMES[m_bb.dest];
+	const char *x = operand_reg(lhs, T5);
+
+	/* q = (mulh(x, m) + x?) >> s, then round towards zero */
+	emit("  li t6, %d\n", multiplier);
+	emit("  mulh t6, %s, t6\n", x);
+	if (multiplier < 0)
+		emit("  add t6, t6, %s\n", x);
+	if (shift > 0)
+		emit("  srai t6, t6, %u\n", shift);
+	emit("  srli t5, t6, 31\n");
+
+	if (!mod && c > 0)
+		emit("  add %s, t6, t5\n", dest);
+	else if (!mod)
+	{
+		emit("  add t6, t6, t5\n");
+		emit("  neg %s, t6\n", dest);
+	}
+	else
+	{
+		/* r = x - q * |c| */
+		emit("  add t6, t6, t5\n");
+		emit("  li t5, %u\n", d);
+		emit("  mul t6, t6, t5\n");
+		x = operand_reg(lhs, T5);
+		emit("  sub %s, %s, t6\n", dest, x);
+	}
+
+	if (is_slot(m_bb.dest))
+		emit("  sw t5, %lu(sp)\n", slot_sp(m_bb.dest));
+
+	return true;
+}
+
 static void raw_kind_binary(koopa_raw_binary_t *binary)
 {
 	struct variant_t lhs = raw_value(binary->lhs);
 	struct variant_t rhs = raw_value(binary->rhs);
+	koopa_raw_binary_op_t op = binary->op;
 
-	switch (binary->op)
+	/* keep immediates on the right */
+	int32_t imm;
+	if (is_commutative(op) && as_imm(binary->lhs, &imm)
+	    && !as_imm(binary->rhs, &imm))
+	{
+		struct variant_t tmp = lhs;
+		lhs = rhs;
+		rhs = tmp;
+	}
+	else if (as_imm(binary->lhs, &imm) && !as_imm(binary->rhs, &imm)
+		 && op == KOOPA_RBO_GT)
+	{
+		/* c > x => x < c */
+		struct variant_t tmp = lhs;
+		lhs = rhs;
+		rhs = tmp;
+		op = KOOPA_RBO_LT;
+	}
+
+	struct variant_t rhs_imm = { .tag = IMM, };
+	bool has_imm = rhs.tag == VALUE && as_imm(rhs.value, &rhs_imm.imm);
+
+	switch (op)
 	{
 	case KOOPA_RBO_NOT_EQ:
-		inst("xor", &lhs, &rhs, NULL);
-		oper("snez", 2);
+		if (has_imm && rhs_imm.imm == 0)
+			inst("snez", &lhs, NULL);
+		else
+		{
+			if (has_imm)
+				inst("xori", &lhs, &rhs_imm, NULL);
+			else
+				inst("xor", &lhs, &rhs, NULL);
+			oper("snez", true);
+		}
 		break;
 	case KOOPA_RBO_EQ:
-		inst("xor", &lhs, &rhs, NULL);
-		oper("seqz", 2);
+		if (has_imm && rhs_imm.imm == 0)
+			inst("seqz", &lhs, NULL);
+		else
+		{
+			if (has_imm)
+				inst("xori", &lhs, &rhs_imm, NULL);
+			else
+				inst("xor", &lhs, &rhs, NULL);
+			oper("seqz", true);
+		}
 		break;
 	case KOOPA_RBO_GT:
 		inst("sgt", &lhs, &rhs, NULL);
 		break;
 	case KOOPA_RBO_LT:
-		inst("slt", &lhs, &rhs, NULL);
+		if (has_imm)
+			inst("slti", &lhs, &rhs_imm, NULL);
+		else
+			inst("slt", &lhs, &rhs, NULL);
 		break;
 	case KOOPA_RBO_GE:
-		inst("slt", &lhs, &rhs, NULL);
-		oper("seqz", 2);
+		if (has_imm)
+			inst("slti", &lhs, &rhs_imm, NULL);
+		else
+			inst("slt", &lhs, &rhs, NULL);
+		oper("seqz", true);
 		break;
 	case KOOPA_RBO_LE:
+		/* x <= c => x < c + 1 */
+		if (has_imm && rhs_imm.imm < IMM_MAX)
+		{
+			++rhs_imm.imm;
+			inst("slti", &lhs, &rhs_imm, NULL);
+			break;
+		}
 		inst("sgt", &lhs, &rhs, NULL);
-		oper("seqz", 2);
+		oper("seqz", true);
 		break;
 	case KOOPA_RBO_ADD:
-		inst("add", &lhs, &rhs, NULL);
+		if (has_imm)
+			inst("addi", &lhs, &rhs_imm, NULL);
+		else
+			inst("add", &lhs, &rhs, NULL);
 		break;
 	case KOOPA_RBO_SUB:
-		inst("sub", &lhs, &rhs, NULL);
+		/* x - c => x + -c */
+		if (has_imm && rhs_imm.imm > IMM_MIN)
+		{
+			rhs_imm.imm = -rhs_imm.imm;
+			inst("addi", &lhs, &rhs_imm, NULL);
+		}
+		else
+			inst("sub", &lhs, &rhs, NULL);
 		break;
 	case KOOPA_RBO_MUL:
 		inst("mul", &lhs, &rhs, NULL);
 		break;
 	case KOOPA_RBO_DIV:
-		inst("div", &lhs, &rhs, NULL);
+		if (!divide_const(&lhs, binary->rhs, false))
+			inst("div", &lhs, &rhs, NULL);
 		break;
 	case KOOPA_RBO_MOD:
-		inst("rem", &lhs, &rhs, NULL);
+		if (!divide_const(&lhs, binary->rhs, true))
+			inst("rem", &lhs, &rhs, NULL);
 		break;
 	case KOOPA_RBO_AND:
-		inst("and", &lhs, &rhs, NULL);
+		if (has_imm)
+			inst("andi", &lhs, &rhs_imm, NULL);
+		else
+			inst("and", &lhs, &rhs, NULL);
 		break;
 	case KOOPA_RBO_OR:
-		inst("or", &lhs, &rhs, NULL);
+		if (has_imm)
+			inst("ori", &lhs, &rhs_imm, NULL);
+		else
+			inst("or", &lhs, &rhs, NULL);
 		break;
 	case KOOPA_RBO_XOR:
-		inst("xor", &lhs, &rhs, NULL);
+		if (has_imm)
+			inst("xori", &lhs, &rhs_imm, NULL);
+		else
+			inst("xor", &lhs, &rhs, NULL);
 		break;
 	case KOOPA_RBO_SHL:
-		inst("sll", &lhs, &rhs, NULL);
+		if (has_imm)
+		{
+			rhs_imm.imm &= 31;
+			inst("slli", &lhs, &rhs_imm, NULL);
+		}
+		else
+			inst("sll", &lhs, &rhs, NULL);
 		break;
 	case KOOPA_RBO_SHR:
-		unimplemented();
+		if (has_imm)
+		{
+			rhs_imm.imm &= 31;
+			inst("srli", &lhs, &rhs_imm, NULL);
+		}
+		else
+			inst("srl", &lhs, &rhs, NULL);
 		break;
 	case KOOPA_RBO_SAR:
-		inst("sra", &lhs, &rhs, NULL);
+		if (has_imm)
+		{
+			rhs_imm.imm &= 31;
+			inst("srai", &lhs, &rhs_imm, NULL);
+		}
+		else
+			inst("sra", &lhs, &rhs, NULL);
 		break;
 	}
 }
@@ -505,12 +1452,8 @@ static void raw_slice(const koopa_raw_slice_t *slice)
 		{
 			koopa_raw_value_t value = slice->buffer[i];
 
+			m_bb.pos = i;
 			raw_value(value);
-		       	if (value->ty->tag == KOOPA_RTT_INT32)
-				// register t_n should start from index of
-				// current value that has non-unit type.
-				// TODO optimize stepping strategy
-				m_bb.reg_idx = ++m_bb.out_idx;
 		}
 		break;
 	}
@@ -520,15 +1463,19 @@ static void raw_kind_call(const koopa_raw_call_t *call)
 {
 	const koopa_raw_function_t callee = call->callee;
 	const koopa_raw_slice_t *args = &call->args;
+	const struct alloc_t *alloc = m_fn.allocs[m_fn.bb_idx];
 
-	/* push saved registers */
-	for (uint32_t i = 0; i < min(m_bb.out_idx, R_MAX); ++i)
-		if (i < T_MAX)
-			emit("  sw t%d, %lu(sp)\n", i,
-			     (i + spill_args) * sizeof(int32_t));
-		else
-			emit("  sw a%d, %lu(sp)\n", i - T_MAX,
-			     (i + spill_args) * sizeof(int32_t));
+	/* push caller-saved registers that are still needed afterwards */
+	uint32_t saved = 0;
+	for (uint32_t i = 0; i < alloc->len; ++i)
+	{
+		const struct live_t *live = &alloc->lives[i];
+
+		if (live->def < m_bb.pos && m_bb.pos < live->last
+		    && !is_slot(live->loc) && !is_callee_saved(live->loc))
+			emit("  sw %s, %lu(sp)\n", REG_NAMES[live->loc],
+			     save_sp(saved++));
+	}
 
 	/* prepare callee arguments */
 	for (uint32_t i = 0; i < args->len; ++i)
@@ -555,29 +1502,26 @@ static void raw_kind_call(const koopa_raw_call_t *call)
 
 	emit("  call %s\n", callee->name + 1);
 
-	/* void functions */
-	if (callee->ty->data.function.ret->tag == KOOPA_RTT_UNIT)
-		return;
-
 	/* functions that have a return value */
-	if (m_bb.out_idx < T_MAX)
-		emit("  mv t%d, a0\n", m_bb.out_idx);
-	else if (m_bb.out_idx < R_MAX - regst_args)
-		emit("  mv a%d, a0\n", m_bb.out_idx - T_MAX + m_fn.arg_count);
-	else
+	if (callee->ty->data.function.ret->tag != KOOPA_RTT_UNIT)
 	{
-		emit("  mv t5, a0\n");
-		emit("  sw t5, %lu(sp)\n", m_out_sp);
+		if (!is_slot(m_bb.dest))
+			emit("  mv %s, a0\n", REG_NAMES[m_bb.dest]);
+		else
+			emit("  sw a0, %lu(sp)\n", slot_sp(m_bb.dest));
 	}
 
 	/* pop saved registers */
-	for (uint32_t i = 0; i < min(m_bb.out_idx, R_MAX); ++i)
-		if (i < T_MAX)
-			emit("  lw t%d, %lu(sp)\n", i,
-			     (i + spill_args) * sizeof(int32_t));
-		else
-			emit("  lw a%d, %lu(sp)\n", i - T_MAX,
-			     (i + spill_args) * sizeof(int32_t));
+	saved = 0;
+	for (uint32_t i = 0; i < alloc->len; ++i)
+	{
+		const struct live_t *live = &alloc->lives[i];
+
+		if (live->def < m_bb.pos && m_bb.pos < live->last
+		    && !is_slot(live->loc) && !is_callee_saved(live->loc))
+			emit("  lw %s, %lu(sp)\n", REG_NAMES[live->loc],
+			     save_sp(saved++));
+	}
 }
 
 /* weird return type... i wonder if there's a better way to backtrack. currently
@@ -629,9 +1573,10 @@ static struct variant_t raw_value(koopa_raw_value_t raw)
 		return (struct variant_t) { .tag = GLOBAL, .global = raw };
 		break;
 	case KOOPA_RVT_LOAD:
+		m_bb.dest = *htable_lookup(m_ht_locs, raw);
 		raw_kind_load(&raw->kind.data.load);
 		htable_insert(m_ht_outs, make_pair(raw, m_fn.bb_idx),
-			      m_bb.out_idx);
+			      m_bb.dest);
 		break;
 	case KOOPA_RVT_STORE:
 		raw_kind_store(&raw->kind.data.store);
@@ -643,9 +1588,13 @@ static struct variant_t raw_value(koopa_raw_value_t raw)
 		todo();
 		break;
 	case KOOPA_RVT_BINARY:
+		/* emitted along with the branch */
+		if (raw == fused_cond(m_fn.cfg->bbs[m_fn.bb_idx]))
+			break;
+		m_bb.dest = *htable_lookup(m_ht_locs, raw);
 		raw_kind_binary(&raw->kind.data.binary);
 		htable_insert(m_ht_outs, make_pair(raw, m_fn.bb_idx),
-			      m_bb.out_idx);
+			      m_bb.dest);
 		break;
 	case KOOPA_RVT_BRANCH:
 		raw_kind_branch(&raw->kind.data.branch);
@@ -654,9 +1603,11 @@ static struct variant_t raw_value(koopa_raw_value_t raw)
 		raw_kind_jump(&raw->kind.data.jump);
 		break;
 	case KOOPA_RVT_CALL:
+		if (raw->ty->tag == KOOPA_RTT_INT32)
+			m_bb.dest = *htable_lookup(m_ht_locs, raw);
 		raw_kind_call(&raw->kind.data.call);
 		htable_insert(m_ht_outs, make_pair(raw, m_fn.bb_idx),
-			      m_bb.out_idx);
+			      m_bb.dest);
 		break;
 	case KOOPA_RVT_RETURN:
 		raw_kind_return(&raw->kind.data.ret);
@@ -674,13 +1625,14 @@ static void raw_basic_block(koopa_raw_basic_block_t raw)
 		return;
 
 	emit("%s:\n", raw->name + 1);
+	if (m_fn.frames->data[m_fn.bb_idx] & FRAME_SETUP)
+		frame_enter();
 #if 0
 	raw_slice(&raw->params);
 	raw_slice(&raw->used_by);
 #endif
 	raw_slice(&raw->insts);
 
-	++m_fn.bb_idx;
 	memset(&m_bb, 0, sizeof(m_bb));
 }
 
@@ -693,6 +1645,12 @@ static void raw_function(koopa_raw_function_t raw)
 	if (raw->bbs.len == 0)
 		return;
 
+	/* buffered for the peephole optimizer and the scheduler */
+	FILE *output = m_output;
+	char *text;
+	size_t len;
+	m_output = open_memstream(&text, &len);
+
 	// every function is global (`extern`al)
 	emit("\n  .globl %s\n", raw->name + 1);
 	emit("%s:\n", raw->name + 1);
@@ -701,9 +1659,31 @@ static void raw_function(koopa_raw_function_t raw)
 	raw_type(raw->ty);
 #if 0
 	raw_slice(&raw->params);
-#endif
 	raw_slice(&raw->bbs);
-	function_epilogue();
+#endif
+	/* unreachable blocks are left out */
+	struct vector_u32_t *layout = m_fn.layout;
+	for (uint32_t i = 0; i < layout->size; ++i)
+	{
+		m_fn.bb_idx = layout->data[i];
+		m_fn.next_bb = i + 1 < layout->size
+			       ? layout->data[i + 1]
+			       : CFG_NONE;
+		raw_basic_block(raw->bbs.buffer[m_fn.bb_idx]);
+	}
+	function_epilogue(raw);
+
+	fclose(m_output);
+	m_output = output;
+	uint32_t insns_len;
+	struct insn_t *insns = asm_parse(text, &insns_len);
+	peephole(insns, insns_len);
+	schedule(insns, insns_len);
+	if (m_compressed)
+		compress(insns, insns_len);
+	asm_print(insns, insns_len, m_output);
+	asm_free(insns, insns_len);
+	free(text);
 }
 
 static void raw_type(koopa_raw_type_t raw)
@@ -729,6 +1709,73 @@ static void raw_type(koopa_raw_type_t raw)
 	}
 }
 
+/* functions are generated into separate buffers, then written out in
+ * their original order */
+struct chunk_t {
+	koopa_raw_function_t function;
+	// goes into the cache once generated, if set
+	struct cache_function_t *cached;
+	uint32_t size;
+	char *text;
+	size_t len;
+};
+
+static int compare_size(const void *lhs, const void *rhs)
+{
+	const struct chunk_t *l = *(const struct chunk_t **)lhs;
+	const struct chunk_t *r = *(const struct chunk_t **)rhs;
+
+	return (l->size < r->size) - (l->size > r->size);
+}
+
+static void chunk_function(void *arg, uint32_t i)
+{
+	struct chunk_t *chunk = ((struct chunk_t **)arg)[i];
+
+	// from the cache
+	if (chunk->text)
+		return;
+
+	m_output = open_memstream(&chunk->text, &chunk->len);
+	m_ht_outs = htable_ppuu32_new();
+	m_ht_stacks = htable_ptru32_new();
+	m_ht_locs = htable_ptru32_new();
+
+	raw_function(chunk->function);
+
+	htable_ptru32_delete(m_ht_locs);
+	htable_ptru32_delete(m_ht_stacks);
+	htable_ppuu32_delete(m_ht_outs);
+	fclose(m_output);
+
+	if (chunk->cached)
+		cache_put(&chunk->cached->key, chunk->text, chunk->len);
+}
+
+/* functions found in the cache are taken as is, even if only declared */
+static void chunk_init(struct chunk_t *chunk, koopa_raw_function_t function,
+		       struct cache_function_t *cached)
+{
+	*chunk = (struct chunk_t) {
+		.function = function,
+		.cached = cached,
+	};
+	if (cached && cached->text)
+	{
+		chunk->text = cached->text;
+		chunk->len = cached->len;
+		chunk->cached = NULL;
+		cached->text = NULL;
+		return;
+	}
+
+	for (uint32_t j = 0; j < function->bbs.len; ++j)
+	{
+		koopa_raw_basic_block_t basic_block = function->bbs.buffer[j];
+		chunk->size += basic_block->insts.len;
+	}
+}
+
 static void init_values(koopa_raw_slice_t *values)
 {
 	for (uint32_t i = 0; i < values->len; ++i)
@@ -752,13 +1799,30 @@ static void init_values(koopa_raw_slice_t *values)
 }
 
 /* public defn.s */
-void codegen(const koopa_raw_program_t *program, FILE *output)
+bool codegen_set_arch(const char *arch)
+{
+	if (strcmp(arch, "rv32im") == 0)
+		m_compressed = false;
+	else if (strcmp(arch, "rv32imc") == 0)
+		m_compressed = true;
+	else
+		return false;
+
+	return true;
+}
+
+void codegen_set_jobs(uint32_t jobs)
+{
+	m_jobs = jobs > 0 ? jobs : 1;
+}
+
+void codegen(const koopa_raw_program_t *program,
+	     struct cache_function_t *cached, uint32_t cached_len,
+	     FILE *output)
 {
 	assert(output);
 
 	m_output = output;
-	m_ht_outs = htable_ppuu32_new();
-	m_ht_stacks = htable_ptru32_new();
 
 	koopa_raw_slice_t *values = &program->values;
 	emit("  .data\n");
@@ -766,8 +1830,73 @@ void codegen(const koopa_raw_program_t *program, FILE *output)
 
 	koopa_raw_slice_t *funcs = &program->funcs;
 	emit("\n  .text\n");
-	raw_slice(funcs);
+	if (m_compressed)
+		emit("  .option rvc\n");
+
+	htable_ptru32_t ht_cached = htable_ptru32_new();
+	for (uint32_t i = 0; i < cached_len; ++i)
+		if (cached[i].raw)
+			htable_insert(ht_cached, (void *)cached[i].raw, i);
+
+	struct chunk_t *chunks = calloc(funcs->len, sizeof(struct chunk_t));
+	struct chunk_t **order = malloc(sizeof(struct chunk_t *) * funcs->len);
+	uint32_t len = 0;
+	for (uint32_t i = 0; i < funcs->len; ++i)
+	{
+		koopa_raw_function_t function = funcs->buffer[i];
+		uint32_t *index = htable_lookup(ht_cached, (void *)function);
+		struct cache_function_t *entry = index ? &cached[*index] : NULL;
 
-	htable_ptru32_delete(m_ht_stacks);
-	htable_ppuu32_delete(m_ht_outs);
+		/* declaration only */
+		if (function->bbs.len == 0 && !(entry && entry->text))
+			continue;
+
+		chunk_init(&chunks[len], function, entry);
+		order[len] = &chunks[len];
+		++len;
+	}
+	htable_ptru32_delete(ht_cached);
+
+	/* big functions first so that no thread is left with one at the end */
+	qsort(order, len, sizeof(struct chunk_t *), compare_size);
+	pool_run(len, m_jobs, chunk_function, order);
+
+	for (uint32_t i = 0; i < len; ++i)
+	{
+		fwrite(chunks[i].text, 1, chunks[i].len, output);
+		free(chunks[i].text);
+	}
+	free(order);
+	free(chunks);
+}
+
+void codegen_begin(FILE *output)
+{
+	assert(output);
+
+	m_output = output;
+
+	emit("  .text\n");
+	if (m_compressed)
+		emit("  .option rvc\n");
+}
+
+void codegen_function(koopa_raw_function_t function,
+		      struct cache_function_t *cached, FILE *output)
+{
+	struct chunk_t chunk;
+	chunk_init(&chunk, function, cached);
+	struct chunk_t *order = &chunk;
+	chunk_function(&order, 0);
+
+	fwrite(chunk.text, 1, chunk.len, output);
+	free(chunk.text);
+}
+
+void codegen_end(const koopa_raw_program_t *program, FILE *output)
+{
+	m_output = output;
+
+	emit("\n  .data\n");
+	init_values(&program->values);
 }
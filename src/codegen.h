@@ -6,10 +6,34 @@
 #ifndef _CODEGEN_H_
 #define _CODEGEN_H_
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#include "cache.h"
 #include "koopa.h"
 
-void codegen(const koopa_raw_program_t *program, FILE *output);
+/* Select target ISA, "rv32im" (default) or "rv32imc".
+ * @return false if it's not supported. */
+bool codegen_set_arch(const char *arch);
+
+/* Generate code for functions on up to `jobs` threads. The output doesn't
+ * depend on it. */
+void codegen_set_jobs(uint32_t jobs);
+
+/* Functions in `cached` with their assembly found in the cache are written
+ * out as is, whether or not their bodies are there; the others with `raw`
+ * set go into the cache. */
+void codegen(const koopa_raw_program_t *program,
+	     struct cache_function_t *cached, uint32_t cached_len,
+	     FILE *output);
+
+/* Streaming: code of functions is written as each of them comes, and
+ * global variables are put at the end, once all of them are known.
+ * `cached` may be NULL. */
+void codegen_begin(FILE *output);
+void codegen_function(koopa_raw_function_t function,
+		      struct cache_function_t *cached, FILE *output);
+void codegen_end(const koopa_raw_program_t *program, FILE *output);
 
 #endif//_CODEGEN_H_
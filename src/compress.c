@@ -0,0 +1,286 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress.h"
+#include "macros.h"
+
+#define SP 2
+
+/* branch ranges, less the worst case rounding of our estimate */
+#define J_RANGE 2044
+#define BZ_RANGE 252
+
+/* labels of the function, by name. open addressing, linear probing */
+struct label_t {
+	const char *name;
+	uint32_t line;
+};
+
+/* state variables */
+static _Thread_local struct insn_t *m_insns;
+static _Thread_local uint32_t m_len;
+// upper bound of the byte offset of each line
+static _Thread_local uint32_t *m_offsets;
+static _Thread_local struct label_t *m_labels;
+static _Thread_local uint32_t m_labels_mask;
+
+/* tool functions */
+static bool is_prime(int32_t reg)
+{
+	return reg >= 8 && reg <= 15;
+}
+
+static bool fits(int32_t imm, int32_t low, int32_t high, int32_t align)
+{
+	return imm >= low && imm <= high && imm % align == 0;
+}
+
+static bool as_imm(const char *arg, int32_t *imm)
+{
+	char *end;
+	long value = strtol(arg, &end, 0);
+	if (end == arg || *end)
+		return false;
+
+	*imm = value;
+	return true;
+}
+
+/* offset & base of `off(reg)` */
+static bool as_address(const char *arg, int32_t *offset, int32_t *base)
+{
+	char *end;
+	long value = strtol(arg, &end, 10);
+	if (end == arg || *end != '(')
+		return false;
+
+	*offset = value;
+	*base = asm_base(arg);
+	return *base != REG_NONE;
+}
+
+static void rewrite(struct insn_t *insn, const char *op, uint32_t argc,
+		    const char *lhs, const char *rhs)
+{
+	char *args[2] = { strdup(lhs), rhs ? strdup(rhs) : NULL };
+
+	free(insn->op);
+	for (uint32_t i = 0; i < insn->argc; ++i)
+		free(insn->args[i]);
+
+	insn->op = strdup(op);
+	insn->argc = argc;
+	memcpy(insn->args, args, sizeof(char *) * argc);
+}
+
+static void set_op(struct insn_t *insn, const char *op)
+{
+	free(insn->op);
+	insn->op = strdup(op);
+}
+
+/* worst case size of a line in bytes, as long as it's uncompressed */
+static uint32_t size(const struct insn_t *insn)
+{
+	int32_t imm;
+
+	if (insn->kind != INSN_OP || insn->dead)
+		return 0;
+
+	/* pseudo-instructions of two */
+	if (strcmp(insn->op, "la") == 0 || strcmp(insn->op, "call") == 0
+	    || strcmp(insn->op, "tail") == 0)
+		return 8;
+	if (strcmp(insn->op, "li") == 0
+	    && !(as_imm(insn->args[1], &imm) && fits(imm, -2048, 2047, 1)))
+		return 8;
+
+	return 4;
+}
+
+static uint32_t fnv1a(const char *text)
+{
+	uint32_t hash = 2166136261u;
+	while (*text)
+		hash = (hash ^ (uint8_t)*text++) * 16777619u;
+
+	return hash;
+}
+
+/* at most half full, so that probing stays short */
+static void labels_new(uint32_t count)
+{
+	uint32_t capacity = 16;
+	while (capacity < count * 2)
+		capacity *= 2;
+	m_labels = calloc(capacity, sizeof(struct label_t));
+	m_labels_mask = capacity - 1;
+
+	for (uint32_t i = 0; i < m_len; ++i)
+	{
+		if (m_insns[i].kind != INSN_LABEL)
+			continue;
+
+		uint32_t j = fnv1a(m_insns[i].op) & m_labels_mask;
+		while (m_labels[j].name)
+			j = (j + 1) & m_labels_mask;
+		m_labels[j] = (struct label_t) {
+			.name = m_insns[i].op,
+			.line = i,
+		};
+	}
+}
+
+static bool in_range(uint32_t from, const char *label, uint32_t range)
+{
+	uint32_t j = fnv1a(label) & m_labels_mask;
+	for (; m_labels[j].name; j = (j + 1) & m_labels_mask)
+	{
+		if (strcmp(m_labels[j].name, label) != 0)
+			continue;
+
+		uint32_t i = m_labels[j].line;
+		uint32_t distance = m_offsets[i] > m_offsets[from]
+				    ? m_offsets[i] - m_offsets[from]
+				    : m_offsets[from] - m_offsets[i];
+		return distance <= range;
+	}
+
+	/* somewhere out of this function */
+	return false;
+}
+
+/* selection */
+static void compress_insn(uint32_t i)
+{
+	struct insn_t *insn = &m_insns[i];
+	const char *op = insn->op;
+	char **args = insn->args;
+
+	int32_t rd = insn->argc > 0 ? asm_reg(args[0]) : REG_NONE;
+	int32_t rs = insn->argc > 1 ? asm_reg(args[1]) : REG_NONE;
+	int32_t rt = insn->argc > 2 ? asm_reg(args[2]) : REG_NONE;
+	int32_t imm, base;
+
+	if (strcmp(op, "li") == 0)
+	{
+		if (rd > 0 && as_imm(args[1], &imm) && fits(imm, -32, 31, 1))
+			rewrite(insn, "c.li", 2, args[0], args[1]);
+	}
+	else if (strcmp(op, "mv") == 0)
+	{
+		if (rd > 0 && rs > 0)
+			rewrite(insn, "c.mv", 2, args[0], args[1]);
+	}
+	else if (strcmp(op, "addi") == 0)
+	{
+		if (!as_imm(args[2], &imm) || imm == 0)
+			return;
+
+		if (rd == SP && rs == SP && fits(imm, -512, 496, 16))
+			rewrite(insn, "c.addi16sp", 2, args[0], args[2]);
+		else if (rd > 0 && rd == rs && fits(imm, -32, 31, 1))
+			rewrite(insn, "c.addi", 2, args[0], args[2]);
+		else if (is_prime(rd) && rs == SP && fits(imm, 4, 1020, 4))
+			set_op(insn, "c.addi4spn");
+	}
+	else if (strcmp(op, "lw") == 0 || strcmp(op, "sw") == 0)
+	{
+		bool load = op[0] == 'l';
+		if (rd == REG_NONE || !as_address(args[1], &imm, &base))
+			return;
+
+		if (base == SP && (rd > 0 || !load) && fits(imm, 0, 252, 4))
+			rewrite(insn, load ? "c.lwsp" : "c.swsp", 2, args[0],
+				args[1]);
+		else if (is_prime(rd) && is_prime(base)
+			 && fits(imm, 0, 124, 4))
+			rewrite(insn, load ? "c.lw" : "c.sw", 2, args[0],
+				args[1]);
+	}
+	else if (strcmp(op, "add") == 0)
+	{
+		if (rd > 0 && rd == rs && rt > 0)
+			rewrite(insn, "c.add", 2, args[0], args[2]);
+		else if (rd > 0 && rd == rt && rs > 0)
+			rewrite(insn, "c.add", 2, args[0], args[1]);
+	}
+	else if (strcmp(op, "sub") == 0 || strcmp(op, "and") == 0
+		 || strcmp(op, "or") == 0 || strcmp(op, "xor") == 0)
+	{
+		char name[8];
+		snprintf(name, sizeof(name), "c.%s", op);
+
+		bool commutative = op[0] != 's';
+		if (!is_prime(rd))
+			return;
+
+		if (rd == rs && is_prime(rt))
+			rewrite(insn, name, 2, args[0], args[2]);
+		else if (commutative && rd == rt && is_prime(rs))
+			rewrite(insn, name, 2, args[0], args[1]);
+	}
+	else if (strcmp(op, "slli") == 0 || strcmp(op, "srli") == 0
+		 || strcmp(op, "srai") == 0 || strcmp(op, "andi") == 0)
+	{
+		char name[8];
+		snprintf(name, sizeof(name), "c.%s", op);
+
+		if (rd != rs || !as_imm(args[2], &imm))
+			return;
+
+		if (op[0] == 'a' ? is_prime(rd) && fits(imm, -32, 31, 1)
+				 : fits(imm, 1, 31, 1)
+				   && (op[1] == 'l' ? rd > 0 : is_prime(rd)))
+			rewrite(insn, name, 2, args[0], args[2]);
+	}
+	else if (strcmp(op, "j") == 0)
+	{
+		if (in_range(i, args[0], J_RANGE))
+			rewrite(insn, "c.j", 1, args[0], NULL);
+	}
+	else if (strcmp(op, "beqz") == 0 || strcmp(op, "bnez") == 0)
+	{
+		if (is_prime(rd) && in_range(i, args[1], BZ_RANGE))
+			rewrite(insn, op[1] == 'e' ? "c.beqz" : "c.bnez", 2,
+				args[0], args[1]);
+	}
+	else if (strcmp(op, "ret") == 0)
+		rewrite(insn, "c.jr", 1, "ra", NULL);
+	else if (strcmp(op, "jr") == 0)
+	{
+		if (rd > 0)
+			rewrite(insn, "c.jr", 1, args[0], NULL);
+	}
+}
+
+/* public defn.s */
+void compress(struct insn_t *insns, uint32_t len)
+{
+	m_insns = insns;
+	m_len = len;
+
+	/* offsets only ever shrink as instructions get compressed */
+	m_offsets = malloc(sizeof(uint32_t) * (len + 1));
+	m_offsets[0] = 0;
+	uint32_t labels = 0;
+	for (uint32_t i = 0; i < len; ++i)
+	{
+		m_offsets[i + 1] = m_offsets[i] + size(&insns[i]);
+		labels += insns[i].kind == INSN_LABEL;
+	}
+	labels_new(labels);
+
+	for (uint32_t i = 0; i < len; ++i)
+		if (insns[i].kind == INSN_OP && !insns[i].dead)
+			compress_insn(i);
+
+	free(m_labels);
+	m_labels = NULL;
+	free(m_offsets);
+	m_insns = NULL;
+	m_len = 0;
+}
@@ -0,0 +1,17 @@
+/**
+ * compress.h
+ * Compressed (RVC) instruction selection.
+ */
+
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include <stdint.h>
+
+#include "asm.h"
+
+/* Rewrite instructions of one function into their 16-bit forms wherever
+ * the operands allow. */
+void compress(struct insn_t *insns, uint32_t len);
+
+#endif//_COMPRESS_H_
@@ -0,0 +1,56 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "context.h"
+#include "intern.h"
+
+/* lexer & parser */
+extern bool lex_open(struct context_t *ctx);
+extern void lex_close(struct context_t *ctx);
+extern int yyparse(void *scanner, struct context_t *ctx);
+
+/* public defn.s */
+void context_init(struct context_t *ctx, const char *input, FILE *errors)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->input = input;
+	ctx->errors = errors;
+}
+
+bool context_parse(struct context_t *ctx)
+{
+	if (!lex_open(ctx))
+	{
+		fprintf(ctx->errors, "%s: %s\n", ctx->input, strerror(errno));
+		return false;
+	}
+	yyparse(ctx->scanner, ctx);
+	lex_close(ctx);
+	// the AST keeps copies of identifiers
+	intern_clear();
+
+	return !ctx->error;
+}
+
+void context_fini(struct context_t *ctx)
+{
+	node_delete(ctx->comp_unit);
+	ctx->comp_unit = NULL;
+	if (ctx->symbols)
+		symbols_delete(ctx->symbols);
+	ctx->symbols = NULL;
+	for (uint32_t i = 1; i < ctx->arenas_len; ++i)
+		if (ctx->arenas[i])
+			bump_delete(ctx->arenas[i]);
+	free(ctx->arenas);
+	ctx->arenas = NULL;
+	ctx->arenas_len = 0;
+	for (uint32_t i = 0; i < ctx->cached_len; ++i)
+		free(ctx->cached[i].text);
+	free(ctx->cached);
+	ctx->cached = NULL;
+	ctx->cached_len = 0;
+}
@@ -0,0 +1,76 @@
+/**
+ * context.h
+ * State of compiling one translation unit.
+ */
+
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "bump.h"
+#include "koopa.h"
+#include "node.h"
+#include "symbols.h"
+
+struct cache_function_t;
+
+/* everything the frontend works on lives here, so that units can be
+ * compiled side by side, or one after another on a thread in turns. it's
+ * handed down explicitly through semantic analysis and IR generation.
+ * what's left in `_Thread_local` variables is scratch state of a single
+ * call, such as the function and basic block being built in ir.c or `m_fn`
+ * in codegen.c: set up on the way in, and of no use once it returns. */
+struct context_t {
+	const char *input;
+	// where diagnostics go
+	FILE *errors;
+
+	/* lexer */
+	void *scanner;
+	char *source;
+	size_t source_len;
+	bool mapped;
+
+	// syntax error found by the lexer or the parser
+	bool error;
+	struct node_t *comp_unit;
+
+	/* if set, globals are handed over one by one as soon as they're
+	 * parsed, and left out of `comp_unit`. parsing stops at the first one
+	 * it returns false for */
+	bool (*global)(struct context_t *ctx, const struct node_t *global);
+
+	/* semantic analysis and IR generation */
+	// where errors are thrown to
+	jmp_buf env;
+	symbols_t symbols;
+	// memory IR of the unit is allocated from it
+	bump_t bump;
+	// if set, bodies of functions go here instead, so that each can be
+	// freed once it's done with
+	bump_t body;
+	// arenas of the threads bodies of functions have been built on, but
+	// the first, which uses `bump`
+	bump_t *arenas;
+	uint32_t arenas_len;
+	// semantic analysis is done along the way
+	bool fused;
+	// if set, the cache entry of each function definition, in order
+	struct cache_function_t *cached;
+	uint32_t cached_len;
+	koopa_raw_program_t *program;
+};
+
+void context_init(struct context_t *ctx, const char *input, FILE *errors);
+
+/* Parse `ctx->input` into `ctx->comp_unit`.
+ * @return false on I/O or syntax errors, or if `ctx->global` failed. */
+bool context_parse(struct context_t *ctx);
+
+void context_fini(struct context_t *ctx);
+
+#endif//_CONTEXT_H_
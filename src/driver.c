@@ -0,0 +1,587 @@
+#include <errno.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "cache.h"
+#include "codegen.h"
+#include "context.h"
+#include "debug.h"
+#include "driver.h"
+#include "dump.h"
+#include "hashtable.h"
+#include "ir.h"
+#include "koopa.h"
+#include "koopaext.h"
+#include "macros.h"
+#include "passes.h"
+#include "phases.h"
+#include "pool.h"
+#include "semantic.h"
+#include "verify.h"
+
+/* options */
+static bool m_verbose = true;
+static bool m_time_passes;
+static bool m_warm;
+static bool m_fused;
+static bool m_streaming;
+// debug builds check memory IR by default
+#ifdef VERIFY_IR
+static bool m_verify = true;
+#else
+static bool m_verify;
+#endif
+
+/* state variables */
+// arena kept by this thread for the next unit, if warm
+static _Thread_local bump_t m_bump;
+
+// where the unit being streamed goes
+static _Thread_local FILE *m_stream_output;
+
+/* tool functions */
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void progress(const char *stage)
+{
+	if (m_verbose)
+		printf("======= %s...\n", stage);
+}
+
+/* as `perror()` does, but to where the diagnostics of a unit go */
+static void complain(FILE *errors, const char *path)
+{
+	fprintf(errors, "%s: %s\n", path, strerror(errno));
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	char *data;
+	FILE *stream = open_memstream(&data, len);
+	char buf[4096];
+	for (size_t n; (n = fread(buf, 1, sizeof(buf), f)) > 0;)
+		fwrite(buf, 1, n, stream);
+	fclose(stream);
+
+	bool ok = !ferror(f);
+	fclose(f);
+	if (!ok)
+	{
+		free(data);
+		return NULL;
+	}
+
+	return data;
+}
+
+/* only the pages in use get backed by memory, and a warm arena keeps
+ * them for the next unit */
+static bump_t arena_new(void)
+{
+	if (!m_warm)
+		return bump_new(256 MiB);
+
+	if (m_bump)
+		bump_reset(m_bump);
+	else
+		m_bump = bump_new(256 MiB);
+	return m_bump;
+}
+
+static void arena_delete(bump_t bump)
+{
+	if (bump != m_bump)
+		bump_delete(bump);
+}
+
+/* the output of a unit is fully determined by its source, its mode and the
+ * flags */
+static bool unit_key(const struct unit_t *unit, struct hash_t *key)
+{
+	size_t len;
+	char *source = read_file(unit->input, &len);
+	if (!source)
+		return false;
+
+	cache_key(key);
+	hash_u32(key, CACHE_UNIT);
+	hash_str(key, unit->mode);
+	hash_bytes(key, source, len);
+
+	free(source);
+	return true;
+}
+
+static bool from_cache(const struct unit_t *unit, const struct hash_t *key)
+{
+	phases_enter(PHASE_OUTPUT);
+	size_t len;
+	char *data = cache_get(CACHE_UNIT, key, &len);
+	if (!data)
+		return false;
+
+	FILE *f = fopen(unit->output, "wb");
+	bool ok = f && fwrite(data, 1, len, f) == len;
+	ok = f && fclose(f) == 0 && ok;
+
+	free(data);
+	return ok;
+}
+
+static void to_cache(const struct unit_t *unit, const struct hash_t *key)
+{
+	phases_enter(PHASE_OUTPUT);
+	size_t len;
+	char *data = read_file(unit->output, &len);
+	if (!data)
+		return;
+
+	cache_put(key, data, len);
+	free(data);
+}
+
+/* text-form IR is written as it's printed, in big chunks */
+static bool dump_file(const koopa_raw_program_t *raw, const char *path,
+		      FILE *errors)
+{
+	FILE *f = fopen(path, "w");
+	if (!f)
+	{
+		complain(errors, path);
+		return false;
+	}
+
+	setvbuf(f, NULL, _IOFBF, 64 KiB);
+	bool ok = dump(raw, f);
+	ok = fclose(f) == 0 && ok;
+	if (!ok)
+	{
+		complain(errors, path);
+		unlink(path);
+	}
+
+	return ok;
+}
+
+/* remarks are shown along with -time-passes, or on their own if verbose */
+static void report_passes(const struct unit_t *unit, const char *remarks)
+{
+	bool remarked = remarks && *remarks && (m_verbose || m_time_passes);
+	if (!m_time_passes && !remarked)
+		return;
+
+	// keep reports of concurrent units apart
+	flockfile(unit->errors);
+	fprintf(unit->errors, "%s:\n", unit->input);
+	if (m_time_passes)
+		passes_report(unit->errors);
+	if (remarked)
+		fprintf(unit->errors, "remarks:\n%s", remarks);
+	funlockfile(unit->errors);
+}
+
+static void report_phases(const struct unit_t *unit)
+{
+	if (phases_report_kind() == PHASES_OFF)
+		return;
+
+	flockfile(unit->errors);
+	if (phases_report_kind() == PHASES_TEXT)
+		fprintf(unit->errors, "%s:\n", unit->input);
+	phases_report(unit->errors, unit->input);
+	funlockfile(unit->errors);
+}
+
+/* a function's code is fully determined by what goes into its key, which is
+ * known as soon as names in it are resolved */
+static void function_key(const struct node_t *func_def, struct hash_t *key)
+{
+	cache_key(key);
+	hash_u32(key, CACHE_FUNCTION);
+	ir_key(func_def, key);
+}
+
+static void function_keys(struct context_t *ctx)
+{
+	const struct node_t *globals = ctx->comp_unit->children[0];
+
+	ctx->cached = calloc(globals->size + 1,
+			     sizeof(struct cache_function_t));
+	ctx->cached_len = 0;
+	for (int i = 0; i < globals->size; ++i)
+	{
+		const struct node_t *node = globals->children[i]->children[0];
+		if (node->data.kind == AST_FuncDef)
+			function_key(node,
+				     &ctx->cached[ctx->cached_len++].key);
+	}
+}
+
+static void function_get(struct cache_function_t *cached)
+{
+	cached->text = cache_get(CACHE_FUNCTION, &cached->key, &cached->len);
+}
+
+/* each function is done with as soon as it's been parsed, so that only one
+ * of them is held in memory at a time */
+static bool stream_global(struct context_t *ctx, const struct node_t *global)
+{
+	if (setjmp(ctx->env) != 0)
+		return false;
+
+	phases_enter(PHASE_IR);
+	koopa_raw_function_t function = ir_stream_global(ctx, global);
+	if (!function)
+	{
+		phases_enter(PHASE_PARSING);
+		return true;
+	}
+
+	/* there are only function passes in a stream, so a hit needs nothing
+	 * more than its key */
+	struct cache_function_t cached = { .raw = function, };
+	if (cache_enabled())
+	{
+		function_key(global->children[0], &cached.key);
+		function_get(&cached);
+	}
+
+	koopa_raw_program_set_allocator(ctx->body);
+	phases_enter(PHASE_PASSES);
+	if (!cached.text)
+		passes_run_function(function);
+	if (m_verify && !cached.text)
+	{
+		phases_enter(PHASE_VERIFY);
+		if (!verify_function(function, ctx->input, ctx->errors))
+			return false;
+	}
+	phases_enter(PHASE_CODEGEN);
+	codegen_function(function, cache_enabled() ? &cached : NULL,
+			 m_stream_output);
+	// before the body is gone, for its peak to be seen
+	phases_enter(PHASE_PARSING);
+	ir_stream_drop(ctx, function);
+	bump_reset(ctx->body);
+
+	return true;
+}
+
+static int stream(const struct unit_t *unit)
+{
+	FILE *f = fopen(unit->output, "w");
+	if (!f)
+	{
+		complain(unit->errors, unit->output);
+		return 1;
+	}
+
+	progress("Streaming assembly");
+	struct context_t ctx;
+	context_init(&ctx, unit->input, unit->errors);
+	ctx.global = stream_global;
+	ctx.bump = arena_new();
+	ctx.body = bump_new(256 MiB);
+	phases_arena(ctx.bump);
+	phases_arena(ctx.body);
+	m_stream_output = f;
+	koopa_raw_program_t raw;
+	ir_stream_begin(&ctx, &raw);
+	passes_begin();
+	codegen_begin(f);
+
+	phases_enter(PHASE_PARSING);
+	bool ok = context_parse(&ctx);
+	ir_stream_end(&ctx);
+
+	phases_enter(PHASE_CODEGEN);
+	if (ok)
+		codegen_end(&raw, f);
+	phases_enter(PHASE_OUTPUT);
+	ok = fclose(f) == 0 && ok;
+	// half an assembly is of no use
+	if (!ok)
+		unlink(unit->output);
+	report_passes(unit, NULL);
+
+	phases_end();
+	bump_delete(ctx.body);
+	arena_delete(ctx.bump);
+	context_fini(&ctx);
+
+	return ok ? 0 : 1;
+}
+
+static int compile(const struct unit_t *unit)
+{
+	int status = 1;
+
+	/* an unchanged unit is copied from the cache. that's only possible if
+	 * nothing but the output is asked for */
+	struct hash_t key;
+	bool cached = cache_enabled() && strcmp(unit->middle, "-o") == 0
+		      && unit_key(unit, &key);
+	if (cached && from_cache(unit, &key))
+	{
+		progress("Using cached output");
+		return 0;
+	}
+
+	/* there's nothing to dump IR from in a stream */
+	if (m_streaming && strcmp(unit->mode, "-riscv") == 0
+	    && strcmp(unit->middle, "-o") == 0)
+	{
+		status = stream(unit);
+		if (status == 0 && cached)
+			to_cache(unit, &key);
+		return status;
+	}
+
+	/* parse */
+	progress("Parsing");
+	struct context_t ctx;
+	context_init(&ctx, unit->input, unit->errors);
+	phases_enter(PHASE_PARSING);
+	if (!context_parse(&ctx))
+		goto cleanup_context;
+
+#if 0
+	/* print AST */
+	printf("======= Abstract syntax tree (AST)\n");
+	ast_print(ctx.comp_unit);
+#endif
+
+	/* semantic analysis */
+	if (!m_fused)
+	{
+		phases_enter(PHASE_SEMANTIC);
+		if (setjmp(ctx.env) != 0)
+			goto cleanup_context;
+		semantic(&ctx);
+	}
+
+	/* functions with assembly in the cache needn't even be built, unless
+	 * module passes need all of them, or their IR is asked for. in that
+	 * case, only codegen is skipped for those that module passes left
+	 * alone */
+	bool functions_cached = cache_enabled() && !m_fused
+				&& strcmp(unit->mode, "-riscv") == 0;
+	bool functions_early = functions_cached && !passes_whole()
+			       && strcmp(unit->middle, "-o") == 0;
+	if (functions_cached)
+		function_keys(&ctx);
+	if (functions_early)
+		for (uint32_t i = 0; i < ctx.cached_len; ++i)
+			function_get(&ctx.cached[i]);
+
+	/* generate memory IR */
+	progress("Generating memory IR");
+	bump_t bump = arena_new();
+	ctx.bump = bump;
+	phases_arena(bump);
+	phases_enter(PHASE_IR);
+	koopa_raw_program_t raw;
+	if (!m_fused)
+	{
+		raw = ir(&ctx);
+		for (uint32_t i = 1; i < ctx.arenas_len; ++i)
+			if (ctx.arenas[i])
+				phases_arena(ctx.arenas[i]);
+	}
+	else if (setjmp(ctx.env) == 0)
+		raw = ir_fused(&ctx);
+	else
+		goto cleanup_raw_program;
+
+	/* optimize */
+	progress("Running passes");
+	phases_enter(PHASE_PASSES);
+	// into the same arena
+	koopa_raw_program_set_allocator(bump);
+	char *remarks = NULL;
+	size_t remarks_len;
+	FILE *stream = open_memstream(&remarks, &remarks_len);
+	passes_set_remarks(stream);
+	htable_ptru32_t changed = functions_cached && !functions_early
+				  ? htable_ptru32_new() : NULL;
+	passes_run(&raw, changed);
+	if (changed)
+	{
+		for (uint32_t i = 0; i < ctx.cached_len; ++i)
+		{
+			struct cache_function_t *cached = &ctx.cached[i];
+
+			if (htable_lookup(changed, (void *)cached->raw))
+				cached->raw = NULL;
+			else if (cached->raw)
+				function_get(cached);
+		}
+		htable_ptru32_delete(changed);
+	}
+	passes_set_remarks(NULL);
+	fclose(stream);
+	report_passes(unit, remarks);
+	free(remarks);
+
+#if 0
+	/* log memory IR */
+	printf("======= Logging memory IR into stderr...\n");
+	debug(&raw);
+#endif
+
+	/* check memory IR integrity */
+	if (m_verify)
+	{
+		progress("Verifying memory IR integrity");
+		phases_enter(PHASE_VERIFY);
+		if (!verify(&raw, unit->input, unit->errors))
+			goto cleanup_raw_program;
+	}
+
+	/* compile to RISC-V assembly */
+	if (strcmp(unit->mode, "-riscv") == 0)
+	{
+		/* dump IR */
+		if (strcmp(unit->middle, "-o") != 0)
+		{
+			progress("Dumping text-form Koopa IR");
+			phases_enter(PHASE_OUTPUT);
+			if (!dump_file(&raw, unit->middle, unit->errors))
+				goto cleanup_raw_program;
+		}
+
+		/* generate assembly */
+		FILE *f = fopen(unit->output, "w");
+		if (!f)
+		{
+			complain(unit->errors, unit->output);
+			goto cleanup_raw_program;
+		}
+		progress("Generating assembly");
+		phases_enter(PHASE_CODEGEN);
+		codegen(&raw, ctx.cached, ctx.cached_len, f);
+		phases_enter(PHASE_OUTPUT);
+		fclose(f);
+	}
+
+	/* generate Koopa IR */
+	if (strcmp(unit->mode, "-koopa") == 0)
+	{
+		/* dump IR */
+		progress("Dumping text-form Koopa IR");
+		phases_enter(PHASE_OUTPUT);
+		if (!dump_file(&raw, unit->output, unit->errors))
+			goto cleanup_raw_program;
+	}
+
+	status = 0;
+	if (cached)
+		to_cache(unit, &key);
+
+	/* cleanup */
+	progress("Cleaning up");
+cleanup_raw_program:
+	phases_end();
+	arena_delete(bump);
+cleanup_context:
+	context_fini(&ctx);
+
+	return status;
+}
+
+static void compile_unit(void *arg, uint32_t i)
+{
+	struct unit_t *units = arg;
+
+	driver_compile(&units[i]);
+}
+
+/* public defn.s */
+void driver_set_verbose(bool verbose)
+{
+	m_verbose = verbose;
+}
+
+void driver_set_time_passes(bool time_passes)
+{
+	m_time_passes = time_passes;
+}
+
+void driver_set_warm(bool warm)
+{
+	m_warm = warm;
+}
+
+void driver_set_fused(bool fused)
+{
+	m_fused = fused;
+}
+
+void driver_set_streaming(bool streaming)
+{
+	m_streaming = streaming;
+}
+
+void driver_set_verify(bool verify)
+{
+	m_verify = verify;
+}
+
+int driver_compile(struct unit_t *unit)
+{
+	double begin = now();
+	if (!unit->errors)
+		unit->errors = stderr;
+	phases_begin();
+	unit->status = compile(unit);
+	phases_end();
+	unit->time = now() - begin;
+	report_phases(unit);
+
+	return unit->status;
+}
+
+double driver_batch(struct unit_t *units, uint32_t len, uint32_t jobs)
+{
+	double begin = now();
+	pool_run(len, jobs, compile_unit, units);
+
+	return now() - begin;
+}
+
+void driver_report(const struct unit_t *units, uint32_t len, double wall,
+		   FILE *output)
+{
+	fprintf(output, "batch:\n");
+	fprintf(output, "  %10s %6s  %s\n", "time (ms)", "status", "input");
+
+	double total = 0;
+	uint32_t failed = 0;
+	for (uint32_t i = 0; i < len; ++i)
+	{
+		const struct unit_t *unit = &units[i];
+
+		fprintf(output, "  %10.3f %6s  %s\n", unit->time * 1e3,
+			unit->status == 0 ? "ok" : "failed", unit->input);
+		total += unit->time;
+		failed += unit->status != 0;
+	}
+	fprintf(output, "  %10.3f %6s  %u units, %u failed\n", total * 1e3,
+		"total", len, failed);
+	fprintf(output, "  %10.3f %6s\n", wall * 1e3, "wall");
+}
@@ -0,0 +1,59 @@
+/**
+ * driver.h
+ * Compiling translation units, one or many at a time.
+ */
+
+#ifndef _DRIVER_H_
+#define _DRIVER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct unit_t {
+	// "-koopa" or "-riscv"
+	const char *mode;
+	const char *input;
+	// where to dump Koopa IR in "-riscv" mode, or "-o" for nowhere
+	const char *middle;
+	const char *output;
+	// where diagnostics of the unit go, stderr if NULL
+	FILE *errors;
+
+	/* filled in by the driver */
+	int status;
+	double time;
+};
+
+/* Print the stage being run to stdout. */
+void driver_set_verbose(bool verbose);
+/* Print pass statistics of each unit to stderr. */
+void driver_set_time_passes(bool time_passes);
+/* Keep the arena of each thread for its next unit. For threads that live
+ * long, as they never give it back. */
+void driver_set_warm(bool warm);
+/* Do semantic analysis while generating IR, in one traversal of the AST. */
+void driver_set_fused(bool fused);
+/* Parse, generate and optimize code of one function at a time, for memory
+ * in use to grow with the largest function rather than the whole unit.
+ * Module passes are skipped. Only applies to "-riscv" without dumping IR;
+ * semantic analysis is always fused. */
+void driver_set_streaming(bool streaming);
+/* Check memory IR before generating code from it. On by default in debug
+ * builds. libkoopa only sees the IR when it's dumped. */
+void driver_set_verify(bool verify);
+
+/* Compile a single unit in the calling thread.
+ * @return exit status; nonzero on any error. */
+int driver_compile(struct unit_t *unit);
+
+/* Compile all units on `jobs` threads, the calling one included.
+ * @return wall time in seconds. */
+double driver_batch(struct unit_t *units, uint32_t len, uint32_t jobs);
+
+/* Print status and time of each unit, along with the wall time of the
+ * whole batch. */
+void driver_report(const struct unit_t *units, uint32_t len, double wall,
+		   FILE *output);
+
+#endif//_DRIVER_H_
@@ -0,0 +1,334 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "dump.h"
+#include "hashtable.h"
+
+/* state variables */
+static _Thread_local FILE *m_output;
+// numbers of unnamed values and basic blocks in the function being printed
+static _Thread_local htable_ptru32_t m_numbers;
+static _Thread_local uint32_t m_next;
+
+static const char *const BINARY_OP_NAMES[] = {
+	"ne", "eq", "gt", "lt", "ge", "le", "add", "sub", "mul", "div", "mod",
+	"and", "or", "xor", "shl", "shr", "sar",
+};
+
+/* emitters */
+#define emit(format, ...) \
+	fprintf(m_output, format __VA_OPT__(,) __VA_ARGS__)
+
+/* tool functions */
+static void number(const void *ptr, const char *name)
+{
+	if (!name)
+		htable_insert(m_numbers, (void *)ptr, m_next++);
+}
+
+static void symbol(const void *ptr, const char *name)
+{
+	if (name)
+	{
+		fputs(name, m_output);
+		return;
+	}
+
+	uint32_t *n = m_numbers ? htable_lookup(m_numbers, (void *)ptr) : NULL;
+	if (n)
+		emit("%%%u", *n);
+	else
+		// nothing defines it, which the verifier would've told
+		fputs("%?", m_output);
+}
+
+static void type(koopa_raw_type_t ty)
+{
+	switch (ty->tag)
+	{
+	case KOOPA_RTT_INT32:
+		fputs("i32", m_output);
+		break;
+	case KOOPA_RTT_UNIT:
+		break;
+	case KOOPA_RTT_ARRAY:
+		fputc('[', m_output);
+		type(ty->data.array.base);
+		emit(", %zu]", ty->data.array.len);
+		break;
+	case KOOPA_RTT_POINTER:
+		fputc('*', m_output);
+		type(ty->data.pointer.base);
+		break;
+	case KOOPA_RTT_FUNCTION:
+		fputc('(', m_output);
+		for (uint32_t i = 0; i < ty->data.function.params.len; ++i)
+		{
+			if (i > 0)
+				fputs(", ", m_output);
+			type(ty->data.function.params.buffer[i]);
+		}
+		fputc(')', m_output);
+		if (ty->data.function.ret->tag != KOOPA_RTT_UNIT)
+		{
+			fputs(": ", m_output);
+			type(ty->data.function.ret);
+		}
+		break;
+	}
+}
+
+static void operand(koopa_raw_value_t value)
+{
+	const koopa_raw_value_kind_t *kind = &value->kind;
+
+	switch (kind->tag)
+	{
+	case KOOPA_RVT_INTEGER:
+		emit("%d", kind->data.integer.value);
+		break;
+	case KOOPA_RVT_ZERO_INIT:
+		fputs("zeroinit", m_output);
+		break;
+	case KOOPA_RVT_UNDEF:
+		fputs("undef", m_output);
+		break;
+	case KOOPA_RVT_AGGREGATE:
+		fputc('{', m_output);
+		for (uint32_t i = 0; i < kind->data.aggregate.elems.len; ++i)
+		{
+			if (i > 0)
+				fputs(", ", m_output);
+			operand(kind->data.aggregate.elems.buffer[i]);
+		}
+		fputc('}', m_output);
+		break;
+	default:
+		symbol(value, value->name);
+		break;
+	}
+}
+
+static void operands(const koopa_raw_slice_t *values)
+{
+	for (uint32_t i = 0; i < values->len; ++i)
+	{
+		if (i > 0)
+			fputs(", ", m_output);
+		operand(values->buffer[i]);
+	}
+}
+
+/* `%name: type` of parameters */
+static void params(const koopa_raw_slice_t *values)
+{
+	for (uint32_t i = 0; i < values->len; ++i)
+	{
+		koopa_raw_value_t value = values->buffer[i];
+
+		if (i > 0)
+			fputs(", ", m_output);
+		symbol(value, value->name);
+		fputs(": ", m_output);
+		type(value->ty);
+	}
+}
+
+static void target(koopa_raw_basic_block_t bb, const koopa_raw_slice_t *args)
+{
+	symbol(bb, bb->name);
+	if (args->len > 0)
+	{
+		fputc('(', m_output);
+		operands(args);
+		fputc(')', m_output);
+	}
+}
+
+static void inst(koopa_raw_value_t value)
+{
+	const koopa_raw_value_kind_t *kind = &value->kind;
+
+	fputs("  ", m_output);
+	if (value->ty->tag != KOOPA_RTT_UNIT)
+	{
+		symbol(value, value->name);
+		fputs(" = ", m_output);
+	}
+
+	switch (kind->tag)
+	{
+	case KOOPA_RVT_ALLOC:
+		fputs("alloc ", m_output);
+		type(value->ty->data.pointer.base);
+		break;
+	case KOOPA_RVT_LOAD:
+		fputs("load ", m_output);
+		operand(kind->data.load.src);
+		break;
+	case KOOPA_RVT_STORE:
+		fputs("store ", m_output);
+		operand(kind->data.store.value);
+		fputs(", ", m_output);
+		operand(kind->data.store.dest);
+		break;
+	case KOOPA_RVT_GET_PTR:
+		fputs("getptr ", m_output);
+		operand(kind->data.get_ptr.src);
+		fputs(", ", m_output);
+		operand(kind->data.get_ptr.index);
+		break;
+	case KOOPA_RVT_GET_ELEM_PTR:
+		fputs("getelemptr ", m_output);
+		operand(kind->data.get_elem_ptr.src);
+		fputs(", ", m_output);
+		operand(kind->data.get_elem_ptr.index);
+		break;
+	case KOOPA_RVT_BINARY:
+		emit("%s ", BINARY_OP_NAMES[kind->data.binary.op]);
+		operand(kind->data.binary.lhs);
+		fputs(", ", m_output);
+		operand(kind->data.binary.rhs);
+		break;
+	case KOOPA_RVT_BRANCH:
+		fputs("br ", m_output);
+		operand(kind->data.branch.cond);
+		fputs(", ", m_output);
+		target(kind->data.branch.true_bb, &kind->data.branch.true_args);
+		fputs(", ", m_output);
+		target(kind->data.branch.false_bb,
+		       &kind->data.branch.false_args);
+		break;
+	case KOOPA_RVT_JUMP:
+		fputs("jump ", m_output);
+		target(kind->data.jump.target, &kind->data.jump.args);
+		break;
+	case KOOPA_RVT_CALL:
+		emit("call %s(", kind->data.call.callee->name);
+		operands(&kind->data.call.args);
+		fputc(')', m_output);
+		break;
+	case KOOPA_RVT_RETURN:
+		fputs("ret", m_output);
+		if (kind->data.ret.value)
+		{
+			fputc(' ', m_output);
+			operand(kind->data.ret.value);
+		}
+		break;
+	default:
+		assert(false /* not an instruction */);
+	}
+	fputc('\n', m_output);
+}
+
+static void global(koopa_raw_value_t value)
+{
+	assert(value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC);
+
+	emit("global %s = alloc ", value->name);
+	type(value->ty->data.pointer.base);
+	fputs(", ", m_output);
+	operand(value->kind.data.global_alloc.init);
+	fputc('\n', m_output);
+}
+
+static void declaration(koopa_raw_function_t function)
+{
+	emit("decl %s", function->name);
+	type(function->ty);
+	fputc('\n', m_output);
+}
+
+static void definition(koopa_raw_function_t function)
+{
+	/* basic blocks may be jumped to, and values used, before they're
+	 * printed, so everything is numbered ahead */
+	m_numbers = htable_ptru32_new();
+	m_next = 0;
+	for (uint32_t i = 0; i < function->params.len; ++i)
+	{
+		koopa_raw_value_t param = function->params.buffer[i];
+		number(param, param->name);
+	}
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		koopa_raw_basic_block_t bb = function->bbs.buffer[i];
+
+		number(bb, bb->name);
+		for (uint32_t j = 0; j < bb->params.len; ++j)
+		{
+			koopa_raw_value_t param = bb->params.buffer[j];
+			number(param, param->name);
+		}
+		for (uint32_t j = 0; j < bb->insts.len; ++j)
+		{
+			koopa_raw_value_t value = bb->insts.buffer[j];
+			if (value->ty->tag != KOOPA_RTT_UNIT)
+				number(value, value->name);
+		}
+	}
+
+	koopa_raw_type_t ret = function->ty->data.function.ret;
+	emit("fun %s(", function->name);
+	params(&function->params);
+	fputc(')', m_output);
+	if (ret->tag != KOOPA_RTT_UNIT)
+	{
+		fputs(": ", m_output);
+		type(ret);
+	}
+	fputs(" {\n", m_output);
+
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		koopa_raw_basic_block_t bb = function->bbs.buffer[i];
+
+		if (i > 0)
+			fputc('\n', m_output);
+		symbol(bb, bb->name);
+		if (bb->params.len > 0)
+		{
+			fputc('(', m_output);
+			params(&bb->params);
+			fputc(')', m_output);
+		}
+		fputs(":\n", m_output);
+		for (uint32_t j = 0; j < bb->insts.len; ++j)
+			inst(bb->insts.buffer[j]);
+	}
+	fputs("}\n", m_output);
+
+	htable_ptru32_delete(m_numbers);
+	m_numbers = NULL;
+}
+
+/* public defn.s */
+bool dump(const koopa_raw_program_t *program, FILE *output)
+{
+	m_output = output;
+
+	for (uint32_t i = 0; i < program->values.len; ++i)
+		global(program->values.buffer[i]);
+
+	/* declarations stick together, everything else is set apart */
+	bool apart = program->values.len > 0;
+	for (uint32_t i = 0; i < program->funcs.len; ++i)
+	{
+		koopa_raw_function_t function = program->funcs.buffer[i];
+		bool decl = function->bbs.len == 0;
+
+		if (apart || (i > 0 && !decl))
+			fputc('\n', output);
+		apart = !decl;
+
+		if (decl)
+			declaration(function);
+		else
+			definition(function);
+	}
+
+	return !ferror(output);
+}
@@ -0,0 +1,20 @@
+/**
+ * dump.h
+ * Text-form Koopa IR printer.
+ */
+
+#ifndef _DUMP_H_
+#define _DUMP_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "koopa.h"
+
+/* Print `program` as text-form Koopa IR, straight from memory IR. Named
+ * values keep their names, which IR generation makes unique; the rest are
+ * numbered in order of definition within each function.
+ * @return whether all of it has been written. */
+bool dump(const koopa_raw_program_t *program, FILE *output);
+
+#endif//_DUMP_H_
@@ -0,0 +1,187 @@
+#pragma clang diagnostic ignored \
+	"-Wincompatible-pointer-types-discards-qualifiers"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "globaldce.h"
+#include "hashtable.h"
+#include "koopaext.h"
+#include "macros.h"
+#include "passes.h"
+#include "vector.h"
+
+/* state variables */
+static _Thread_local htable_ptru32_t m_ht_live;
+
+/* tool functions */
+static bool is_live(const void *ptr)
+{
+	return htable_lookup(m_ht_live, (void *)ptr) != NULL;
+}
+
+static void mark_live(const void *ptr, struct vector_ptr_t *worklist)
+{
+	if (is_live(ptr))
+		return;
+
+	htable_insert(m_ht_live, (void *)ptr, true);
+	if (worklist)
+		vector_ptr_push(worklist, (void *)ptr);
+}
+
+static void mark_global(koopa_raw_value_t value)
+{
+	if (value && value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+		mark_live(value, NULL);
+}
+
+/* globals are read by anything but a store into them */
+static void mark_reads(koopa_raw_value_t value)
+{
+	const koopa_raw_value_kind_t *kind = &value->kind;
+
+	switch (kind->tag)
+	{
+	case KOOPA_RVT_LOAD:
+		mark_global(kind->data.load.src);
+		break;
+	case KOOPA_RVT_STORE:
+		mark_global(kind->data.store.value);
+		break;
+	case KOOPA_RVT_BINARY:
+		mark_global(kind->data.binary.lhs);
+		mark_global(kind->data.binary.rhs);
+		break;
+	case KOOPA_RVT_CALL:
+		for (uint32_t i = 0; i < kind->data.call.args.len; ++i)
+			mark_global(kind->data.call.args.buffer[i]);
+		break;
+	case KOOPA_RVT_RETURN:
+		mark_global(kind->data.ret.value);
+		break;
+	default:
+		break;
+	}
+}
+
+static void mark(koopa_raw_function_t main)
+{
+	struct vector_ptr_t *worklist = vector_ptr_new(16);
+
+	mark_live(main, worklist);
+	while (worklist->size > 0)
+	{
+		koopa_raw_function_t function = vector_ptr_pop(worklist);
+
+		for (uint32_t i = 0; i < function->bbs.len; ++i)
+		{
+			koopa_raw_basic_block_t basic_block =
+				function->bbs.buffer[i];
+
+			for (uint32_t j = 0; j < basic_block->insts.len; ++j)
+			{
+				koopa_raw_value_t value =
+					basic_block->insts.buffer[j];
+
+				mark_reads(value);
+				if (value->kind.tag == KOOPA_RVT_CALL)
+					mark_live(value->kind.data.call.callee,
+						  worklist);
+			}
+		}
+	}
+
+	vector_ptr_delete(worklist);
+}
+
+static bool is_dead_store(koopa_raw_value_t value)
+{
+	if (value->kind.tag != KOOPA_RVT_STORE)
+		return false;
+
+	koopa_raw_value_t dest = value->kind.data.store.dest;
+	return dest->kind.tag == KOOPA_RVT_GLOBAL_ALLOC && !is_live(dest);
+}
+
+static void sweep_stores(koopa_raw_function_t function)
+{
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		koopa_raw_basic_block_data_t *basic_block =
+			function->bbs.buffer[i];
+		koopa_raw_slice_t *insts = &basic_block->insts;
+
+		uint32_t len = 0;
+		for (uint32_t j = 0; j < insts->len; ++j)
+		{
+			koopa_raw_value_t value = insts->buffer[j];
+
+			if (!is_dead_store(value))
+			{
+				insts->buffer[len++] = value;
+				continue;
+			}
+
+			slice_remove(&value->kind.data.store.value->used_by,
+				     value);
+			slice_remove(&value->kind.data.store.dest->used_by,
+				     value);
+		}
+		insts->len = len;
+	}
+}
+
+/* public defn.s */
+void globaldce(koopa_raw_program_t *program)
+{
+	koopa_raw_function_t main = NULL;
+	for (uint32_t i = 0; i < program->funcs.len; ++i)
+	{
+		koopa_raw_function_t function = program->funcs.buffer[i];
+
+		if (strcmp(function->name, "@main") == 0)
+			main = function;
+	}
+
+	/* not a whole program */
+	if (!main)
+		return;
+
+	m_ht_live = htable_ptru32_new();
+	mark(main);
+
+	uint32_t len = 0;
+	for (uint32_t i = 0; i < program->funcs.len; ++i)
+	{
+		koopa_raw_function_t function = program->funcs.buffer[i];
+
+		if (!is_live(function))
+		{
+			passes_remark("dead function: %s", function->name + 1);
+			continue;
+		}
+
+		sweep_stores(function);
+		program->funcs.buffer[len++] = function;
+	}
+	program->funcs.len = len;
+
+	len = 0;
+	for (uint32_t i = 0; i < program->values.len; ++i)
+	{
+		koopa_raw_value_t value = program->values.buffer[i];
+
+		if (!is_live(value))
+		{
+			passes_remark("dead global: %s", value->name + 1);
+			continue;
+		}
+
+		program->values.buffer[len++] = value;
+	}
+	program->values.len = len;
+
+	htable_ptru32_delete(m_ht_live);
+}
@@ -0,0 +1,16 @@
+/**
+ * globaldce.h
+ * Dead function and dead global elimination.
+ */
+
+#ifndef _GLOBALDCE_H_
+#define _GLOBALDCE_H_
+
+#include "koopa.h"
+
+/* Remove functions unreachable from `main` in the call graph, and globals
+ * that are never read, along with stores into them. Removed symbols are
+ * noted as remarks of passes. */
+void globaldce(koopa_raw_program_t *program);
+
+#endif//_GLOBALDCE_H_
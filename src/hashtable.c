@@ -13,7 +13,9 @@ struct _htable_ppuu32_item_t {
 };
 
 struct _htable_ppuu32_t {
-	struct _htable_ppuu32_item_t *data[HASHTABLE_SIZE];
+	struct _htable_ppuu32_item_t **data;
+	uint32_t bits;
+	uint32_t count;
 };
 
 struct _htable_ptru32_item_t {
@@ -23,7 +25,9 @@ struct _htable_ptru32_item_t {
 };
 
 struct _htable_ptru32_t {
-	struct _htable_ptru32_item_t *data[HASHTABLE_SIZE];
+	struct _htable_ptru32_item_t **data;
+	uint32_t bits;
+	uint32_t count;
 };
 
 struct _htable_strsym_item_t {
@@ -52,13 +56,14 @@ static uint8_t hash_str(char *s)
 	return h;
 }
 
-static uint8_t hash_ptr(void *p)
+/* top `bits` bits of the product, which are the well-mixed ones */
+static uint32_t hash_ptr(void *p, uint32_t bits)
 {
 	/* really need `constexpr` here */
 	if (sizeof(void *) == 8)
-		return (((uintptr_t)p) * 0x9E3779B97F4A7C15) >> 56;
+		return (((uintptr_t)p) * 0x9E3779B97F4A7C15) >> (64 - bits);
 	if (sizeof(void *) == 4)
-		return (((uintptr_t)p) * 0x9E3779B9) >> 24;
+		return (((uintptr_t)p) * 0x9E3779B9) >> (32 - bits);
 }
 
 /* tool functions */
@@ -98,6 +103,61 @@ static struct _htable_ppuu32_item_t *htable_ppuu32_item_new(
 	return new;
 }
 
+/* pointer-keyed tables double their buckets once they hold as many items.
+ * bucket `i` splits into `2i` and `2i + 1`, so chains only need to keep their
+ * order, newest first, for shadowed keys to stay shadowed */
+static void htable_ptru32_grow(struct _htable_ptru32_t *table)
+{
+	uint32_t size = 1u << table->bits++;
+	struct _htable_ptru32_item_t **data = calloc(2 * size, sizeof(*data));
+	for (uint32_t i = 0; i < size; ++i)
+	{
+		/* oldest first */
+		struct _htable_ptru32_item_t *reversed = NULL, *item, *next;
+		for (item = table->data[i]; item; item = next)
+		{
+			next = item->next;
+			item->next = reversed;
+			reversed = item;
+		}
+		for (item = reversed; item; item = next)
+		{
+			next = item->next;
+			uint32_t j = hash_ptr(item->key, table->bits);
+			item->next = data[j];
+			data[j] = item;
+		}
+	}
+	free(table->data);
+	table->data = data;
+}
+
+static void htable_ppuu32_grow(struct _htable_ppuu32_t *table)
+{
+	uint32_t size = 1u << table->bits++;
+	struct _htable_ppuu32_item_t **data = calloc(2 * size, sizeof(*data));
+	for (uint32_t i = 0; i < size; ++i)
+	{
+		/* oldest first */
+		struct _htable_ppuu32_item_t *reversed = NULL, *item, *next;
+		for (item = table->data[i]; item; item = next)
+		{
+			next = item->next;
+			item->next = reversed;
+			reversed = item;
+		}
+		for (item = reversed; item; item = next)
+		{
+			next = item->next;
+			uint32_t j = hash_ptr(item->key.ptr, table->bits);
+			item->next = data[j];
+			data[j] = item;
+		}
+	}
+	free(table->data);
+	table->data = data;
+}
+
 /* HashTable<String, Ptr> */
 htable_strsym_t htable_strsym_new(void)
 {
@@ -167,12 +227,14 @@ void htable_strsym_delete(htable_strsym_t table)
 htable_ptru32_t htable_ptru32_new(void)
 {
 	struct _htable_ptru32_t *new = calloc(1, sizeof(*new));
+	new->data = calloc(HASHTABLE_SIZE, sizeof(*new->data));
+	new->bits = HASHTABLE_LOG;
 	return new;
 }
 
 uint32_t *htable_ptru32_lookup(htable_ptru32_t table, void *key)
 {
-	uint8_t i = hash_ptr(key);
+	uint32_t i = hash_ptr(key, table->bits);
 	struct _htable_ptru32_item_t *item = table->data[i];
 	if (!item)
 		return NULL;
@@ -188,7 +250,10 @@ uint32_t *htable_ptru32_lookup(htable_ptru32_t table, void *key)
 
 uint32_t *htable_ptru32_insert(htable_ptru32_t table, void *key, uint32_t value)
 {
-	uint8_t i = hash_ptr(key);
+	if (++table->count > 1u << table->bits)
+		htable_ptru32_grow(table);
+
+	uint32_t i = hash_ptr(key, table->bits);
 	struct _htable_ptru32_item_t *new = htable_ptru32_item_new(key, value);
 	if (table->data[i])
 		new->next = table->data[i];
@@ -199,7 +264,7 @@ uint32_t *htable_ptru32_insert(htable_ptru32_t table, void *key, uint32_t value)
 
 void htable_ptru32_delete(htable_ptru32_t table)
 {
-	for (size_t i = 0; i < HASHTABLE_SIZE; ++i)
+	for (size_t i = 0; i < 1u << table->bits; ++i)
 	{
 		struct _htable_ptru32_item_t *item = table->data[i];
 		struct _htable_ptru32_item_t *next;
@@ -210,6 +275,7 @@ void htable_ptru32_delete(htable_ptru32_t table)
 			item = next;
 		}
 	}
+	free(table->data);
 	free(table);
 }
 
@@ -217,12 +283,14 @@ void htable_ptru32_delete(htable_ptru32_t table)
 htable_ppuu32_t htable_ppuu32_new(void)
 {
 	struct _htable_ppuu32_t *new = calloc(1, sizeof(*new));
+	new->data = calloc(HASHTABLE_SIZE, sizeof(*new->data));
+	new->bits = HASHTABLE_LOG;
 	return new;
 }
 
 uint32_t *htable_ppuu32_lookup(htable_ppuu32_t table, struct pair_ptru32_t key)
 {
-	uint8_t i = hash_ptr(key.ptr);
+	uint32_t i = hash_ptr(key.ptr, table->bits);
 	struct _htable_ppuu32_item_t *item = table->data[i];
 	if (!item)
 		return NULL;
@@ -239,7 +307,10 @@ uint32_t *htable_ppuu32_lookup(htable_ppuu32_t table, struct pair_ptru32_t key)
 uint32_t *htable_ppuu32_insert(htable_ppuu32_t table, struct pair_ptru32_t key,
 			       uint32_t value)
 {
-	uint8_t i = hash_ptr(key.ptr);
+	if (++table->count > 1u << table->bits)
+		htable_ppuu32_grow(table);
+
+	uint32_t i = hash_ptr(key.ptr, table->bits);
 	struct _htable_ppuu32_item_t *new = htable_ppuu32_item_new(key, value);
 	if (table->data[i])
 		new->next = table->data[i];
@@ -250,7 +321,7 @@ uint32_t *htable_ppuu32_insert(htable_ppuu32_t table, struct pair_ptru32_t key,
 
 void htable_ppuu32_delete(htable_ppuu32_t table)
 {
-	for (size_t i = 0; i < HASHTABLE_SIZE; ++i)
+	for (size_t i = 0; i < 1u << table->bits; ++i)
 	{
 		struct _htable_ppuu32_item_t *item = table->data[i];
 		struct _htable_ppuu32_item_t *next;
@@ -261,5 +332,6 @@ void htable_ppuu32_delete(htable_ppuu32_t table)
 			item = next;
 		}
 	}
+	free(table->data);
 	free(table);
 }
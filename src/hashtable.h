@@ -14,6 +14,7 @@
 
 #define HASHTABLE_BITS 0xff
 #define HASHTABLE_SIZE 256
+#define HASHTABLE_LOG 8
 
 /* HashTable<Pair<Ptr, UInt32>, UInt32> */
 struct pair_ptru32_t {
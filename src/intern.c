@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "macros.h"
+
+#define CHUNK_SIZE (64 KiB)
+#define INITIAL_CAPACITY 1024
+
+/* strings live in chunks that are never moved */
+struct chunk_t {
+	struct chunk_t *next;
+	size_t used;
+	char buf[];
+};
+
+/* open addressing, linear probing */
+struct entry_t {
+	const char *str;
+	size_t len;
+	uint32_t hash;
+};
+
+/* state variables */
+static _Thread_local struct chunk_t *m_chunks;
+static _Thread_local struct entry_t *m_entries;
+static _Thread_local size_t m_capacity;
+static _Thread_local size_t m_count;
+
+/* tool functions */
+static uint32_t fnv1a(const char *text, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; ++i)
+		hash = (hash ^ (uint8_t)text[i]) * 16777619u;
+
+	return hash;
+}
+
+static char *store(const char *text, size_t len)
+{
+	if (!m_chunks || m_chunks->used + len + 1 > CHUNK_SIZE)
+	{
+		size_t size = max((size_t)CHUNK_SIZE, len + 1);
+		struct chunk_t *chunk = malloc(sizeof(*chunk) + size);
+		chunk->next = m_chunks;
+		chunk->used = 0;
+		m_chunks = chunk;
+	}
+
+	char *str = m_chunks->buf + m_chunks->used;
+	memcpy(str, text, len);
+	str[len] = '\0';
+	m_chunks->used += len + 1;
+
+	return str;
+}
+
+static void grow(void)
+{
+	struct entry_t *old = m_entries;
+	size_t old_capacity = m_capacity;
+
+	m_capacity = old_capacity ? old_capacity * 2 : INITIAL_CAPACITY;
+	m_entries = calloc(m_capacity, sizeof(*m_entries));
+	for (size_t i = 0; i < old_capacity; ++i)
+	{
+		if (!old[i].str)
+			continue;
+
+		size_t j = old[i].hash & (m_capacity - 1);
+		while (m_entries[j].str)
+			j = (j + 1) & (m_capacity - 1);
+		m_entries[j] = old[i];
+	}
+	free(old);
+}
+
+/* public defn.s */
+const char *intern(const char *text, size_t len)
+{
+	if (2 * (m_count + 1) > m_capacity)
+		grow();
+
+	uint32_t hash = fnv1a(text, len);
+	size_t i = hash & (m_capacity - 1);
+	for (; m_entries[i].str; i = (i + 1) & (m_capacity - 1))
+		if (m_entries[i].hash == hash && m_entries[i].len == len
+		    && memcmp(m_entries[i].str, text, len) == 0)
+			return m_entries[i].str;
+
+	m_entries[i] = (struct entry_t) {
+		.str = store(text, len),
+		.len = len,
+		.hash = hash,
+	};
+	++m_count;
+
+	return m_entries[i].str;
+}
+
+void intern_clear(void)
+{
+	while (m_chunks)
+	{
+		struct chunk_t *next = m_chunks->next;
+		free(m_chunks);
+		m_chunks = next;
+	}
+
+	free(m_entries);
+	m_entries = NULL;
+	m_capacity = 0;
+	m_count = 0;
+}
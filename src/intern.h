@@ -0,0 +1,18 @@
+/**
+ * intern.h
+ * Interned strings.
+ */
+
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+#include <stddef.h>
+
+/* Unique, NUL-terminated copy of `len` bytes at `text`; equal strings give
+ * the same pointer. Valid until `intern_clear()`. */
+const char *intern(const char *text, size_t len);
+
+/* Free every interned string. */
+void intern_clear(void);
+
+#endif//_INTERN_H_
@@ -0,0 +1,639 @@
+#pragma clang diagnostic ignored \
+	"-Wincompatible-pointer-types-discards-qualifiers"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "hashtable.h"
+#include "ipcp.h"
+#include "koopaext.h"
+#include "macros.h"
+#include "vector.h"
+
+/* cloning limits */
+#define CLONE_MAX 2
+#define CLONE_INSTS_MAX 256
+// a call site in a loop, or two outside of any
+#define CLONE_WEIGHT_MIN 2
+#define LOOP_SCALE 3
+#define LOOP_DEPTH_MAX 6
+
+/* call sites of a function */
+struct callee_t {
+	koopa_raw_function_data_t *function;
+	struct vector_ptr_t *calls;
+	// estimated execution count of each call
+	struct vector_u32_t *weights;
+};
+
+/* old -> new, for values and basic blocks */
+struct map_t {
+	htable_ptru32_t indices;
+	struct vector_ptr_t *news;
+};
+
+/* state variables */
+static _Thread_local struct callee_t *m_callees;
+static _Thread_local uint32_t m_callee_count;
+static _Thread_local htable_ptru32_t m_ht_callees;
+
+/* maps */
+static struct map_t map_new(void)
+{
+	return (struct map_t) {
+		.indices = htable_ptru32_new(),
+		.news = vector_ptr_new(16),
+	};
+}
+
+static void map_delete(struct map_t *map)
+{
+	vector_ptr_delete(map->news);
+	htable_ptru32_delete(map->indices);
+}
+
+static void map_insert(struct map_t *map, const void *old, const void *new)
+{
+	htable_insert(map->indices, (void *)old, map->news->size);
+	vector_ptr_push(map->news, (void *)new);
+}
+
+static void *map_get(const struct map_t *map, const void *old)
+{
+	uint32_t *it = htable_lookup(map->indices, (void *)old);
+
+	return it ? map->news->data[*it] : (void *)old;
+}
+
+/* tool functions */
+static void slice_erase(koopa_raw_slice_t *slice, uint32_t index)
+{
+	assert(index < slice->len);
+
+	memmove(&slice->buffer[index], &slice->buffer[index + 1],
+		sizeof(void *) * (slice->len - index - 1));
+	--slice->len;
+}
+
+static bool as_const(koopa_raw_value_t value, int32_t *constant)
+{
+	if (value->kind.tag != KOOPA_RVT_INTEGER)
+		return false;
+
+	*constant = value->kind.data.integer.value;
+	return true;
+}
+
+static uint32_t count_insts(koopa_raw_function_t function)
+{
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		koopa_raw_basic_block_t basic_block = function->bbs.buffer[i];
+		count += basic_block->insts.len;
+	}
+
+	return count;
+}
+
+static bool name_taken(const koopa_raw_program_t *program, const char *name)
+{
+	for (uint32_t i = 0; i < program->funcs.len; ++i)
+	{
+		koopa_raw_function_t function = program->funcs.buffer[i];
+
+		if (strcmp(function->name, name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/* `user` now uses what `old` maps to. a fresh user hasn't been recorded
+ * anywhere yet, otherwise only new operands need to learn about it */
+static void *remap_value(const struct map_t *map, koopa_raw_value_t old,
+			 koopa_raw_value_t user, bool fresh)
+{
+	koopa_raw_value_data_t *new = map_get(map, old);
+	if (new && (fresh || new != old))
+		slice_append(&new->used_by, user);
+
+	return new;
+}
+
+static void *remap_bb(const struct map_t *map, koopa_raw_basic_block_t old,
+		      koopa_raw_value_t user, bool fresh)
+{
+	koopa_raw_basic_block_data_t *new = map_get(map, old);
+	if (new && (fresh || new != old))
+		slice_append(&new->used_by, user);
+
+	return new;
+}
+
+/* rewrite operands of every instruction in `function` through `map` */
+static void remap_operands(koopa_raw_function_t function,
+			   const struct map_t *map, bool fresh)
+{
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		koopa_raw_basic_block_t basic_block = function->bbs.buffer[i];
+
+		for (uint32_t j = 0; j < basic_block->insts.len; ++j)
+		{
+			koopa_raw_value_data_t *value =
+				basic_block->insts.buffer[j];
+			koopa_raw_value_kind_t *kind = &value->kind;
+
+			switch (kind->tag)
+			{
+			case KOOPA_RVT_LOAD:
+				kind->data.load.src =
+					remap_value(map, kind->data.load.src,
+						    value, fresh);
+				break;
+			case KOOPA_RVT_STORE:
+				kind->data.store.value =
+					remap_value(map, kind->data.store.value,
+						    value, fresh);
+				kind->data.store.dest =
+					remap_value(map, kind->data.store.dest,
+						    value, fresh);
+				break;
+			case KOOPA_RVT_BINARY:
+				kind->data.binary.lhs =
+					remap_value(map, kind->data.binary.lhs,
+						    value, fresh);
+				kind->data.binary.rhs =
+					remap_value(map, kind->data.binary.rhs,
+						    value, fresh);
+				break;
+			case KOOPA_RVT_BRANCH:
+				kind->data.branch.cond =
+					remap_value(map, kind->data.branch.cond,
+						    value, fresh);
+				kind->data.branch.true_bb =
+					remap_bb(map, kind->data.branch.true_bb,
+						 value, fresh);
+				kind->data.branch.false_bb =
+					remap_bb(map,
+						 kind->data.branch.false_bb,
+						 value, fresh);
+				break;
+			case KOOPA_RVT_JUMP:
+				kind->data.jump.target =
+					remap_bb(map, kind->data.jump.target,
+						 value, fresh);
+				break;
+			case KOOPA_RVT_CALL:
+				for (uint32_t k = 0;
+				     k < kind->data.call.args.len; ++k)
+					kind->data.call.args.buffer[k] =
+						remap_value(map,
+						kind->data.call.args.buffer[k],
+						value, fresh);
+				break;
+			case KOOPA_RVT_RETURN:
+				if (kind->data.ret.value)
+					kind->data.ret.value = remap_value(map,
+						kind->data.ret.value, value,
+						fresh);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+/* specialization */
+static bool is_only_store(koopa_raw_value_t alloc, koopa_raw_value_t store)
+{
+	for (uint32_t i = 0; i < alloc->used_by.len; ++i)
+	{
+		koopa_raw_value_t user = alloc->used_by.buffer[i];
+
+		if (user == store)
+			continue;
+		if (user->kind.tag != KOOPA_RVT_LOAD
+		    || user->kind.data.load.src != alloc)
+			return false;
+	}
+
+	return true;
+}
+
+/* bind the parameter to a constant. in memory form a parameter is stored
+ * into its own alloc right at the entry; if nothing else ever stores there,
+ * loads from it become the constant itself. */
+static void bind_param(koopa_raw_function_data_t *function, uint32_t index,
+		       int32_t constant)
+{
+	koopa_raw_value_data_t *param = function->params.buffer[index];
+
+	for (uint32_t i = 0; i < param->used_by.len; ++i)
+	{
+		koopa_raw_value_data_t *store = param->used_by.buffer[i];
+		if (store->kind.tag != KOOPA_RVT_STORE)
+			continue;
+
+		koopa_raw_value_data_t *integer =
+			(void *)koopa_raw_integer(constant);
+		store->kind.data.store.value = integer;
+		slice_append(&integer->used_by, store);
+
+		koopa_raw_value_data_t *alloc =
+			(void *)store->kind.data.store.dest;
+		if (alloc->kind.tag != KOOPA_RVT_ALLOC
+		    || !is_only_store(alloc, store))
+			continue;
+
+		/* forward the constant, then drop the alloc altogether */
+		struct map_t map = map_new();
+		for (uint32_t j = 0; j < alloc->used_by.len; ++j)
+			if (alloc->used_by.buffer[j] != store)
+				map_insert(&map, alloc->used_by.buffer[j],
+					   koopa_raw_integer(constant));
+		map_insert(&map, store, NULL);
+		map_insert(&map, alloc, NULL);
+
+		remap_operands(function, &map, false);
+		for (uint32_t j = 0; j < function->bbs.len; ++j)
+		{
+			koopa_raw_basic_block_data_t *basic_block =
+				function->bbs.buffer[j];
+			koopa_raw_slice_t *insts = &basic_block->insts;
+
+			uint32_t len = 0;
+			for (uint32_t k = 0; k < insts->len; ++k)
+				if (!htable_lookup(map.indices,
+						   (void *)insts->buffer[k]))
+					insts->buffer[len++] = insts->buffer[k];
+			insts->len = len;
+		}
+		map_delete(&map);
+	}
+	param->used_by.len = 0;
+}
+
+/* remove the parameter from the signature, and the argument from calls */
+static void drop_param(koopa_raw_function_data_t *function, uint32_t index,
+		       struct vector_ptr_t *calls)
+{
+	slice_erase(&function->params, index);
+	slice_erase(&((koopa_raw_type_kind_t *)function->ty)
+		    ->data.function.params, index);
+	for (uint32_t i = index; i < function->params.len; ++i)
+	{
+		koopa_raw_value_data_t *param = function->params.buffer[i];
+		--param->kind.data.func_arg_ref.index;
+	}
+
+	for (uint32_t i = 0; i < calls->size; ++i)
+	{
+		koopa_raw_value_data_t *call = calls->data[i];
+		koopa_raw_value_data_t *arg =
+			call->kind.data.call.args.buffer[index];
+		slice_remove(&arg->used_by, call);
+		slice_erase(&call->kind.data.call.args, index);
+	}
+}
+
+/* call graph */
+static void collect_calls(const koopa_raw_program_t *program)
+{
+	m_callee_count = 0;
+	m_callees = malloc(sizeof(*m_callees) * program->funcs.len);
+	m_ht_callees = htable_ptru32_new();
+	for (uint32_t i = 0; i < program->funcs.len; ++i)
+	{
+		koopa_raw_function_data_t *function = program->funcs.buffer[i];
+		if (function->bbs.len == 0)
+			continue;
+
+		htable_insert(m_ht_callees, function, m_callee_count);
+		m_callees[m_callee_count++] = (struct callee_t) {
+			.function = function,
+			.calls = vector_ptr_new(4),
+			.weights = vector_u32_new(4),
+		};
+	}
+
+	for (uint32_t i = 0; i < m_callee_count; ++i)
+	{
+		koopa_raw_function_t caller = m_callees[i].function;
+		struct cfg_t *cfg = cfg_new(caller);
+
+		for (uint32_t j = 0; j < caller->bbs.len; ++j)
+		{
+			koopa_raw_basic_block_t basic_block =
+				caller->bbs.buffer[j];
+			uint32_t weight = 1u << (LOOP_SCALE
+						 * min(cfg->depth[j],
+						       LOOP_DEPTH_MAX));
+
+			for (uint32_t k = 0; k < basic_block->insts.len; ++k)
+			{
+				koopa_raw_value_t value =
+					basic_block->insts.buffer[k];
+				if (value->kind.tag != KOOPA_RVT_CALL)
+					continue;
+
+				uint32_t *it = htable_lookup(m_ht_callees,
+					(void *)value->kind.data.call.callee);
+				if (!it)
+					continue;
+
+				vector_ptr_push(m_callees[*it].calls,
+						(void *)value);
+				vector_u32_push(m_callees[*it].weights, weight);
+			}
+		}
+
+		cfg_delete(cfg);
+	}
+}
+
+static void free_calls(void)
+{
+	for (uint32_t i = 0; i < m_callee_count; ++i)
+	{
+		vector_u32_delete(m_callees[i].weights);
+		vector_ptr_delete(m_callees[i].calls);
+	}
+	htable_ptru32_delete(m_ht_callees);
+	free(m_callees);
+}
+
+/* cloning */
+// clones live as long as the rest of the program
+static void *allocate(size_t size)
+{
+	return bump_malloc(koopa_raw_program_allocator(), size);
+}
+
+static koopa_raw_value_data_t *clone_value(koopa_raw_value_t value)
+{
+	koopa_raw_value_data_t *new = allocate(sizeof(*new));
+	*new = *value;
+	new->used_by = slice_new(0, KOOPA_RSIK_VALUE);
+
+	if (value->kind.tag == KOOPA_RVT_CALL)
+	{
+		const koopa_raw_slice_t *args = &value->kind.data.call.args;
+
+		new->kind.data.call.args = slice_new(args->len,
+						     KOOPA_RSIK_VALUE);
+		for (uint32_t i = 0; i < args->len; ++i)
+			new->kind.data.call.args.buffer[i] = args->buffer[i];
+	}
+
+	return new;
+}
+
+static char *suffixed(const char *name, uint32_t suffix)
+{
+	size_t len = strlen(name) + 16;
+	char *new = allocate(len);
+	snprintf(new, len, "%s_c%u", name, suffix);
+
+	return new;
+}
+
+static koopa_raw_function_data_t *clone_function(koopa_raw_function_t function,
+						 const char *name,
+						 uint32_t suffix)
+{
+	struct map_t map = map_new();
+
+	koopa_raw_function_data_t *new = allocate(sizeof(*new));
+	new->name = name;
+
+	koopa_raw_type_kind_t *ty = allocate(sizeof(*ty));
+	*ty = *function->ty;
+	ty->data.function.params = slice_new(0, KOOPA_RSIK_TYPE);
+	for (uint32_t i = 0; i < function->params.len; ++i)
+		slice_append(&ty->data.function.params,
+			     function->ty->data.function.params.buffer[i]);
+	new->ty = ty;
+
+	new->params = slice_new(0, KOOPA_RSIK_VALUE);
+	for (uint32_t i = 0; i < function->params.len; ++i)
+	{
+		koopa_raw_value_data_t *param =
+			clone_value(function->params.buffer[i]);
+		map_insert(&map, function->params.buffer[i], param);
+		slice_append(&new->params, param);
+	}
+
+	new->bbs = slice_new(0, KOOPA_RSIK_BASIC_BLOCK);
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		koopa_raw_basic_block_t basic_block = function->bbs.buffer[i];
+
+		koopa_raw_basic_block_data_t *new_bb =
+			allocate(sizeof(*new_bb));
+		new_bb->name = suffixed(basic_block->name, suffix);
+		new_bb->params = slice_new(0, KOOPA_RSIK_VALUE);
+		new_bb->used_by = slice_new(0, KOOPA_RSIK_VALUE);
+		new_bb->insts = slice_new(basic_block->insts.len,
+					  KOOPA_RSIK_VALUE);
+		map_insert(&map, basic_block, new_bb);
+		slice_append(&new->bbs, new_bb);
+
+		for (uint32_t j = 0; j < basic_block->insts.len; ++j)
+		{
+			koopa_raw_value_t value = basic_block->insts.buffer[j];
+			koopa_raw_value_data_t *copy = clone_value(value);
+
+			map_insert(&map, value, copy);
+			new_bb->insts.buffer[j] = copy;
+		}
+	}
+
+	/* copies are users of whatever they use in the clone, be it copied
+	 * as well or not */
+	remap_operands(new, &map, true);
+
+	map_delete(&map);
+	return new;
+}
+
+static bool same_pattern(koopa_raw_value_t a, koopa_raw_value_t b)
+{
+	const koopa_raw_slice_t *lhs = &a->kind.data.call.args;
+	const koopa_raw_slice_t *rhs = &b->kind.data.call.args;
+
+	for (uint32_t i = 0; i < lhs->len; ++i)
+	{
+		int32_t x, y;
+		bool is_x = as_const(lhs->buffer[i], &x);
+		bool is_y = as_const(rhs->buffer[i], &y);
+
+		if (is_x != is_y || (is_x && x != y))
+			return false;
+	}
+
+	return true;
+}
+
+static bool has_const(koopa_raw_value_t call)
+{
+	const koopa_raw_slice_t *args = &call->kind.data.call.args;
+
+	for (uint32_t i = 0; i < args->len; ++i)
+	{
+		int32_t constant;
+		if (as_const(args->buffer[i], &constant))
+			return true;
+	}
+
+	return false;
+}
+
+/* bind and drop every parameter `pattern` passes a constant to */
+static void specialize(koopa_raw_function_data_t *function,
+		       koopa_raw_value_t pattern, struct vector_ptr_t *calls)
+{
+	const koopa_raw_slice_t *args = &pattern->kind.data.call.args;
+
+	for (uint32_t i = args->len; i-- > 0; )
+	{
+		int32_t constant;
+		if (!as_const(args->buffer[i], &constant))
+			continue;
+
+		bind_param(function, i, constant);
+		drop_param(function, i, calls);
+	}
+}
+
+/* public defn.s */
+void ipcp(koopa_raw_program_t *program)
+{
+	collect_calls(program);
+
+	for (uint32_t i = 0; i < m_callee_count; ++i)
+	{
+		struct callee_t *callee = &m_callees[i];
+		if (callee->calls->size == 0)
+			continue;
+
+		koopa_raw_value_t first = callee->calls->data[0];
+		for (uint32_t j = callee->function->params.len; j-- > 0; )
+		{
+			int32_t constant;
+			if (!as_const(first->kind.data.call.args.buffer[j],
+				      &constant))
+				continue;
+
+			bool same = true;
+			for (uint32_t k = 1; same && k < callee->calls->size;
+			     ++k)
+			{
+				koopa_raw_value_t call = callee->calls->data[k];
+				int32_t other;
+
+				same = as_const(call->kind.data.call.args
+						.buffer[j], &other)
+				       && other == constant;
+			}
+			if (!same)
+				continue;
+
+			bind_param(callee->function, j, constant);
+			drop_param(callee->function, j, callee->calls);
+		}
+	}
+
+	free_calls();
+}
+
+void ipcp_clone(koopa_raw_program_t *program)
+{
+	collect_calls(program);
+
+	for (uint32_t i = 0; i < m_callee_count; ++i)
+	{
+		struct callee_t *callee = &m_callees[i];
+		if (strcmp(callee->function->name, "@main") == 0
+		    || count_insts(callee->function) > CLONE_INSTS_MAX)
+			continue;
+
+		/* group call sites by the constants they pass */
+		struct vector_ptr_t *patterns = vector_ptr_new(4);
+		struct vector_u32_t *weights = vector_u32_new(4);
+		struct vector_u32_t *groups =
+			vector_u32_fill(callee->calls->size, UINT32_MAX);
+		for (uint32_t j = 0; j < callee->calls->size; ++j)
+		{
+			koopa_raw_value_t call = callee->calls->data[j];
+			if (!has_const(call))
+				continue;
+
+			uint32_t k = 0;
+			while (k < patterns->size
+			       && !same_pattern(patterns->data[k], call))
+				++k;
+			if (k == patterns->size)
+			{
+				vector_ptr_push(patterns, (void *)call);
+				vector_u32_push(weights, 0);
+			}
+			weights->data[k] += callee->weights->data[j];
+			groups->data[j] = k;
+		}
+
+		for (uint32_t n = 0; n < CLONE_MAX; ++n)
+		{
+			/* hottest pattern left */
+			uint32_t best = UINT32_MAX;
+			for (uint32_t k = 0; k < patterns->size; ++k)
+				if (weights->data[k] >= CLONE_WEIGHT_MIN
+				    && (best == UINT32_MAX
+					|| weights->data[k]
+					   > weights->data[best]))
+					best = k;
+			if (best == UINT32_MAX)
+				break;
+			weights->data[best] = 0;
+
+			struct vector_ptr_t *calls = vector_ptr_new(4);
+			for (uint32_t j = 0; j < callee->calls->size; ++j)
+				if (groups->data[j] == best)
+					vector_ptr_push(calls,
+							callee->calls->data[j]);
+
+			uint32_t suffix = 0;
+			char *name;
+			do
+				name = suffixed(callee->function->name,
+						suffix++);
+			while (name_taken(program, name));
+
+			koopa_raw_function_data_t *clone =
+				clone_function(callee->function, name,
+					       suffix - 1);
+			slice_append(&program->funcs, clone);
+
+			specialize(clone, patterns->data[best], calls);
+			for (uint32_t j = 0; j < calls->size; ++j)
+			{
+				koopa_raw_value_data_t *call = calls->data[j];
+				call->kind.data.call.callee = clone;
+			}
+
+			vector_ptr_delete(calls);
+		}
+
+		vector_u32_delete(groups);
+		vector_u32_delete(weights);
+		vector_ptr_delete(patterns);
+	}
+
+	free_calls();
+}
@@ -0,0 +1,20 @@
+/**
+ * ipcp.h
+ * Interprocedural constant propagation.
+ */
+
+#ifndef _IPCP_H_
+#define _IPCP_H_
+
+#include "koopa.h"
+
+/* Replace parameters that receive the same constant at every call site with
+ * that constant, and drop them from the signature. */
+void ipcp(koopa_raw_program_t *program);
+
+/* Clone functions for the hottest patterns of constant arguments their call
+ * sites pass, up to a few clones per function, and specialize the clones as
+ * `ipcp()` does. */
+void ipcp_clone(koopa_raw_program_t *program);
+
+#endif//_IPCP_H_
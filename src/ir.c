@@ -5,68 +5,87 @@
 
 #include <assert.h>
 #include <setjmp.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "koopaext.h"
 #include "ir.h"
 #include "ast.h"
+#include "context.h"
 #include "macros.h"
-#include "globals.h"
+#include "pool.h"
+#include "semantic.h"
+#include "vector.h"
 
 /* state variables */
-static koopa_raw_program_t *m_curr_program;
-static koopa_raw_function_t m_curr_function;
-static koopa_raw_basic_block_t m_curr_basic_block;
-static koopa_raw_value_t m_curr_call;
+// scratch of the call in progress, see context.h
+static _Thread_local koopa_raw_function_t m_curr_function;
+static _Thread_local koopa_raw_basic_block_t m_curr_basic_block;
+static _Thread_local koopa_raw_value_t m_curr_call;
 
-static koopa_raw_basic_block_t m_curr_cond;
-static koopa_raw_basic_block_t m_curr_end;
+static _Thread_local koopa_raw_basic_block_t m_curr_cond;
+static _Thread_local koopa_raw_basic_block_t m_curr_end;
 
-static uint32_t m_mangle_idx;
-static bool m_returned;
+static _Thread_local uint32_t m_mangle_idx;
+// how deep scopes are nested, just as in the symbol table
+static _Thread_local int16_t m_level;
+static _Thread_local bool m_returned;
+
+static uint32_t m_jobs = 1;
 
 /* accessor decl.s */
-static koopa_raw_program_t CompUnit(const struct node_t *node);
-static koopa_raw_function_t FuncDef(const struct node_t *node);
-static koopa_raw_type_t Type(const struct node_t *node);
-static void Block(const struct node_t *node);
-
-static void Stmt(const struct node_t *node);
-static koopa_raw_value_t Number(const struct node_t *node);
-static koopa_raw_value_t Exp(const struct node_t *node);
-static koopa_raw_value_t UnaryExp(const struct node_t *node);
-static koopa_raw_value_t PrimaryExp(const struct node_t *node);
-
-static void Decl(const struct node_t *node);
+static koopa_raw_program_t CompUnit(struct context_t *ctx,
+				    const struct node_t *node);
+static koopa_raw_function_t FuncDef(struct context_t *ctx,
+				    const struct node_t *node);
+static koopa_raw_type_t Type(struct context_t *ctx, const struct node_t *node);
+static void Block(struct context_t *ctx, const struct node_t *node);
+
+static void Stmt(struct context_t *ctx, const struct node_t *node);
+static koopa_raw_value_t Number(struct context_t *ctx,
+				const struct node_t *node);
+static koopa_raw_value_t Exp(struct context_t *ctx, const struct node_t *node);
+static koopa_raw_value_t UnaryExp(struct context_t *ctx,
+				  const struct node_t *node);
+static koopa_raw_value_t PrimaryExp(struct context_t *ctx,
+				    const struct node_t *node);
+
+static void Decl(struct context_t *ctx, const struct node_t *node);
+/* evaluated during semantic analysis phase, unless fused */
+static void ConstDecl(struct context_t *ctx, const struct node_t *node);
+static void ConstDef(struct context_t *ctx, const struct node_t *node);
 #if 0
-/* already evaluated during semantic analysis phase */
-static koopa_raw_value_t ConstDecl(const struct node_t *node);
-static koopa_raw_value_t ConstDef(const struct node_t *node);
-static koopa_raw_value_t ConstInitVal(const struct node_t *node);
+static koopa_raw_value_t ConstInitVal(struct context_t *ctx,
+				      const struct node_t *node);
 #endif
-static void VarDecl(const struct node_t *node);
-static koopa_raw_value_t VarDef(const struct node_t *node);
-static koopa_raw_value_t InitVal(const struct node_t *node);
-static void BlockItem(const struct node_t *node);
-static koopa_raw_value_t LVal(const struct node_t *node);
+static void VarDecl(struct context_t *ctx, const struct node_t *node);
+static koopa_raw_value_t VarDef(struct context_t *ctx,
+				const struct node_t *node);
+static koopa_raw_value_t InitVal(struct context_t *ctx,
+				 const struct node_t *node);
+static void BlockItem(struct context_t *ctx, const struct node_t *node);
+static koopa_raw_value_t LVal(struct context_t *ctx, const struct node_t *node);
 #if 0
 /* already evaluated during semantic analysis phase */
-static koopa_raw_value_t ConstExp(const struct node_t *node);
-static koopa_raw_value_t ConstDefList(const struct node_t *node);
+static koopa_raw_value_t ConstExp(struct context_t *ctx,
+				  const struct node_t *node);
 #endif
-static void VarDefList(const struct node_t *node);
-static void BlockItemList(const struct node_t *node);
-
-static void FuncFParamList(const struct node_t *node);
-static koopa_raw_value_t FuncFParam(const struct node_t *node);
-static void FuncRParamList(const struct node_t *node);
-static koopa_raw_value_t FuncRParam(const struct node_t *node);
-static void GlobalList(const struct node_t *node);
-static void Global(const struct node_t *node);
+static void ConstDefList(struct context_t *ctx, const struct node_t *node);
+static void VarDefList(struct context_t *ctx, const struct node_t *node);
+static void BlockItemList(struct context_t *ctx, const struct node_t *node);
+
+static void FuncFParamList(struct context_t *ctx, const struct node_t *node);
+static koopa_raw_value_t FuncFParam(struct context_t *ctx,
+				    const struct node_t *node);
+static void FuncRParamList(struct context_t *ctx, const struct node_t *node);
+static koopa_raw_value_t FuncRParam(struct context_t *ctx,
+				    const struct node_t *node);
+static void GlobalList(struct context_t *ctx, const struct node_t *node);
+static void Global(struct context_t *ctx, const struct node_t *node);
 
 /* tool functions */
-static void init_lib(void)
+static void init_lib(struct context_t *ctx)
 {
 	koopa_raw_function_t getint =
 		koopa_raw_function(
@@ -124,23 +143,23 @@ static void init_lib(void)
 			"stoptime"
 		);
 
-	slice_append(&m_curr_program->funcs, getint);
-	slice_append(&m_curr_program->funcs, getch);
-	slice_append(&m_curr_program->funcs, getarray);
-	slice_append(&m_curr_program->funcs, putint);
-	slice_append(&m_curr_program->funcs, putch);
-	slice_append(&m_curr_program->funcs, putarray);
-	slice_append(&m_curr_program->funcs, starttime);
-	slice_append(&m_curr_program->funcs, stoptime);
-
-	symbols_get(g_symbols, "getint")->function.raw = getint;
-	symbols_get(g_symbols, "getch")->function.raw = getch;
-	symbols_get(g_symbols, "getarray")->function.raw = getarray;
-	symbols_get(g_symbols, "putint")->function.raw = putint;
-	symbols_get(g_symbols, "putch")->function.raw = putch;
-	symbols_get(g_symbols, "putarray")->function.raw = putarray;
-	symbols_get(g_symbols, "starttime")->function.raw = starttime;
-	symbols_get(g_symbols, "stoptime")->function.raw = stoptime;
+	slice_append(&ctx->program->funcs, getint);
+	slice_append(&ctx->program->funcs, getch);
+	slice_append(&ctx->program->funcs, getarray);
+	slice_append(&ctx->program->funcs, putint);
+	slice_append(&ctx->program->funcs, putch);
+	slice_append(&ctx->program->funcs, putarray);
+	slice_append(&ctx->program->funcs, starttime);
+	slice_append(&ctx->program->funcs, stoptime);
+
+	symbols_get(ctx->symbols, "getint")->function.raw = getint;
+	symbols_get(ctx->symbols, "getch")->function.raw = getch;
+	symbols_get(ctx->symbols, "getarray")->function.raw = getarray;
+	symbols_get(ctx->symbols, "putint")->function.raw = putint;
+	symbols_get(ctx->symbols, "putch")->function.raw = putch;
+	symbols_get(ctx->symbols, "putarray")->function.raw = putarray;
+	symbols_get(ctx->symbols, "starttime")->function.raw = starttime;
+	symbols_get(ctx->symbols, "stoptime")->function.raw = stoptime;
 
 #if 1
 	koopa_raw_function_t usleep =
@@ -151,26 +170,122 @@ static void init_lib(void)
 
 	slice_append(&usleep->ty->data.function.params, koopa_raw_type_int32());
 
-	slice_append(&m_curr_program->funcs, usleep);
+	slice_append(&ctx->program->funcs, usleep);
 
-	symbols_get(g_symbols, "usleep")->function.raw = usleep;
+	symbols_get(ctx->symbols, "usleep")->function.raw = usleep;
 #endif
 }
 
+/* IR of the unit of the caller is built into its arena */
+static void enter(struct context_t *ctx)
+{
+	koopa_raw_program_set_allocator(ctx->bump);
+}
+
+static void begin(struct context_t *ctx, koopa_raw_program_t *program)
+{
+	*program = (koopa_raw_program_t) {
+		.values = slice_new(0, KOOPA_RSIK_VALUE),
+		.funcs = slice_new(0, KOOPA_RSIK_FUNCTION),
+	};
+	ctx->program = program;
+	/* a unit that failed halfway may have left these behind */
+	m_curr_cond = NULL;
+	m_curr_end = NULL;
+	m_level = 0;
+	m_returned = false;
+
+	init_lib(ctx);
+}
+
+/* when fused, scopes are built in the symbol table along the way. otherwise
+ * names have been resolved during semantic analysis, and all that's left is
+ * the nesting
+ * @return level of the enclosing scope, to be closed back to. */
+static int16_t scope_open(struct context_t *ctx)
+{
+	if (ctx->fused)
+		symbols_indent(ctx->symbols);
+
+	return m_level++;
+}
+
+/* close the scope opened at `level`, along with those of declarations in
+ * it */
+static void scope_close(struct context_t *ctx, int16_t level)
+{
+	if (ctx->fused)
+		symbols_dedent(ctx->symbols);
+
+	m_level = level;
+}
+
 static char *mangle(char *ident)
 {
 	if (!ident)
 		return NULL;
 
-#define MANGLED_MAX (IDENT_MAX + 1 + IDENT_MAX + (1 + 6) * 2 + (1 + 10))
+	/* numbered within the function, so that names in a function don't
+	 * change with the ones before it */
+#define MANGLED_MAX (IDENT_MAX + 1 + IDENT_MAX + (1 + 6) + (1 + 10))
 	char name[MANGLED_MAX];
-	snprintf(name, MANGLED_MAX, "%s_%s_%hd_%hd_%u",
-		 m_curr_function->name + 1, ident, symbols_level(g_symbols),
-		 symbols_scope(g_symbols), m_mangle_idx++);
+	snprintf(name, MANGLED_MAX, "%s_%s_%hd_%u",
+		 m_curr_function->name + 1, ident, m_level, m_mangle_idx++);
 	name[MANGLED_MAX - 1] = '\0';
 #undef MANGLED_MAX
 
-	return bump_strdup(g_bump, name);
+	return bump_strdup(koopa_raw_program_allocator(), name);
+}
+
+/* constant subtrees become a single integer */
+static koopa_raw_value_t fold(struct context_t *ctx, const struct node_t *node)
+{
+	int32_t value;
+	if (!semantic_fold(ctx, node, &value))
+		return NULL;
+
+	return koopa_raw_integer(value);
+}
+
+/* an instruction that's thrown away uses nothing */
+static void drop(koopa_raw_value_t inst)
+{
+	const koopa_raw_value_kind_t *kind = &inst->kind;
+
+	switch (kind->tag)
+	{
+	case KOOPA_RVT_LOAD:
+		slice_remove(&kind->data.load.src->used_by, inst);
+		break;
+	case KOOPA_RVT_STORE:
+		slice_remove(&kind->data.store.value->used_by, inst);
+		slice_remove(&kind->data.store.dest->used_by, inst);
+		break;
+	case KOOPA_RVT_BINARY:
+		slice_remove(&kind->data.binary.lhs->used_by, inst);
+		slice_remove(&kind->data.binary.rhs->used_by, inst);
+		break;
+	case KOOPA_RVT_BRANCH:
+		slice_remove(&kind->data.branch.cond->used_by, inst);
+		slice_remove(&kind->data.branch.true_bb->used_by, inst);
+		slice_remove(&kind->data.branch.false_bb->used_by, inst);
+		break;
+	case KOOPA_RVT_JUMP:
+		slice_remove(&kind->data.jump.target->used_by, inst);
+		break;
+	case KOOPA_RVT_CALL:
+		for (uint32_t i = 0; i < kind->data.call.args.len; ++i)
+			slice_remove(&((koopa_raw_value_t)
+				       kind->data.call.args.buffer[i])->used_by,
+				     inst);
+		break;
+	case KOOPA_RVT_RETURN:
+		if (kind->data.ret.value)
+			slice_remove(&kind->data.ret.value->used_by, inst);
+		break;
+	default:
+		break;
+	}
 }
 
 static void try_append(koopa_raw_slice_t *slice, koopa_raw_value_t inst)
@@ -185,14 +300,178 @@ static void try_append(koopa_raw_slice_t *slice, koopa_raw_value_t inst)
 	    && (last->kind.tag == KOOPA_RVT_RETURN
 		|| last->kind.tag == KOOPA_RVT_BRANCH
 		|| last->kind.tag == KOOPA_RVT_JUMP))
+	{
+		drop(inst);
 		return;
+	}
 #endif
 
 	slice_append(slice, inst);
 }
 
+/* the signature is complete before the body, which may be freed on its own,
+ * or built on another thread */
+static koopa_raw_function_t signature(struct context_t *ctx,
+				      const struct node_t *node)
+{
+	char *name = node->children[1]->data.value.s;
+
+	koopa_raw_type_t ty = Type(ctx, node->children[0]);
+	if (node->size == 4)
+		for (int i = 0; i < node->children[2]->size; ++i)
+			slice_append(&ty->data.function.params,
+				     koopa_raw_type_int32());
+	koopa_raw_function_t ret = koopa_raw_function(ty, name);
+
+	struct symbol_t *symbol;
+	if (ctx->fused)
+		symbol = semantic_define(ctx, node, name,
+			symbol_function(NULL,
+				ty->data.function.ret->tag == KOOPA_RTT_UNIT
+				? VOID : INT));
+	else
+		symbol = node->data.symbol;
+	assert(symbol);
+	symbol->function.raw = ret;
+
+	return ret;
+}
+
+static void body(struct context_t *ctx, const struct node_t *node,
+		 koopa_raw_function_t function)
+{
+	m_curr_function = function;
+	m_mangle_idx = 0;
+	m_level = 0;
+
+	/* initial basic block */
+	koopa_raw_basic_block_t bb = koopa_raw_basic_block(mangle("entry"));
+	m_curr_basic_block = bb;
+	slice_append(&function->bbs, bb);
+
+	int16_t level = scope_open(ctx);
+	if (node->size == 4)
+	{
+		/* has parameters */
+		FuncFParamList(ctx, node->children[2]);
+		Block(ctx, node->children[3]);
+	}
+	else
+		Block(ctx, node->children[2]);
+	scope_close(ctx, level);
+
+	// prepend a return statement in function returning void
+	koopa_raw_value_t last = slice_back(&m_curr_basic_block->insts);
+	if (function->ty->data.function.ret->tag == KOOPA_RTT_UNIT
+	    && (!last || last->kind.tag != KOOPA_RVT_RETURN))
+		slice_append(&m_curr_basic_block->insts,
+			     koopa_raw_return(NULL));
+}
+
+/* bodies are built biggest first, so that the last ones to be stolen are
+ * small */
+static uint32_t weight(const struct node_t *node)
+{
+	uint32_t ret = 1;
+	for (int i = 0; i < node->size; ++i)
+		ret += weight(node->children[i]);
+
+	return ret;
+}
+
+static int heavier(const void *lhs, const void *rhs)
+{
+	const struct pair_ptru32_t *l = lhs, *r = rhs;
+
+	return (l->u32 < r->u32) - (l->u32 > r->u32);
+}
+
+struct bodies_t {
+	struct context_t *ctx;
+	struct pair_ptru32_t *defs;
+};
+
+static void build_body(void *arg, uint32_t i)
+{
+	struct bodies_t *bodies = arg;
+	struct context_t *ctx = bodies->ctx;
+	const struct node_t *node = bodies->defs[i].ptr;
+	uint32_t w = pool_worker();
+
+	/* the calling thread allocates from the arena of the unit, the others
+	 * from ones of their own. uses of global variables are left to
+	 * `link_globals()` */
+	if (w > 0 && !ctx->arenas[w])
+		ctx->arenas[w] = bump_new(256 MiB);
+	koopa_raw_program_set_allocator(w > 0 ? ctx->arenas[w] : ctx->bump);
+	koopa_raw_program_set_shared(true);
+
+	body(ctx, node, node->data.symbol->function.raw);
+
+	koopa_raw_program_set_shared(false);
+}
+
+/* loads and stores of global variables go into their `used_by`, in the order
+ * they'd be in had the bodies been built one after another */
+static void link_globals(const koopa_raw_program_t *program)
+{
+	for (uint32_t i = 0; i < program->funcs.len; ++i)
+	{
+		koopa_raw_function_t function = program->funcs.buffer[i];
+		for (uint32_t j = 0; j < function->bbs.len; ++j)
+		{
+			koopa_raw_basic_block_t bb = function->bbs.buffer[j];
+			for (uint32_t k = 0; k < bb->insts.len; ++k)
+			{
+				koopa_raw_value_t inst = bb->insts.buffer[k];
+				koopa_raw_value_t global = NULL;
+
+				if (inst->kind.tag == KOOPA_RVT_LOAD)
+					global = inst->kind.data.load.src;
+				else if (inst->kind.tag == KOOPA_RVT_STORE)
+					global = inst->kind.data.store.dest;
+				if (global && global->kind.tag
+					      == KOOPA_RVT_GLOBAL_ALLOC)
+					slice_append(&global->used_by, inst);
+			}
+		}
+	}
+}
+
+/* a name refers to either what's declared within the function, which the
+ * tokens tell, or a global, of which only the signature matters */
+static void hash_node(struct hash_t *hash, const struct node_t *node)
+{
+	hash_u32(hash, node->data.kind);
+	hash_u32(hash, node->size);
+	if (node->data.kind == AST_INT_CONST)
+		hash_u32(hash, node->data.value.i);
+	else if (node->data.terminal)
+		hash_str(hash, node->data.value.s);
+
+	const struct symbol_t *symbol = node->data.symbol;
+	if (symbol && symbol->meta.level == 0)
+	{
+		hash_u32(hash, symbol->tag);
+		if (symbol->tag == CONSTANT)
+			hash_u32(hash, symbol->constant.value);
+		if (symbol->tag == FUNCTION)
+		{
+			const struct vector_typ_t *params =
+				symbol->function.params;
+			hash_u32(hash, symbol->function.type);
+			hash_u32(hash, params ? params->size : 0);
+			for (size_t i = 0; params && i < params->size; ++i)
+				hash_u32(hash, params->data[i]);
+		}
+	}
+
+	for (int i = 0; i < node->size; ++i)
+		hash_node(hash, node->children[i]);
+}
+
 /* accessor defn.s */
-static koopa_raw_type_t Type(const struct node_t *node)
+static koopa_raw_type_t Type(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Type);
 
@@ -209,28 +488,29 @@ static koopa_raw_type_t Type(const struct node_t *node)
 	return ret;
 }
 
-static void Block(const struct node_t *node)
+static void Block(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Block);
 
-	symbols_enter(g_symbols);
-	BlockItemList(node->children[0]);
-	symbols_dedent(g_symbols);
+	int16_t level = scope_open(ctx);
+	BlockItemList(ctx, node->children[0]);
+	scope_close(ctx, level);
 }
 
-static koopa_raw_value_t PrimaryExp(const struct node_t *node)
+static koopa_raw_value_t PrimaryExp(struct context_t *ctx,
+				    const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_PrimaryExp);
 
 	switch (node->children[0]->data.kind)
 	{
 	case AST_Number:
-		return Number(node->children[0]);
+		return Number(ctx, node->children[0]);
 	case AST_Exp:
-		return Exp(node->children[0]);
+		return Exp(ctx, node->children[0]);
 	case AST_LVal:
 	{
-		koopa_raw_value_t lval = LVal(node->children[0]);
+		koopa_raw_value_t lval = LVal(ctx, node->children[0]);
 		/* if lval is a constant */
 		if (lval->ty->tag == KOOPA_RTT_INT32)
 			return lval;
@@ -246,18 +526,25 @@ static koopa_raw_value_t PrimaryExp(const struct node_t *node)
 	}
 }
 
-static koopa_raw_value_t UnaryExp(const struct node_t *node)
+static koopa_raw_value_t UnaryExp(struct context_t *ctx,
+				  const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_UnaryExp);
 
+	koopa_raw_value_t ret = fold(ctx, node);
+	if (ret)
+		return ret;
+
 	switch (node->children[0]->data.kind)
 	{
 	case AST_PrimaryExp:
-		return PrimaryExp(node->children[0]);
+		return PrimaryExp(ctx, node->children[0]);
 	case AST_IDENT:
 	{
 		char *ident = node->children[0]->data.value.s;
-		struct symbol_t *symbol = symbols_get(g_symbols, ident);
+		struct symbol_t *symbol = ctx->fused
+			? semantic_function(ctx, node, ident)
+			: node->data.symbol;
 		assert(symbol && symbol->tag == FUNCTION);
 
 		koopa_raw_value_t this_call = m_curr_call;
@@ -266,7 +553,7 @@ static koopa_raw_value_t UnaryExp(const struct node_t *node)
 		m_curr_call = call;
 		/* function call: IDENT (LP) [FuncRParams] (RP) */
 		if (node->size == 2)
-			FuncRParamList(node->children[1]);
+			FuncRParamList(ctx, node->children[1]);
 		// "pop"
 		m_curr_call = this_call;
 		try_append(&m_curr_basic_block->insts, call);
@@ -281,11 +568,10 @@ static koopa_raw_value_t UnaryExp(const struct node_t *node)
 
 	/* unary plus; basically does nothing, propagate */
 	if (op_token == '+')
-		return UnaryExp(node->children[1]);
+		return UnaryExp(ctx, node->children[1]);
 
 	koopa_raw_value_t lhs = koopa_raw_integer(0);
-	koopa_raw_value_t rhs = UnaryExp(node->children[1]);
-	koopa_raw_value_t ret;
+	koopa_raw_value_t rhs = UnaryExp(ctx, node->children[1]);
 	switch (op_token)
 	{
 	case '-':
@@ -303,15 +589,18 @@ static koopa_raw_value_t UnaryExp(const struct node_t *node)
 	return ret;
 }
 
-static koopa_raw_value_t Exp(const struct node_t *node)
+static koopa_raw_value_t Exp(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Exp);
 
+	koopa_raw_value_t ret = fold(ctx, node);
+	if (ret)
+		return ret;
+
 	/* unary expression, propagate */
 	if (node->size == 1)
-		return UnaryExp(node->children[0]);
+		return UnaryExp(ctx, node->children[0]);
 
-	koopa_raw_value_t ret;
 	/* naughty logical operators */
 	if (node->children[1]->data.kind == AST_LOR)
 	{
@@ -334,7 +623,8 @@ static koopa_raw_value_t Exp(const struct node_t *node)
 
 		/* if (!lhs) */
 		koopa_raw_value_t lfalse =
-			koopa_raw_binary(KOOPA_RBO_EQ, Exp(node->children[0]),
+			koopa_raw_binary(KOOPA_RBO_EQ,
+					 Exp(ctx, node->children[0]),
 					 koopa_raw_integer(0));
 		koopa_raw_value_t branch = koopa_raw_branch(lfalse, false_bb,
 							    end_bb);
@@ -346,7 +636,7 @@ static koopa_raw_value_t Exp(const struct node_t *node)
 		/* result = rhs; */
 		koopa_raw_value_t rtrue =
 			koopa_raw_binary(KOOPA_RBO_NOT_EQ,
-					 Exp(node->children[2]),
+					 Exp(ctx, node->children[2]),
 					 koopa_raw_integer(0));
 		koopa_raw_value_t store = koopa_raw_store(rtrue, result);
 		koopa_raw_value_t jump = koopa_raw_jump(end_bb);
@@ -381,7 +671,7 @@ static koopa_raw_value_t Exp(const struct node_t *node)
 		/* if (lhs) */
 		koopa_raw_value_t ltrue =
 			koopa_raw_binary(KOOPA_RBO_NOT_EQ,
-					 Exp(node->children[0]),
+					 Exp(ctx, node->children[0]),
 					 koopa_raw_integer(0));
 		koopa_raw_value_t branch = koopa_raw_branch(ltrue, true_bb,
 							    end_bb);
@@ -393,7 +683,7 @@ static koopa_raw_value_t Exp(const struct node_t *node)
 		/* result = rhs; */
 		koopa_raw_value_t rtrue =
 			koopa_raw_binary(KOOPA_RBO_NOT_EQ,
-					 Exp(node->children[2]),
+					 Exp(ctx, node->children[2]),
 					 koopa_raw_integer(0));
 		koopa_raw_value_t store = koopa_raw_store(rtrue, result);
 		koopa_raw_value_t jump = koopa_raw_jump(end_bb);
@@ -410,8 +700,8 @@ static koopa_raw_value_t Exp(const struct node_t *node)
 
 	/* otherwise, binary expression */
 	char *op_token = node->children[1]->data.value.s;
-	koopa_raw_value_t lhs = Exp(node->children[0]);
-	koopa_raw_value_t rhs = Exp(node->children[2]);
+	koopa_raw_value_t lhs = Exp(ctx, node->children[0]);
+	koopa_raw_value_t rhs = Exp(ctx, node->children[2]);
 
 	switch (node->children[1]->data.kind)
 	{
@@ -442,6 +732,7 @@ static koopa_raw_value_t Exp(const struct node_t *node)
 			ret = koopa_raw_binary(KOOPA_RBO_SHL, lhs, rhs);
 		else
 			panic("unsupported SHOP");
+		break;
 	case AST_ADDOP:
 		if (strcmp(op_token, "+") == 0)
 			ret = koopa_raw_binary(KOOPA_RBO_ADD, lhs, rhs);
@@ -470,14 +761,15 @@ complete:
 	return ret;
 }
 
-static koopa_raw_value_t Number(const struct node_t *node)
+static koopa_raw_value_t Number(struct context_t *ctx,
+				const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Number);
 
 	return koopa_raw_integer(node->children[0]->data.value.i);
 }
 
-static void Stmt(const struct node_t *node)
+static void Stmt(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Stmt);
 
@@ -490,21 +782,25 @@ static void Stmt(const struct node_t *node)
 		/* empty Stmt, do nothing */
 		break;
 	case AST_LVal:
-		inst = koopa_raw_store(Exp(node->children[1]),
-				       LVal(node->children[0]));
+		if (ctx->fused)
+			semantic_variable(ctx, node->children[0],
+					  node->children[0]->children[0]
+						  ->data.value.s);
+		inst = koopa_raw_store(Exp(ctx, node->children[1]),
+				       LVal(ctx, node->children[0]));
 
 		try_append(&m_curr_basic_block->insts, inst);
 		break;
 	case AST_Exp:
-		Exp(node->children[0]);
+		Exp(ctx, node->children[0]);
 		break;
 	case AST_Block:
-		Block(node->children[0]);
+		Block(ctx, node->children[0]);
 		break;
 	case AST_RETURN:
 		/* if has `Exp` */
 		if (node->size == 2)
-			inst = koopa_raw_return(Exp(node->children[1]));
+			inst = koopa_raw_return(Exp(ctx, node->children[1]));
 		else
 			inst = koopa_raw_return(NULL);
 
@@ -514,7 +810,7 @@ static void Stmt(const struct node_t *node)
 		break;
 	case AST_IF:
 	{
-		koopa_raw_value_t cond = Exp(node->children[1]);
+		koopa_raw_value_t cond = Exp(ctx, node->children[1]);
 
 		koopa_raw_basic_block_t true_bb =
 			koopa_raw_basic_block(mangle("if_then"));
@@ -529,7 +825,7 @@ static void Stmt(const struct node_t *node)
 		slice_append(&m_curr_function->bbs, true_bb);
 		m_curr_basic_block = true_bb;
 		// `then` branch always evaluated
-		Stmt(node->children[2]);
+		Stmt(ctx, node->children[2]);
 		// FIXME find a more elegant solution to indicate returns inside
 		// if branches with a single statement (i.e. no blocks)
 		m_returned = false;
@@ -541,7 +837,7 @@ static void Stmt(const struct node_t *node)
 		/* if has `else` branch */
 		if (node->size == 4)
 		{
-			Stmt(node->children[3]);
+			Stmt(ctx, node->children[3]);
 			m_returned = false;
 			try_append(&m_curr_basic_block->insts,
 				   koopa_raw_jump(end_bb));
@@ -566,7 +862,7 @@ static void Stmt(const struct node_t *node)
 
 		slice_append(&m_curr_function->bbs, cond_bb);
 		m_curr_basic_block = cond_bb;
-		koopa_raw_value_t cond = Exp(node->children[1]);
+		koopa_raw_value_t cond = Exp(ctx, node->children[1]);
 		inst = koopa_raw_branch(cond, body_bb, end_bb);
 		try_append(&m_curr_basic_block->insts, inst);
 
@@ -575,7 +871,7 @@ static void Stmt(const struct node_t *node)
 		/* "push" */
 		m_curr_cond = cond_bb;
 		m_curr_end = end_bb;
-		Stmt(node->children[2]);
+		Stmt(ctx, node->children[2]);
 		// FIXME find a more elegant solution
 		m_returned = false;
 		/* "pop" */
@@ -590,6 +886,8 @@ static void Stmt(const struct node_t *node)
 	}
 	case AST_BREAK:
 	{
+		if (ctx->fused)
+			semantic_jump(ctx, node, m_curr_end != NULL);
 		koopa_raw_basic_block_t break_bb =
 			koopa_raw_basic_block(mangle("while_break"));
 		slice_append(&m_curr_function->bbs, break_bb);
@@ -601,6 +899,8 @@ static void Stmt(const struct node_t *node)
 	}
 	case AST_CONTINUE:
 	{
+		if (ctx->fused)
+			semantic_jump(ctx, node, m_curr_cond != NULL);
 		koopa_raw_basic_block_t continue_bb =
 			koopa_raw_basic_block(mangle("while_continue"));
 		slice_append(&m_curr_function->bbs, continue_bb);
@@ -615,125 +915,120 @@ static void Stmt(const struct node_t *node)
 	}
 }
 
-static void GlobalList(const struct node_t *node)
+static void GlobalList(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_GlobalList);
 
-	for (int i = node->size - 1; i >= 0; --i)
-		Global(node->children[i]);
+	for (int i = 0; i < node->size; ++i)
+		Global(ctx, node->children[i]);
 }
 
-static koopa_raw_function_t FuncDef(const struct node_t *node)
+static koopa_raw_function_t FuncDef(struct context_t *ctx,
+				    const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_FuncDef);
 
-	char *name = node->children[1]->data.value.s;
-
-	koopa_raw_type_t ty = Type(node->children[0]);
-	koopa_raw_function_t ret = koopa_raw_function(ty, name);
-	m_curr_function = ret;
-
-	struct symbol_t *symbol = symbols_get(g_symbols, name);
-	assert(symbol);
-	symbol->function.raw = ret;
-
-	/* initial basic block */
-	koopa_raw_basic_block_t bb = koopa_raw_basic_block(mangle("entry"));
-	m_curr_basic_block = bb;
-	slice_append(&ret->bbs, bb);
-
-	symbols_enter(g_symbols);
-	if (node->size == 4)
-	{
-		/* has parameters */
-		FuncFParamList(node->children[2]);
-		Block(node->children[3]);
-	}
-	else
-		Block(node->children[2]);
-	symbols_dedent(g_symbols);
-
-	// prepend a return statement in function returning void
-	koopa_raw_value_t last = slice_back(&m_curr_basic_block->insts);
-	if (ty->data.function.ret->tag == KOOPA_RTT_UNIT
-	    && (!last || last->kind.tag != KOOPA_RVT_RETURN))
-		slice_append(&m_curr_basic_block->insts,
-			     koopa_raw_return(NULL));
+	koopa_raw_function_t ret = signature(ctx, node);
+	if (ctx->body)
+		koopa_raw_program_set_allocator(ctx->body);
+	body(ctx, node, ret);
+	koopa_raw_program_set_allocator(ctx->bump);
 
 	return ret;
 }
 
-static koopa_raw_program_t CompUnit(const struct node_t *node)
+static koopa_raw_program_t CompUnit(struct context_t *ctx,
+				    const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_CompUnit);
 
-	koopa_raw_program_t ret = {
-		.values = slice_new(0, KOOPA_RSIK_VALUE),
-		.funcs = slice_new(0, KOOPA_RSIK_FUNCTION),
-	};
+	koopa_raw_program_t ret;
 	// XXX very dangerous, but we're in fact not unwinding the stack until
 	// traversal of the whole program has been completed, so it shouldn't be
 	// a problem for now
-	m_curr_program = &ret;
-
-	init_lib();
+	begin(ctx, &ret);
 
-	GlobalList(node->children[0]);
+	GlobalList(ctx, node->children[0]);
+	ctx->program = NULL;
 
 	return ret;
 }
 
-static void Global(const struct node_t *node)
+static void Global(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Global);
 
+	/* bodies are left for later, unless fused */
 	if (node->children[0]->data.kind == AST_FuncDef)
-		slice_append(&m_curr_program->funcs,
-			     FuncDef(node->children[0]));
+		slice_append(&ctx->program->funcs, ctx->fused
+			     ? FuncDef(ctx, node->children[0])
+			     : signature(ctx, node->children[0]));
 	else if (node->children[0]->data.kind == AST_Decl)
-		Decl(node->children[0]);
+		Decl(ctx, node->children[0]);
 }
 
-static void Decl(const struct node_t *node)
+static void Decl(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Decl);
 
-	if (symbols_level(g_symbols) > 0)
-		symbols_enter(g_symbols);
+	if (m_level > 0)
+		scope_open(ctx);
 
+	if (node->children[0]->data.kind == AST_ConstDecl && ctx->fused)
+		ConstDecl(ctx, node->children[0]);
 	if (node->children[0]->data.kind == AST_VarDecl)
-		VarDecl(node->children[0]);
+		VarDecl(ctx, node->children[0]);
+}
+
+static void ConstDecl(struct context_t *ctx, const struct node_t *node)
+{
+	assert(node && node->data.kind == AST_ConstDecl);
+
+	ConstDefList(ctx, node->children[1]);
+}
+
+static void ConstDef(struct context_t *ctx, const struct node_t *node)
+{
+	assert(node && node->data.kind == AST_ConstDef);
+
+	char *ident = node->children[0]->data.value.s;
+	/* ConstInitVal: ConstExp */
+	int32_t value = semantic_const(ctx, node->children[1]->children[0]);
+	semantic_define(ctx, node, ident, symbol_constant(value));
 }
 
-static void VarDecl(const struct node_t *node)
+static void VarDecl(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_VarDecl);
 
-	VarDefList(node->children[1]);
+	VarDefList(ctx, node->children[1]);
 }
 
-static koopa_raw_value_t VarDef(const struct node_t *node)
+static koopa_raw_value_t VarDef(struct context_t *ctx,
+				const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_VarDef);
 
 	char *ident = node->children[0]->data.value.s;
 	struct symbol_t *symbol;
-	struct view_t view = symbols_lookup(g_symbols, ident);
-	while ((symbol = view.next(&view)))
-		if (symbols_here(g_symbols, symbol))
-			break;
+	if (ctx->fused)
+		symbol = semantic_define(ctx, node, ident, symbol_variable());
+	else
+		symbol = node->data.symbol;
 	assert(symbol);
 
 	koopa_raw_value_t ret;
 	if (symbol->meta.level == 0)
 	{
+		/* InitVal: Exp, which is constant here */
 		ret = symbol->variable.raw = koopa_raw_global_alloc(
 			koopa_raw_name_global(ident),
 			(node->size == 2)
-				? InitVal(node->children[1])
+				? koopa_raw_integer(semantic_const(ctx,
+					node->children[1]->children[0]))
 				: koopa_raw_zero_init(koopa_raw_type_int32())
 		);
-		slice_append(&m_curr_program->values, ret);
+		slice_append(&ctx->program->values, ret);
 
 		return ret;
 	}
@@ -749,43 +1044,50 @@ static koopa_raw_value_t VarDef(const struct node_t *node)
 	{
 		/* mind the evaluation order */
 		koopa_raw_value_t store =
-			koopa_raw_store(InitVal(node->children[1]), ret);
+			koopa_raw_store(InitVal(ctx, node->children[1]), ret);
 		try_append(&m_curr_basic_block->insts, store);
 	}
 
 	return ret;
 }
 
-static koopa_raw_value_t InitVal(const struct node_t *node)
+static koopa_raw_value_t InitVal(struct context_t *ctx,
+				 const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_InitVal);
 
-	return Exp(node->children[0]);
+	return Exp(ctx, node->children[0]);
 }
 
-static void BlockItem(const struct node_t *node)
+static void BlockItem(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_BlockItem);
 
 	if (node->children[0]->data.kind == AST_Decl)
-		Decl(node->children[0]);
+		Decl(ctx, node->children[0]);
 	if (node->children[0]->data.kind == AST_Stmt)
-		Stmt(node->children[0]);
+		Stmt(ctx, node->children[0]);
 }
 
-static koopa_raw_value_t LVal(const struct node_t *node)
+static koopa_raw_value_t LVal(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_LVal);
 
 	char *ident = node->children[0]->data.value.s;
-	struct symbol_t *symbol = symbols_get(g_symbols, ident);
+	struct symbol_t *symbol = ctx->fused
+		? semantic_value(ctx, node, ident)
+		: node->data.symbol;
 	assert(symbol);
 
 	koopa_raw_value_t ret;
 	switch (symbol->tag)
 	{
 	case CONSTANT:
-		if (!(ret = symbol->constant.raw))
+		/* a global one would outlive the body it's allocated in, or
+		 * be used by bodies built side by side */
+		if (symbol->meta.level == 0)
+			ret = koopa_raw_integer(symbol->constant.value);
+		else if (!(ret = symbol->constant.raw))
 			ret = symbol->constant.raw =
 				koopa_raw_integer(symbol->constant.value);
 		break;
@@ -799,62 +1101,75 @@ static koopa_raw_value_t LVal(const struct node_t *node)
 	return ret;
 }
 
-static void VarDefList(const struct node_t *node)
+static void ConstDefList(struct context_t *ctx, const struct node_t *node)
+{
+	assert(node && node->data.kind == AST_ConstDefList);
+
+	for (int i = 0; i < node->size; ++i)
+		ConstDef(ctx, node->children[i]);
+}
+
+static void VarDefList(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_VarDefList);
 
-	for (int i = node->size - 1; i >= 0; --i)
-		VarDef(node->children[i]);
+	for (int i = 0; i < node->size; ++i)
+		VarDef(ctx, node->children[i]);
 }
 
-static void BlockItemList(const struct node_t *node)
+static void BlockItemList(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_BlockItemList);
 
-	for (int i = node->size - 1; i >= 0 && !m_returned; --i)
-		BlockItem(node->children[i]);
+	for (int i = 0; i < node->size && !m_returned; ++i)
+		BlockItem(ctx, node->children[i]);
 
 	m_returned = false;
 }
 
-static void FuncRParamList(const struct node_t *node)
+static void FuncRParamList(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_FuncRParamList);
 
-	for (int i = node->size - 1; i >= 0; --i)
-		slice_append(&m_curr_call->kind.data.call.args,
-			     FuncRParam(node->children[i]));
+	for (int i = 0; i < node->size; ++i)
+	{
+		koopa_raw_value_t arg = FuncRParam(ctx, node->children[i]);
+		slice_append(&m_curr_call->kind.data.call.args, arg);
+		slice_append(&arg->used_by, m_curr_call);
+	}
 }
 
-static koopa_raw_value_t FuncRParam(const struct node_t *node)
+static koopa_raw_value_t FuncRParam(struct context_t *ctx,
+				    const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_FuncRParam);
 
-	return Exp(node->children[0]);
+	return Exp(ctx, node->children[0]);
 }
 
-static void FuncFParamList(const struct node_t *node)
+static void FuncFParamList(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_FuncFParamList);
 
-	for (int i = node->size - 1; i >= 0; --i)
+	for (int i = 0; i < node->size; ++i)
 		slice_append(&m_curr_function->params,
-			     FuncFParam(node->children[i]));
+			     FuncFParam(ctx, node->children[i]));
 }
 
-static koopa_raw_value_t FuncFParam(const struct node_t *node)
+static koopa_raw_value_t FuncFParam(struct context_t *ctx,
+				    const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_FuncFParam);
 
 	char *ident = node->children[1]->data.value.s;
-	struct symbol_t *symbol = symbols_get(g_symbols, ident);
+	struct symbol_t *symbol = ctx->fused
+		? symbols_add(ctx->symbols, ident, symbol_variable())
+		: node->data.symbol;
 	assert(symbol);
 
 	char *name = koopa_raw_name_global(ident);
 	koopa_raw_value_t ret =
 		koopa_raw_func_arg_ref(name, m_curr_function->params.len);
-	slice_append(&m_curr_function->ty->data.function.params,
-		     koopa_raw_type_int32());
 
 	/* make an alloc for parameter */
 	koopa_raw_value_t alloc = symbol->variable.raw =
@@ -867,10 +1182,118 @@ static koopa_raw_value_t FuncFParam(const struct node_t *node)
 }
 
 /* public defn.s */
-koopa_raw_program_t ir(const struct node_t *program)
+koopa_raw_program_t ir(struct context_t *ctx)
+{
+	enter(ctx);
+	ctx->fused = false;
+
+	/* globals and signatures first. bodies only read what's global by
+	 * then, and names in them are resolved already, so they're built side
+	 * by side */
+	koopa_raw_program_t ret = CompUnit(ctx, ctx->comp_unit);
+
+	const struct node_t *globals = ctx->comp_unit->children[0];
+	struct pair_ptru32_t *defs =
+		malloc(sizeof(struct pair_ptru32_t) * (globals->size + 1));
+	uint32_t len = 0, k = 0;
+	for (int i = 0; i < globals->size; ++i)
+	{
+		const struct node_t *node = globals->children[i]->children[0];
+		if (node->data.kind != AST_FuncDef)
+			continue;
+
+		/* those found in the cache are only declared */
+		struct cache_function_t *cached =
+			k < ctx->cached_len ? &ctx->cached[k++] : NULL;
+		if (cached)
+			cached->raw = node->data.symbol->function.raw;
+		if (!cached || !cached->text)
+			defs[len++] = make_pair((void *)node, weight(node));
+	}
+	qsort(defs, len, sizeof(struct pair_ptru32_t), heavier);
+
+	ctx->arenas_len = m_jobs < len ? m_jobs : len;
+	ctx->arenas = calloc(ctx->arenas_len + 1, sizeof(bump_t));
+	pool_run(len, ctx->arenas_len, build_body,
+		 &(struct bodies_t) { ctx, defs });
+	free(defs);
+
+	enter(ctx);
+	link_globals(&ret);
+
+	symbols_delete(ctx->symbols);
+	ctx->symbols = NULL;
+
+	return ret;
+}
+
+koopa_raw_program_t ir_fused(struct context_t *ctx)
 {
-	koopa_raw_program_t ret = CompUnit(program);
-	symbols_delete(g_symbols);
+	enter(ctx);
+	ctx->fused = true;
+	semantic_begin(ctx);
+
+	koopa_raw_program_t ret = CompUnit(ctx, ctx->comp_unit);
+	symbols_delete(ctx->symbols);
+	ctx->symbols = NULL;
 
 	return ret;
 }
+
+void ir_key(const struct node_t *func_def, struct hash_t *key)
+{
+	assert(func_def && func_def->data.kind == AST_FuncDef);
+
+	hash_node(key, func_def);
+}
+
+void ir_set_jobs(uint32_t jobs)
+{
+	m_jobs = jobs > 0 ? jobs : 1;
+}
+
+void ir_stream_begin(struct context_t *ctx, koopa_raw_program_t *program)
+{
+	enter(ctx);
+	ctx->fused = true;
+	semantic_begin(ctx);
+
+	begin(ctx, program);
+}
+
+koopa_raw_function_t ir_stream_global(struct context_t *ctx,
+				      const struct node_t *global)
+{
+	assert(global && global->data.kind == AST_Global);
+	enter(ctx);
+
+	if (global->children[0]->data.kind == AST_FuncDef)
+		return FuncDef(ctx, global->children[0]);
+
+	Decl(ctx, global->children[0]);
+	return NULL;
+}
+
+void ir_stream_drop(struct context_t *ctx, koopa_raw_function_t function)
+{
+	koopa_raw_function_data_t *data = (koopa_raw_function_data_t *)function;
+	enter(ctx);
+
+	data->params = slice_new(0, KOOPA_RSIK_VALUE);
+	data->bbs = slice_new(0, KOOPA_RSIK_BASIC_BLOCK);
+
+	/* so are its loads and stores of global variables */
+	for (uint32_t i = 0; i < ctx->program->values.len; ++i)
+	{
+		const void *value = ctx->program->values.buffer[i];
+		((koopa_raw_value_data_t *)value)->used_by =
+			slice_new(0, KOOPA_RSIK_VALUE);
+	}
+}
+
+void ir_stream_end(struct context_t *ctx)
+{
+	symbols_delete(ctx->symbols);
+	ctx->symbols = NULL;
+	ctx->program = NULL;
+}
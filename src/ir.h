@@ -7,12 +7,43 @@
 #define _IR_H_
 
 #include "koopa.h"
+#include "cache.h"
+#include "context.h"
 #include "node.h"
 #include "bump.h"
 #include "hashtable.h"
 
-/* Generate Koopa raw program from AST.
+/* Generate Koopa raw program from `ctx->comp_unit`, allocated from
+ * `ctx->bump`, following the results of `semantic()`. Bodies of functions
+ * are built on up to as many threads as set by `ir_set_jobs()`; those built
+ * on other threads than the caller's are allocated from `ctx->arenas`.
+ * Functions in `ctx->cached` get `raw` set, and those with their assembly
+ * found are only declared.
  * @return Generated raw program. */
-koopa_raw_program_t ir(const struct node_t *program);
+koopa_raw_program_t ir(struct context_t *ctx);
+/* The output doesn't depend on `jobs`. */
+void ir_set_jobs(uint32_t jobs);
+
+/* Add to `key` everything IR of the function defined by `func_def` is built
+ * from: its tokens, and the signatures of the globals they refer to. Names
+ * in it must have been resolved, and the symbol table not be gone yet. */
+void ir_key(const struct node_t *func_def, struct hash_t *key);
+/* Same, but doing semantic analysis along the way instead. Errors are thrown
+ * to `ctx->env`.
+ * @return Generated raw program. */
+koopa_raw_program_t ir_fused(struct context_t *ctx);
+
+/* Generate IR one global at a time, as they're parsed, doing semantic
+ * analysis as `ir_fused()` does. Global variables and library functions go
+ * into `program`; bodies of functions are allocated from `ctx->body`, so
+ * that each can be freed once it's done with. */
+void ir_stream_begin(struct context_t *ctx, koopa_raw_program_t *program);
+/* @return function defined by `global`, or NULL if it's a declaration. */
+koopa_raw_function_t ir_stream_global(struct context_t *ctx,
+				      const struct node_t *global);
+/* Forget the body of `function`, before `ctx->body` is reset. Its signature
+ * is still there for the functions calling it. */
+void ir_stream_drop(struct context_t *ctx, koopa_raw_function_t function);
+void ir_stream_end(struct context_t *ctx);
 
 #endif//_IR_H_
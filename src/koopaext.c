@@ -4,12 +4,18 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "debug.h"
 #include "hashtable.h"
 #include "koopaext.h"
 #include "macros.h"
-#include "globals.h"
+
+/* state variables */
+// arena that everything built here comes from
+static _Thread_local bump_t m_bump;
+// global variables are shared with other threads
+static _Thread_local bool m_shared;
 
 // TODO make a table that efficiently deduplicates different kinds of values
 // that are in fact the same thing
@@ -17,30 +23,49 @@
 /* raw program memory management */
 void koopa_raw_program_set_allocator(bump_t bump)
 {
-	g_bump = bump;
+	m_bump = bump;
+}
+
+bump_t koopa_raw_program_allocator(void)
+{
+	return m_bump;
+}
+
+void koopa_raw_program_set_shared(bool shared)
+{
+	m_shared = shared;
 }
 
 /* slice operations */
+/* room for `len` items and the ones `slice_append()` may add */
+static uint32_t capacity(uint32_t len)
+{
+	uint32_t capacity = 1;
+	while (capacity < len)
+		capacity *= 2;
+
+	return capacity;
+}
+
 void slice_append(koopa_raw_slice_t *slice, void *item)
 {
-	if (slice->len == 0)
-	{
-		slice->len = 1;
-		slice->buffer = bump_malloc(g_bump, sizeof(void *));
-		slice->buffer[0] = item;
-	}
-	else
+	/* i mean, this thing is definitely not designed for insertion,
+	 * right? since it doesn't have a capacity field.
+	 * well, perhaps all of those _raw_ things aren't meant to be
+	 * manipulated by human, you know, they're all const-qualified.
+	 * ah, nevermind. buffers always hold the next power of two of `len`,
+	 * so they only need to grow when `len` is a power of two. */
+	uint32_t len = slice->len;
+	if (len == 0 || (len & (len - 1)) == 0)
 	{
-		/* i mean, this thing is definitely not designed for insertion,
-		 * right? since it doesn't have a capacity field, thus we have
-		 * to realloc() all the time.
-		 * well, perhaps all of those _raw_ things aren't meant to be
-		 * manipulated by human, you know, they're all const-qualified.
-		 * ah, nevermind. */
-		slice->buffer = bump_realloc(g_bump, slice->buffer, 
-					     sizeof(void *) * ++slice->len);
-		slice->buffer[slice->len - 1] = item;
+		const void **buffer = bump_malloc(m_bump,
+						  sizeof(void *)
+						  * max(2 * len, 1u));
+		if (len > 0)
+			memcpy(buffer, slice->buffer, sizeof(void *) * len);
+		slice->buffer = buffer;
 	}
+	slice->buffer[slice->len++] = item;
 }
 
 void *slice_back(koopa_raw_slice_t *slice)
@@ -51,6 +76,21 @@ void *slice_back(koopa_raw_slice_t *slice)
 	return slice->buffer[slice->len - 1];
 }
 
+/* removes the first occurrence of `item`, if any */
+void slice_remove(koopa_raw_slice_t *slice, void *item)
+{
+	for (uint32_t i = 0; i < slice->len; ++i)
+	{
+		if (slice->buffer[i] != item)
+			continue;
+
+		memmove(&slice->buffer[i], &slice->buffer[i + 1],
+			sizeof(void *) * (slice->len - i - 1));
+		--slice->len;
+		return;
+	}
+}
+
 koopa_raw_slice_t slice_new(uint32_t len, koopa_raw_slice_item_kind_t kind)
 {
 	koopa_raw_slice_t slice = { .len = len, .kind = kind, };
@@ -58,7 +98,8 @@ koopa_raw_slice_t slice_new(uint32_t len, koopa_raw_slice_item_kind_t kind)
 	if (len == 0)
 		slice.buffer = NULL;
 	else
-		slice.buffer = bump_malloc(g_bump, sizeof(void *) * len);
+		slice.buffer = bump_malloc(m_bump,
+					   sizeof(void *) * capacity(len));
 
 	return slice;
 }
@@ -79,7 +120,7 @@ char *koopa_raw_name_global(char *ident)
 	snprintf(name, 1 + IDENT_MAX, "@%s", ident);
 	name[IDENT_MAX] = '\0';
 
-	return bump_strdup(g_bump, name);
+	return bump_strdup(m_bump, name);
 }
 
 char *koopa_raw_name_local(char *ident)
@@ -91,7 +132,7 @@ char *koopa_raw_name_local(char *ident)
 	snprintf(name, 1 + IDENT_MAX, "%%%s", ident);
 	name[IDENT_MAX] = '\0';
 
-	return bump_strdup(g_bump, name);
+	return bump_strdup(m_bump, name);
 }
 
 /* common objects */
@@ -103,6 +144,16 @@ static koopa_raw_type_kind_t KOOPA_RAW_TYPE_KIND_UNIT = {
 	.tag = KOOPA_RTT_UNIT,
 };
 
+/* `user` goes into `used_by` of `value`, unless others may be doing the same
+ * at the same time */
+static void use(koopa_raw_value_t value, koopa_raw_value_t user)
+{
+	if (m_shared && value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+		return;
+
+	slice_append(&value->used_by, user);
+}
+
 /* IR builders */
 koopa_raw_type_t koopa_raw_type_int32(void)
 {
@@ -116,7 +167,7 @@ koopa_raw_type_t koopa_raw_type_unit(void)
 
 koopa_raw_type_t koopa_raw_type_array(koopa_raw_type_t base, size_t len)
 {
-	koopa_raw_type_kind_t *type = bump_malloc(g_bump, sizeof(*type));
+	koopa_raw_type_kind_t *type = bump_malloc(m_bump, sizeof(*type));
 	type->tag = KOOPA_RTT_ARRAY;
 	type->data.array.base = base;
 	type->data.array.len = len;
@@ -126,7 +177,7 @@ koopa_raw_type_t koopa_raw_type_array(koopa_raw_type_t base, size_t len)
 
 koopa_raw_type_t koopa_raw_type_pointer(koopa_raw_type_t base)
 {
-	koopa_raw_type_kind_t *type = bump_malloc(g_bump, sizeof(*type));
+	koopa_raw_type_kind_t *type = bump_malloc(m_bump, sizeof(*type));
 	type->tag = KOOPA_RTT_POINTER;
 	type->data.pointer.base = base;
 
@@ -135,7 +186,7 @@ koopa_raw_type_t koopa_raw_type_pointer(koopa_raw_type_t base)
 
 koopa_raw_type_t koopa_raw_type_function(koopa_raw_type_t ret)
 {
-	koopa_raw_type_kind_t *type = bump_malloc(g_bump, sizeof(*type));
+	koopa_raw_type_kind_t *type = bump_malloc(m_bump, sizeof(*type));
 	type->tag = KOOPA_RTT_FUNCTION;
 	type->data.function.params = slice_new(0, KOOPA_RSIK_TYPE);
 	type->data.function.ret = ret;
@@ -145,7 +196,7 @@ koopa_raw_type_t koopa_raw_type_function(koopa_raw_type_t ret)
 
 koopa_raw_value_t koopa_raw_integer(int32_t value)
 {
-	koopa_raw_value_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_value_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->ty = koopa_raw_type_int32();
 	ret->name = NULL;
 	ret->used_by = slice_new(0, KOOPA_RSIK_VALUE);
@@ -164,7 +215,7 @@ koopa_raw_value_t koopa_raw_aggregate()
 
 koopa_raw_value_t koopa_raw_zero_init(koopa_raw_type_t ty)
 {
-	koopa_raw_value_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_value_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->ty = ty;
 	ret->name = NULL;
 	ret->used_by = slice_new(0, KOOPA_RSIK_VALUE);
@@ -183,7 +234,7 @@ koopa_raw_value_t koopa_raw_undef(koopa_raw_type_t ty)
 
 koopa_raw_value_t koopa_raw_func_arg_ref(char *name, size_t index)
 {
-	koopa_raw_value_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_value_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->ty = koopa_raw_type_int32();
 	ret->name = name;
 	ret->used_by = slice_new(0, KOOPA_RSIK_VALUE);
@@ -203,7 +254,7 @@ koopa_raw_value_t koopa_raw_block_arg_ref(size_t index)
 
 koopa_raw_value_t koopa_raw_global_alloc(char *name, koopa_raw_value_t init)
 {
-	koopa_raw_value_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_value_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->ty = koopa_raw_type_pointer(init->ty);
 	ret->name = name;
 	ret->used_by = slice_new(0, KOOPA_RSIK_VALUE);
@@ -212,14 +263,14 @@ koopa_raw_value_t koopa_raw_global_alloc(char *name, koopa_raw_value_t init)
 		.data.global_alloc = { .init = init, },
 	};
 
-	slice_append(&ret->kind.data.global_alloc.init->used_by, ret);
+	use(ret->kind.data.global_alloc.init, ret);
 	
 	return ret;
 }
 
 koopa_raw_value_t koopa_raw_alloc(char *name, koopa_raw_type_t base)
 {
-	koopa_raw_value_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_value_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->ty = koopa_raw_type_pointer(base);
 	ret->name = name;
 	ret->used_by = slice_new(0, KOOPA_RSIK_VALUE);
@@ -232,7 +283,7 @@ koopa_raw_value_t koopa_raw_alloc(char *name, koopa_raw_type_t base)
 
 koopa_raw_value_t koopa_raw_load(koopa_raw_value_t src)
 {
-	koopa_raw_value_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_value_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->ty = koopa_raw_type_int32();
 	ret->name = NULL;
 	ret->used_by = slice_new(0, KOOPA_RSIK_VALUE);
@@ -241,7 +292,7 @@ koopa_raw_value_t koopa_raw_load(koopa_raw_value_t src)
 		.data.load = { .src = src, },
 	};
 
-	slice_append(&ret->kind.data.load.src->used_by, ret);
+	use(ret->kind.data.load.src, ret);
 
 	return ret;
 }
@@ -249,7 +300,7 @@ koopa_raw_value_t koopa_raw_load(koopa_raw_value_t src)
 koopa_raw_value_t koopa_raw_store(koopa_raw_value_t value,
 				  koopa_raw_value_t dest)
 {
-	koopa_raw_value_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_value_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->ty = koopa_raw_type_unit();
 	ret->name = NULL;
 	ret->used_by = slice_new(0, KOOPA_RSIK_VALUE);
@@ -258,8 +309,8 @@ koopa_raw_value_t koopa_raw_store(koopa_raw_value_t value,
 		.data.store = { .value = value, .dest = dest, },
 	};
 
-	slice_append(&ret->kind.data.store.value->used_by, ret);
-	slice_append(&ret->kind.data.store.dest->used_by, ret);
+	use(ret->kind.data.store.value, ret);
+	use(ret->kind.data.store.dest, ret);
 
 	return ret;
 }
@@ -282,7 +333,7 @@ koopa_raw_value_t koopa_raw_binary(koopa_raw_binary_op_t op,
 				   koopa_raw_value_t lhs,
 				   koopa_raw_value_t rhs)
 {
-	koopa_raw_value_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_value_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->ty = koopa_raw_type_int32();
 	ret->name = NULL;
 	ret->used_by = slice_new(0, KOOPA_RSIK_VALUE);
@@ -291,8 +342,8 @@ koopa_raw_value_t koopa_raw_binary(koopa_raw_binary_op_t op,
 		.data.binary = { .op = op, .lhs = lhs, .rhs = rhs, },
 	};
 
-	slice_append(&ret->kind.data.binary.lhs->used_by, ret);
-	slice_append(&ret->kind.data.binary.rhs->used_by, ret);
+	use(ret->kind.data.binary.lhs, ret);
+	use(ret->kind.data.binary.rhs, ret);
 
 	return ret;
 }
@@ -301,7 +352,7 @@ koopa_raw_value_t koopa_raw_branch(koopa_raw_value_t cond,
 				   koopa_raw_basic_block_t true_bb,
 				   koopa_raw_basic_block_t false_bb)
 {
-	koopa_raw_value_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_value_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->ty = koopa_raw_type_unit();
 	ret->name = NULL;
 	ret->used_by = slice_new(0, KOOPA_RSIK_VALUE);
@@ -316,7 +367,7 @@ koopa_raw_value_t koopa_raw_branch(koopa_raw_value_t cond,
 		},
 	};
 
-	slice_append(&ret->kind.data.branch.cond->used_by, ret);
+	use(ret->kind.data.branch.cond, ret);
 	slice_append(&ret->kind.data.branch.true_bb->used_by, ret);
 	slice_append(&ret->kind.data.branch.false_bb->used_by, ret);
 
@@ -325,7 +376,7 @@ koopa_raw_value_t koopa_raw_branch(koopa_raw_value_t cond,
 
 koopa_raw_value_t koopa_raw_jump(koopa_raw_basic_block_t target)
 {
-	koopa_raw_value_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_value_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->ty = koopa_raw_type_unit();
 	ret->name = NULL;
 	ret->used_by = slice_new(0, KOOPA_RSIK_VALUE);
@@ -344,7 +395,7 @@ koopa_raw_value_t koopa_raw_jump(koopa_raw_basic_block_t target)
 
 koopa_raw_value_t koopa_raw_call(koopa_raw_function_t callee)
 {
-	koopa_raw_value_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_value_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->ty = callee->ty->data.function.ret;
 	ret->name = NULL;
 	ret->used_by = slice_new(0, KOOPA_RSIK_VALUE);
@@ -361,7 +412,7 @@ koopa_raw_value_t koopa_raw_call(koopa_raw_function_t callee)
 
 koopa_raw_value_t koopa_raw_return(koopa_raw_value_t value)
 {
-	koopa_raw_value_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_value_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->ty = koopa_raw_type_unit();
 	ret->name = NULL;
 	ret->used_by = slice_new(0, KOOPA_RSIK_VALUE);
@@ -372,14 +423,14 @@ koopa_raw_value_t koopa_raw_return(koopa_raw_value_t value)
 
 	/* we can in fact return nothing */
 	if (value != NULL)
-		slice_append(&ret->kind.data.ret.value->used_by, ret);
+		use(ret->kind.data.ret.value, ret);
 
 	return ret;
 }
 
 koopa_raw_basic_block_t koopa_raw_basic_block(char *name)
 {
-	koopa_raw_basic_block_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_basic_block_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->name = koopa_raw_name_local(name);
 	ret->params = slice_new(0, KOOPA_RSIK_VALUE);
 	ret->used_by = slice_new(0, KOOPA_RSIK_VALUE);
@@ -390,7 +441,7 @@ koopa_raw_basic_block_t koopa_raw_basic_block(char *name)
 
 koopa_raw_function_t koopa_raw_function(koopa_raw_type_t ty, char *name)
 {
-	koopa_raw_function_data_t *ret = bump_malloc(g_bump, sizeof(*ret));
+	koopa_raw_function_data_t *ret = bump_malloc(m_bump, sizeof(*ret));
 	ret->ty = ty;
 	ret->name = koopa_raw_name_global(name);
 	ret->params = slice_new(0, KOOPA_RSIK_VALUE);
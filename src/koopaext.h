@@ -6,17 +6,25 @@
 #ifndef _KOOPAEXT_H_
 #define _KOOPAEXT_H_
 
+#include <stdbool.h>
+
 #include "koopa.h"
 #include "bump.h"
 
-/* raw program memory management */
+/* raw program memory management. the allocator is per thread */
 void koopa_raw_program_set_allocator(bump_t bump);
+bump_t koopa_raw_program_allocator(void);
+/* While set, uses of global variables aren't recorded by this thread, so
+ * that functions can be built side by side. They're for the caller to add
+ * afterwards. */
+void koopa_raw_program_set_shared(bool shared);
 
 /* slice operations */
 koopa_raw_slice_t slice_new(uint32_t len, koopa_raw_slice_item_kind_t kind);
 void slice_append(koopa_raw_slice_t *slice, void *item);
 void slice_iter(koopa_raw_slice_t *slice, void (*fn)(void *));
 void *slice_back(koopa_raw_slice_t *slice);
+void slice_remove(koopa_raw_slice_t *slice, void *item);
 
 /* name constructors */
 char *koopa_raw_name_global(char *ident);
@@ -4,32 +4,283 @@
  */
 
 #include <assert.h>
-#include <setjmp.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include "ast.h"
+#include "cache.h"
 #include "codegen.h"
 #include "debug.h"
-#include "globals.h"
+#include "driver.h"
 #include "ir.h"
 #include "koopa.h"
-#include "koopaext.h"
 #include "macros.h"
-#include "semantic.h"
+#include "passes.h"
+#include "peephole.h"
+#include "phases.h"
+#include "pool.h"
+#include "schedule.h"
+#include "serve.h"
+#include "vector.h"
 
-/* yacc variables */
-extern FILE *yyin;
-extern int yyparse(void);
+/* options */
+static bool m_peephole_stats;
+static bool m_cache_stats;
+static uint32_t m_jobs;
 
-/* state variables */
-extern bool error;
-extern struct node_t *comp_unit;
+/* options that don't change the output, and so are left out of cache
+ * keys */
+static bool is_neutral(const char *option)
+{
+	return strcmp(option, "-peephole-stats") == 0
+	       || strcmp(option, "-time-passes") == 0
+	       || strncmp(option, "-time-report", 12) == 0
+	       || strcmp(option, "-fused") == 0
+	       || strcmp(option, "-verify") == 0
+	       || strcmp(option, "-no-verify") == 0
+	       || strncmp(option, "-cache-", 7) == 0
+	       || strncmp(option, "-j", 2) == 0;
+}
+
+static bool parse_options(int argc, char **argv)
+{
+	const char *disable = "-peephole-disable=";
+	const char *passes = "-passes=";
+	const char *tune = "-mtune=";
+	const char *arch = "-march=";
+	const char *cache_dir = "-cache-dir=";
+	const char *cache_size = "-cache-size=";
+	const char *pipeline = NULL;
+	uint32_t level = 1;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		if (strncmp(argv[i], disable, strlen(disable)) == 0)
+		{
+			char *rules = strdup(argv[i] + strlen(disable));
+			for (char *rule = strtok(rules, ","); rule;
+			     rule = strtok(NULL, ","))
+				if (!peephole_disable(rule))
+				{
+					fprintf(stderr, "unknown rule: %s\n",
+						rule);
+					free(rules);
+					return false;
+				}
+			free(rules);
+		}
+		else if (strncmp(argv[i], arch, strlen(arch)) == 0)
+		{
+			if (!codegen_set_arch(argv[i] + strlen(arch)))
+			{
+				fprintf(stderr, "unsupported arch: %s\n",
+					argv[i] + strlen(arch));
+				return false;
+			}
+		}
+		else if (strncmp(argv[i], tune, strlen(tune)) == 0)
+		{
+			if (!schedule_set_target(argv[i] + strlen(tune)))
+			{
+				fprintf(stderr, "unknown core: %s\n",
+					argv[i] + strlen(tune));
+				return false;
+			}
+		}
+		else if (strncmp(argv[i], passes, strlen(passes)) == 0)
+			pipeline = argv[i] + strlen(passes);
+		else if (strlen(argv[i]) == 3 && strncmp(argv[i], "-O", 2) == 0
+			 && argv[i][2] >= '0'
+			 && argv[i][2] <= '0' + OPT_LEVEL_MAX)
+			level = argv[i][2] - '0';
+		else if (strcmp(argv[i], "-peephole-stats") == 0)
+			m_peephole_stats = true;
+		else if (strcmp(argv[i], "-time-passes") == 0)
+			driver_set_time_passes(true);
+		else if (strcmp(argv[i], "-time-report") == 0)
+			phases_set_report(PHASES_TEXT);
+		else if (strcmp(argv[i], "-time-report=json") == 0)
+			phases_set_report(PHASES_JSON);
+		else if (strcmp(argv[i], "-fused") == 0)
+			driver_set_fused(true);
+		else if (strcmp(argv[i], "-stream") == 0)
+			driver_set_streaming(true);
+		else if (strcmp(argv[i], "-verify") == 0)
+			driver_set_verify(true);
+		else if (strcmp(argv[i], "-no-verify") == 0)
+			driver_set_verify(false);
+		else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] >= '1'
+			 && argv[i][2] <= '9')
+			m_jobs = strtoul(argv[i] + 2, NULL, 10);
+		else if (strncmp(argv[i], cache_dir, strlen(cache_dir)) == 0)
+		{
+			if (!cache_set_dir(argv[i] + strlen(cache_dir)))
+			{
+				perror(argv[i] + strlen(cache_dir));
+				return false;
+			}
+		}
+		else if (strncmp(argv[i], cache_size, strlen(cache_size)) == 0)
+			cache_set_size(strtoul(argv[i] + strlen(cache_size),
+					       NULL, 10) MiB);
+		else if (strcmp(argv[i], "-cache-stats") == 0)
+			m_cache_stats = true;
+		else
+		{
+			fprintf(stderr, "unknown option: %s\n", argv[i]);
+			return false;
+		}
+	}
+
+	/* -passes= overrides the default pipeline of -O */
+	peephole_set_enabled(level > 0);
+	schedule_set_enabled(level > 0);
+	passes_set_level(level);
+	if (pipeline && !passes_set_pipeline(pipeline))
+	{
+		fprintf(stderr, "unknown pass in: %s\n", pipeline);
+		return false;
+	}
+
+	char *flags;
+	size_t len;
+	FILE *stream = open_memstream(&flags, &len);
+	for (int i = 0; i < argc; ++i)
+		if (!is_neutral(argv[i]))
+			fprintf(stream, "%s\n", argv[i]);
+	fclose(stream);
+	cache_set_flags(flags);
+	free(flags);
+
+	return true;
+}
+
+static void report(void)
+{
+	if (m_peephole_stats)
+		peephole_report(stderr);
+
+	if (cache_enabled())
+		cache_trim();
+	if (m_cache_stats)
+		cache_report(stderr);
+}
+
+/* `@file` stands for the whitespace-separated paths listed in it */
+static bool read_paths(const char *arg, struct vector_ptr_t *paths)
+{
+	if (arg[0] != '@')
+	{
+		vector_ptr_push(paths, strdup(arg));
+		return true;
+	}
+
+	FILE *f = fopen(arg + 1, "r");
+	if (!f)
+	{
+		perror(arg + 1);
+		return false;
+	}
+
+	char path[4096];
+	while (fscanf(f, "%4095s", path) == 1)
+		vector_ptr_push(paths, strdup(path));
+
+	fclose(f);
+	return true;
+}
+
+/* compiler -batch <mode> [options] <input> <output> [<input> <output>]...
+ * inputs and outputs may also come in pairs from response files. */
+static int batch(int argc, char **argv)
+{
+	if (argc < 1)
+		return 1;
+
+	const char *mode = argv[0];
+	if (strcmp(mode, "-koopa") != 0 && strcmp(mode, "-riscv") != 0)
+	{
+		fprintf(stderr, "unsupported batch mode: %s\n", mode);
+		return 1;
+	}
+
+	/* options come before paths */
+	int first = 1;
+	while (first < argc && argv[first][0] == '-')
+		++first;
+	if (!parse_options(first - 1, argv + 1))
+		return 1;
+
+	int status = 1;
+	struct vector_ptr_t *paths = vector_ptr_new(16);
+	for (int i = first; i < argc; ++i)
+		if (!read_paths(argv[i], paths))
+			goto cleanup_paths;
+	if (paths->size % 2 != 0)
+	{
+		fprintf(stderr, "input without output: %s\n",
+			(char *)vector_ptr_back(paths));
+		goto cleanup_paths;
+	}
+
+	uint32_t len = paths->size / 2;
+	struct unit_t *units = calloc(len, sizeof(struct unit_t));
+	for (uint32_t i = 0; i < len; ++i)
+		units[i] = (struct unit_t) {
+			.mode = mode,
+			.input = paths->data[2 * i],
+			.middle = "-o",
+			.output = paths->data[2 * i + 1],
+		};
+
+	if (m_jobs == 0)
+		m_jobs = pool_default_jobs();
+	driver_set_verbose(false);
+	double wall = driver_batch(units, len, m_jobs);
+	driver_report(units, len, wall, stderr);
+	report();
+
+	status = 0;
+	for (uint32_t i = 0; i < len; ++i)
+		if (units[i].status != 0)
+			status = 1;
+
+	free(units);
+cleanup_paths:
+	for (size_t i = 0; i < paths->size; ++i)
+		free(paths->data[i]);
+	vector_ptr_delete(paths);
+
+	return status;
+}
+
+/* compiler -serve <socket> [options] */
+static int server(int argc, char **argv)
+{
+	if (argc < 1 || !parse_options(argc - 1, argv + 1))
+		return 1;
+
+	/* requests are compiled side by side, each on a single thread */
+	driver_set_verbose(false);
+	driver_set_warm(true);
+	return serve(argv[0], m_jobs ? m_jobs : pool_default_jobs());
+}
 
 int main(int argc, char **argv)
 {
-	if (argc != 5)
+	/* many units per process */
+	if (argc >= 2 && strcmp(argv[1], "-batch") == 0)
+		return batch(argc - 2, argv + 2);
+
+	/* units sent to a long-running process */
+	if (argc >= 2 && strcmp(argv[1], "-serve") == 0)
+		return server(argc - 2, argv + 2);
+	if (argc == 7 && strcmp(argv[1], "-connect") == 0)
+		return serve_request(argv[2], argv[3], argv[4], argv[5],
+				     argv[6]);
+
+	if (argc < 5)
 		return 1;
 
 	const char *mode = argv[1];
@@ -37,6 +288,10 @@ int main(int argc, char **argv)
 	const char *middle = argv[3];
 	const char *output = argv[4];
 
+	/* options */
+	if (!parse_options(argc - 5, argv + 5))
+		return 1;
+
 	/* reference mode */
 	if (strcmp(mode, "-debug") == 0)
 	{
@@ -57,87 +312,20 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
-	/* parse */
-	printf("======= Parsing...\n");
-	yyin = fopen(input, "r");
-	if (!yyin)
-	{
-		perror(input);
-		return 1;
-	}
-	yyparse();
-	fclose(yyin);
-
-	/* check error from lexer/parser */
-	if (error)
-		return 1;
-
-#if 0
-	/* print AST */
-	printf("======= Abstract syntax tree (AST)\n");
-	ast_print(comp_unit);
-#endif
-
-	/* semantic analysis */
-	if (setjmp(g_exception_env) == 0)
-		semantic(comp_unit);
-	else
-		goto cleanup_comp_unit;
-
-	/* generate memory IR */
-	printf("======= Generating memory IR...\n");
-	bump_t bump = bump_new(4 MiB);
-	koopa_raw_program_set_allocator(bump);
-	koopa_raw_program_t raw = ir(comp_unit);
-
-#if 0
-	/* log memory IR */
-	printf("======= Logging memory IR into stderr...\n");
-	debug(&raw);
-#endif
-
-	/* try to convert memory IR into raw koopa program */
-	printf("======= Verifying memory IR integrity...\n");
-	koopa_program_t program;
-	koopa_error_code_t ret = koopa_generate_raw_to_koopa(&raw, &program);
-	if (ret != KOOPA_EC_SUCCESS)
-	{
-		printf("error code: %d", ret);
-		goto cleanup_raw_program;
-	}
-
-	/* compile to RISC-V assembly */
-	if (strcmp(mode, "-riscv") == 0)
-	{
-		/* dump IR */
-		if (strcmp(middle, "-o") != 0)
-		{
-			printf("======= Dumping text-form Koopa IR...\n");
-			koopa_dump_to_file(program, middle);
-		}
-
-		/* generate assembly */
-		FILE *f = fopen(output, "w");
-		printf("======= Generating assembly...\n");
-		codegen(&raw, f);
-		fclose(f);
-	}
-
-	/* generate Koopa IR */
-	if (strcmp(mode, "-koopa") == 0)
-	{
-		/* dump IR */
-		printf("======= Dumping text-form Koopa IR...\n");
-		koopa_dump_to_file(program, output);
-	}
+	/* one unit, so its functions are what get spread over threads. only
+	 * if asked to, as a build running many of us at once has the cores
+	 * taken already */
+	ir_set_jobs(m_jobs ? m_jobs : 1);
+	codegen_set_jobs(m_jobs ? m_jobs : 1);
 
-	/* cleanup */
-	printf("======= Cleaning up...\n");
-	koopa_delete_program(program);
-cleanup_raw_program:
-	bump_delete(bump);
-cleanup_comp_unit:
-	node_delete(comp_unit);
+	struct unit_t unit = {
+		.mode = mode,
+		.input = input,
+		.middle = middle,
+		.output = output,
+	};
+	int status = driver_compile(&unit);
+	report();
 
-	return 0;
+	return status;
 }
@@ -8,6 +8,7 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 // ima be lazy here, obliging what the standard says
 #define IDENT_MAX 64
@@ -83,11 +84,24 @@ union ast_value_u {
 	char s[IDENT_MAX];
 };
 
+/* what's known about the value of an expression */
+enum fold_e {
+	FOLD_UNKNOWN = 0,
+	FOLD_VARIABLE,
+	FOLD_CONSTANT,
+};
+
 struct node_data_t {
 	bool terminal;
 	int lineno;
 	enum ast_kind_e kind;
 	union ast_value_u value;
+	// filled in by semantic analysis, for IR generation to pick up
+	enum fold_e fold;
+	int32_t folded;
+	// what the name defined or used here refers to, for as long as the
+	// symbol table lasts. only globals if semantic analysis is fused
+	struct symbol_t *symbol;
 };
 
 struct node_t {
@@ -0,0 +1,507 @@
+#pragma clang diagnostic ignored \
+	"-Wincompatible-pointer-types-discards-qualifiers"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cache.h"
+#include "globaldce.h"
+#include "ipcp.h"
+#include "macros.h"
+#include "passes.h"
+#include "strength.h"
+
+#define PIPELINE_MAX 32
+
+struct pass_t {
+	const char *name;
+	enum {
+		PASS_MODULE,
+		PASS_FUNCTION,
+	} kind;
+	union {
+		void (*module)(koopa_raw_program_t *program);
+		void (*function)(koopa_raw_function_t function);
+	};
+	// lowest optimization level that runs this pass
+	uint32_t level;
+};
+
+/* registered passes, in the order of default pipelines */
+static const struct pass_t PASSES[] = {
+	{
+		.name = "globaldce",
+		.kind = PASS_MODULE,
+		.module = globaldce,
+		.level = 1,
+	},
+	{
+		.name = "ipcp",
+		.kind = PASS_MODULE,
+		.module = ipcp,
+		.level = 1,
+	},
+	{
+		.name = "ipcp-clone",
+		.kind = PASS_MODULE,
+		.module = ipcp_clone,
+		.level = 2,
+	},
+	/* clones may have taken every call site of what they're cloned from */
+	{
+		.name = "globaldce",
+		.kind = PASS_MODULE,
+		.module = globaldce,
+		.level = 2,
+	},
+	{
+		.name = "strength",
+		.kind = PASS_FUNCTION,
+		.function = strength,
+		.level = 1,
+	},
+};
+
+#define PASS_COUNT (sizeof(PASSES) / sizeof(PASSES[0]))
+
+/* statistics of a pass run */
+struct stat_t {
+	const struct pass_t *pass;
+	double time;
+	uint32_t insts_before;
+	uint32_t insts_after;
+};
+
+/* state variables */
+static const struct pass_t *m_pipeline[PIPELINE_MAX];
+static uint32_t m_pipeline_len;
+static _Thread_local struct stat_t m_stats[PIPELINE_MAX];
+static _Thread_local uint32_t m_stats_len;
+static _Thread_local FILE *m_remarks;
+
+/* tool functions */
+static const struct pass_t *find_pass(const char *name)
+{
+	for (uint32_t i = 0; i < PASS_COUNT; ++i)
+		if (strcmp(PASSES[i].name, name) == 0)
+			return &PASSES[i];
+
+	return NULL;
+}
+
+static uint32_t count_function_insts(koopa_raw_function_t function)
+{
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		koopa_raw_basic_block_t basic_block = function->bbs.buffer[i];
+		count += basic_block->insts.len;
+	}
+
+	return count;
+}
+
+static uint32_t count_insts(const koopa_raw_program_t *program)
+{
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < program->funcs.len; ++i)
+		count += count_function_insts(program->funcs.buffer[i]);
+
+	return count;
+}
+
+/* fingerprints of functions, to tell which ones module passes have changed.
+ * values and blocks of the function are numbered in order, the rest are
+ * hashed by content */
+static void hash_type(struct hash_t *hash, koopa_raw_type_t ty)
+{
+	hash_u32(hash, ty->tag);
+	switch (ty->tag)
+	{
+	case KOOPA_RTT_INT32:
+	case KOOPA_RTT_UNIT:
+		break;
+	case KOOPA_RTT_ARRAY:
+		hash_u32(hash, ty->data.array.len);
+		hash_type(hash, ty->data.array.base);
+		break;
+	case KOOPA_RTT_POINTER:
+		hash_type(hash, ty->data.pointer.base);
+		break;
+	case KOOPA_RTT_FUNCTION:
+		hash_u32(hash, ty->data.function.params.len);
+		for (uint32_t i = 0; i < ty->data.function.params.len; ++i)
+			hash_type(hash, ty->data.function.params.buffer[i]);
+		hash_type(hash, ty->data.function.ret);
+		break;
+	}
+}
+
+static void hash_operand(struct hash_t *hash, const void *operand,
+			 htable_ptru32_t ids)
+{
+	uint32_t *id = htable_lookup(ids, operand);
+	if (id)
+	{
+		hash_u32(hash, *id);
+		return;
+	}
+
+	koopa_raw_value_t value = operand;
+	hash_u32(hash, UINT32_MAX);
+	hash_u32(hash, value->kind.tag);
+	hash_type(hash, value->ty);
+	switch (value->kind.tag)
+	{
+	case KOOPA_RVT_INTEGER:
+		hash_u32(hash, value->kind.data.integer.value);
+		break;
+	case KOOPA_RVT_FUNC_ARG_REF:
+		hash_u32(hash, value->kind.data.func_arg_ref.index);
+		break;
+	case KOOPA_RVT_AGGREGATE:
+	{
+		const koopa_raw_slice_t *elems =
+			&value->kind.data.aggregate.elems;
+		for (uint32_t i = 0; i < elems->len; ++i)
+			hash_operand(hash, elems->buffer[i], ids);
+		break;
+	}
+	default:
+		// global allocations
+		hash_str(hash, value->name);
+		break;
+	}
+}
+
+static void hash_slice(struct hash_t *hash, const koopa_raw_slice_t *slice,
+		       htable_ptru32_t ids)
+{
+	hash_u32(hash, slice->len);
+	for (uint32_t i = 0; i < slice->len; ++i)
+		hash_operand(hash, slice->buffer[i], ids);
+}
+
+static void hash_inst(struct hash_t *hash, koopa_raw_value_t inst,
+		      htable_ptru32_t ids)
+{
+	const koopa_raw_value_kind_t *kind = &inst->kind;
+
+	hash_u32(hash, kind->tag);
+	hash_str(hash, inst->name);
+	hash_type(hash, inst->ty);
+	switch (kind->tag)
+	{
+	case KOOPA_RVT_LOAD:
+		hash_operand(hash, kind->data.load.src, ids);
+		break;
+	case KOOPA_RVT_STORE:
+		hash_operand(hash, kind->data.store.value, ids);
+		hash_operand(hash, kind->data.store.dest, ids);
+		break;
+	case KOOPA_RVT_GET_PTR:
+		hash_operand(hash, kind->data.get_ptr.src, ids);
+		hash_operand(hash, kind->data.get_ptr.index, ids);
+		break;
+	case KOOPA_RVT_GET_ELEM_PTR:
+		hash_operand(hash, kind->data.get_elem_ptr.src, ids);
+		hash_operand(hash, kind->data.get_elem_ptr.index, ids);
+		break;
+	case KOOPA_RVT_BINARY:
+		hash_u32(hash, kind->data.binary.op);
+		hash_operand(hash, kind->data.binary.lhs, ids);
+		hash_operand(hash, kind->data.binary.rhs, ids);
+		break;
+	case KOOPA_RVT_BRANCH:
+		hash_operand(hash, kind->data.branch.cond, ids);
+		hash_u32(hash, *htable_lookup(ids, kind->data.branch.true_bb));
+		hash_u32(hash, *htable_lookup(ids, kind->data.branch.false_bb));
+		hash_slice(hash, &kind->data.branch.true_args, ids);
+		hash_slice(hash, &kind->data.branch.false_args, ids);
+		break;
+	case KOOPA_RVT_JUMP:
+		hash_u32(hash, *htable_lookup(ids, kind->data.jump.target));
+		hash_slice(hash, &kind->data.jump.args, ids);
+		break;
+	case KOOPA_RVT_CALL:
+		// the callee's signature, not its body
+		hash_str(hash, kind->data.call.callee->name);
+		hash_type(hash, kind->data.call.callee->ty);
+		hash_slice(hash, &kind->data.call.args, ids);
+		break;
+	case KOOPA_RVT_RETURN:
+		if (kind->data.ret.value)
+			hash_operand(hash, kind->data.ret.value, ids);
+		break;
+	default:
+		break;
+	}
+}
+
+static void hash_function(struct hash_t *hash, koopa_raw_function_t function)
+{
+	htable_ptru32_t ids = htable_ptru32_new();
+	uint32_t count = 0;
+
+	for (uint32_t i = 0; i < function->params.len; ++i)
+		htable_insert(ids, function->params.buffer[i], count++);
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		koopa_raw_basic_block_t basic_block = function->bbs.buffer[i];
+
+		htable_insert(ids, basic_block, count++);
+		for (uint32_t j = 0; j < basic_block->params.len; ++j)
+			htable_insert(ids, basic_block->params.buffer[j],
+				      count++);
+		for (uint32_t j = 0; j < basic_block->insts.len; ++j)
+			htable_insert(ids, basic_block->insts.buffer[j],
+				      count++);
+	}
+
+	hash_str(hash, function->name);
+	hash_type(hash, function->ty);
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		koopa_raw_basic_block_t basic_block = function->bbs.buffer[i];
+
+		hash_str(hash, basic_block->name);
+		hash_u32(hash, basic_block->insts.len);
+		for (uint32_t j = 0; j < basic_block->insts.len; ++j)
+			hash_inst(hash, basic_block->insts.buffer[j], ids);
+	}
+
+	htable_ptru32_delete(ids);
+}
+
+/* functions as of before a run of module passes */
+struct prints_t {
+	htable_ptru32_t indices;
+	koopa_raw_function_t *functions;
+	struct hash_t *hashes;
+	uint32_t len;
+};
+
+static struct prints_t prints_take(const koopa_raw_program_t *program)
+{
+	struct prints_t ret = {
+		.indices = htable_ptru32_new(),
+		.functions = malloc(sizeof(koopa_raw_function_t)
+				    * program->funcs.len),
+		.hashes = malloc(sizeof(struct hash_t) * program->funcs.len),
+	};
+	for (uint32_t i = 0; i < program->funcs.len; ++i)
+	{
+		koopa_raw_function_t function = program->funcs.buffer[i];
+		if (function->bbs.len == 0)
+			continue;
+
+		htable_insert(ret.indices, (void *)function, ret.len);
+		ret.functions[ret.len] = function;
+		hash_init(&ret.hashes[ret.len]);
+		hash_function(&ret.hashes[ret.len], function);
+		++ret.len;
+	}
+
+	return ret;
+}
+
+/* those that are gone count as changed, too */
+static void prints_compare(struct prints_t *prints,
+			   const koopa_raw_program_t *program,
+			   htable_ptru32_t changed)
+{
+	bool *kept = calloc(prints->len + 1, sizeof(bool));
+	for (uint32_t i = 0; i < program->funcs.len; ++i)
+	{
+		koopa_raw_function_t function = program->funcs.buffer[i];
+		uint32_t *index = htable_lookup(prints->indices,
+						(void *)function);
+		if (!index)
+			continue;
+
+		struct hash_t hash;
+		hash_init(&hash);
+		hash_function(&hash, function);
+		kept[*index] = hash.a == prints->hashes[*index].a
+			       && hash.b == prints->hashes[*index].b;
+	}
+
+	for (uint32_t i = 0; i < prints->len; ++i)
+		if (!kept[i])
+			htable_insert(changed, (void *)prints->functions[i],
+				      1);
+
+	free(kept);
+	htable_ptru32_delete(prints->indices);
+	free(prints->functions);
+	free(prints->hashes);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run_pass(const struct pass_t *pass, koopa_raw_program_t *program)
+{
+	switch (pass->kind)
+	{
+	case PASS_MODULE:
+		pass->module(program);
+		break;
+	case PASS_FUNCTION:
+		for (uint32_t i = 0; i < program->funcs.len; ++i)
+		{
+			koopa_raw_function_t function =
+				program->funcs.buffer[i];
+
+			/* declaration only */
+			if (function->bbs.len == 0)
+				continue;
+
+			pass->function(function);
+		}
+		break;
+	}
+}
+
+/* public defn.s */
+void passes_set_level(uint32_t level)
+{
+	assert(level <= OPT_LEVEL_MAX);
+
+	m_pipeline_len = 0;
+	for (uint32_t i = 0; i < PASS_COUNT; ++i)
+		if (PASSES[i].level <= level)
+			m_pipeline[m_pipeline_len++] = &PASSES[i];
+}
+
+bool passes_set_pipeline(const char *list)
+{
+	char *names = strdup(list);
+	bool ok = true;
+
+	m_pipeline_len = 0;
+	for (char *name = strtok(names, ","); name; name = strtok(NULL, ","))
+	{
+		const struct pass_t *pass = find_pass(name);
+		if (!pass || m_pipeline_len == PIPELINE_MAX)
+		{
+			ok = false;
+			break;
+		}
+
+		m_pipeline[m_pipeline_len++] = pass;
+	}
+
+	free(names);
+	return ok;
+}
+
+bool passes_whole(void)
+{
+	for (uint32_t i = 0; i < m_pipeline_len; ++i)
+		if (m_pipeline[i]->kind == PASS_MODULE)
+			return true;
+
+	return false;
+}
+
+void passes_run(koopa_raw_program_t *program, htable_ptru32_t changed)
+{
+	struct prints_t prints = {0};
+
+	// statistics are of the last program run
+	m_stats_len = 0;
+	for (uint32_t i = 0; i < m_pipeline_len; ++i)
+	{
+		const struct pass_t *pass = m_pipeline[i];
+		struct stat_t *stat = &m_stats[m_stats_len++];
+
+		/* function passes do the same to the same function, so only
+		 * runs of module passes in between are checked */
+		bool module = changed && pass->kind == PASS_MODULE;
+		if (module
+		    && (i == 0 || m_pipeline[i - 1]->kind != PASS_MODULE))
+			prints = prints_take(program);
+
+		stat->pass = pass;
+		stat->insts_before = count_insts(program);
+		double begin = now();
+		run_pass(pass, program);
+		stat->time = now() - begin;
+		stat->insts_after = count_insts(program);
+
+		if (module && (i + 1 == m_pipeline_len
+			       || m_pipeline[i + 1]->kind != PASS_MODULE))
+			prints_compare(&prints, program, changed);
+	}
+}
+
+void passes_begin(void)
+{
+	m_stats_len = 0;
+	for (uint32_t i = 0; i < m_pipeline_len; ++i)
+		if (m_pipeline[i]->kind == PASS_FUNCTION)
+			m_stats[m_stats_len++] = (struct stat_t) {
+				.pass = m_pipeline[i],
+			};
+}
+
+void passes_run_function(koopa_raw_function_t function)
+{
+	for (uint32_t i = 0; i < m_stats_len; ++i)
+	{
+		struct stat_t *stat = &m_stats[i];
+
+		stat->insts_before += count_function_insts(function);
+		double begin = now();
+		stat->pass->function(function);
+		stat->time += now() - begin;
+		stat->insts_after += count_function_insts(function);
+	}
+}
+
+void passes_report(FILE *output)
+{
+	fprintf(output, "passes:\n");
+	fprintf(output, "  %-16s %10s %8s %8s %8s\n", "pass", "time (ms)",
+		"before", "after", "delta");
+
+	double total = 0;
+	for (uint32_t i = 0; i < m_stats_len; ++i)
+	{
+		const struct stat_t *stat = &m_stats[i];
+
+		fprintf(output, "  %-16s %10.3f %8u %8u %+8d\n",
+			stat->pass->name, stat->time * 1e3,
+			stat->insts_before, stat->insts_after,
+			(int32_t)(stat->insts_after - stat->insts_before));
+		total += stat->time;
+	}
+	fprintf(output, "  %-16s %10.3f\n", "total", total * 1e3);
+}
+
+void passes_set_remarks(FILE *output)
+{
+	m_remarks = output;
+}
+
+void passes_remark(const char *format, ...)
+{
+	if (!m_remarks)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	fprintf(m_remarks, "  ");
+	vfprintf(m_remarks, format, args);
+	fprintf(m_remarks, "\n");
+	va_end(args);
+}
@@ -0,0 +1,49 @@
+/**
+ * passes.h
+ * Pass manager of Koopa raw programs.
+ */
+
+#ifndef _PASSES_H_
+#define _PASSES_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hashtable.h"
+#include "koopa.h"
+
+#define OPT_LEVEL_MAX 2
+
+/* Use the default pipeline of given optimization level. */
+void passes_set_level(uint32_t level);
+
+/* Use passes in given comma-separated list, in order.
+ * @return false if some pass doesn't exist. */
+bool passes_set_pipeline(const char *list);
+
+/* @return whether the pipeline has module passes, which need the bodies of
+ * all functions. */
+bool passes_whole(void);
+
+/* Run the pipeline over `program`. Functions module passes have changed or
+ * removed go into `changed`, if set. */
+void passes_run(koopa_raw_program_t *program, htable_ptru32_t changed);
+
+/* Start a unit that's run one function at a time. Module passes are left
+ * out, as they need the whole program. */
+void passes_begin(void);
+/* Run the function passes of the pipeline over `function`, adding to the
+ * statistics of the unit. */
+void passes_run_function(koopa_raw_function_t function);
+
+/* Print wall time and instruction count change of each pass run. */
+void passes_report(FILE *output);
+
+/* Send remarks of passes on this thread to `output`, or drop them if it's
+ * NULL, which is the default. */
+void passes_set_remarks(FILE *output);
+/* Note something a pass has done to the unit, e.g. a symbol it removed. */
+void passes_remark(const char *format, ...);
+
+#endif//_PASSES_H_
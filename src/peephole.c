@@ -0,0 +1,329 @@
+#include <assert.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm.h"
+#include "macros.h"
+#include "peephole.h"
+
+#define SLOT_NONE INT32_MIN
+
+/* what's known about registers at the current instruction */
+struct state_t {
+	bool known[REG_COUNT];
+	int32_t value[REG_COUNT];
+	// stack slot whose content the register holds
+	int32_t slot[REG_COUNT];
+};
+
+/* state variables */
+static _Thread_local struct insn_t *m_insns;
+static _Thread_local uint32_t m_len;
+static _Thread_local struct state_t m_state;
+static bool m_enabled = true;
+
+/* tool functions */
+static bool is_caller_saved(int32_t reg)
+{
+	return reg == 1 || (reg >= 5 && reg <= 7) || (reg >= 10 && reg <= 17)
+	       || reg >= 28;
+}
+
+/* offset of `off(sp)`, or SLOT_NONE for other kinds of addresses */
+static int32_t stack_slot(const char *address)
+{
+	char *end;
+	long offset = strtol(address, &end, 10);
+	if (end == address || strcmp(end, "(sp)") != 0)
+		return SLOT_NONE;
+
+	return offset;
+}
+
+static void set_insn(struct insn_t *insn, const char *op, uint32_t argc, ...)
+{
+	va_list args;
+	va_start(args, argc);
+
+	/* operands may come from the instruction itself */
+	char *new_args[OPERAND_MAX];
+	for (uint32_t i = 0; i < argc; ++i)
+		new_args[i] = strdup(va_arg(args, const char *));
+	va_end(args);
+
+	free(insn->op);
+	for (uint32_t i = 0; i < insn->argc; ++i)
+		free(insn->args[i]);
+
+	insn->op = strdup(op);
+	insn->argc = argc;
+	memcpy(insn->args, new_args, sizeof(char *) * argc);
+}
+
+/* rules */
+// replace loads from a stack slot some register already holds
+static bool store_load(uint32_t i)
+{
+	struct insn_t *insn = &m_insns[i];
+	if (strcmp(insn->op, "lw") != 0)
+		return false;
+
+	int32_t slot = stack_slot(insn->args[1]);
+	if (slot == SLOT_NONE)
+		return false;
+
+	for (int32_t reg = 0; reg < REG_COUNT; ++reg)
+	{
+		if (m_state.slot[reg] != slot)
+			continue;
+
+		if (reg == asm_reg(insn->args[0]))
+			insn->dead = true;
+		else
+			set_insn(insn, "mv", 2, insn->args[0],
+				 asm_reg_name(reg));
+		return true;
+	}
+
+	return false;
+}
+
+// remove `li` of a constant the register already holds
+static bool redundant_li(uint32_t i)
+{
+	struct insn_t *insn = &m_insns[i];
+	if (strcmp(insn->op, "li") != 0)
+		return false;
+
+	int32_t reg = asm_reg(insn->args[0]);
+	if (reg == REG_NONE || !m_state.known[reg]
+	    || m_state.value[reg] != (int32_t)strtol(insn->args[1], NULL, 0))
+		return false;
+
+	insn->dead = true;
+	return true;
+}
+
+// remove `j` to a label that immediately follows
+static bool jump_next(uint32_t i)
+{
+	struct insn_t *insn = &m_insns[i];
+	if (strcmp(insn->op, "j") != 0)
+		return false;
+
+	for (uint32_t j = i + 1; j < m_len; ++j)
+	{
+		if (m_insns[j].dead)
+			continue;
+		if (m_insns[j].kind != INSN_LABEL)
+			return false;
+
+		if (strcmp(m_insns[j].op, insn->args[0]) == 0)
+		{
+			insn->dead = true;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// remove moves to self
+static bool self_move(uint32_t i)
+{
+	struct insn_t *insn = &m_insns[i];
+
+	bool mv = strcmp(insn->op, "mv") == 0
+		  && strcmp(insn->args[0], insn->args[1]) == 0;
+	bool addi = strcmp(insn->op, "addi") == 0
+		    && strcmp(insn->args[0], insn->args[1]) == 0
+		    && strcmp(insn->args[2], "0") == 0;
+	if (!mv && !addi)
+		return false;
+
+	insn->dead = true;
+	return true;
+}
+
+static struct {
+	const char *name;
+	bool (*apply)(uint32_t i);
+	bool disabled;
+	_Atomic uint32_t hits;
+} m_rules[] = {
+	{ .name = "self-move", .apply = self_move, },
+	{ .name = "store-load", .apply = store_load, },
+	{ .name = "redundant-li", .apply = redundant_li, },
+	{ .name = "jump-next", .apply = jump_next, },
+};
+
+#define RULE_COUNT (sizeof(m_rules) / sizeof(m_rules[0]))
+
+/* dataflow */
+static void forget_all(void)
+{
+	for (int32_t reg = 0; reg < REG_COUNT; ++reg)
+	{
+		m_state.known[reg] = false;
+		m_state.slot[reg] = SLOT_NONE;
+	}
+
+	m_state.known[0] = true;
+	m_state.value[0] = 0;
+}
+
+static void forget_slots(void)
+{
+	for (int32_t reg = 0; reg < REG_COUNT; ++reg)
+		m_state.slot[reg] = SLOT_NONE;
+}
+
+static void forget(int32_t reg)
+{
+	if (reg == 0)
+		return;
+
+	m_state.known[reg] = false;
+	m_state.slot[reg] = SLOT_NONE;
+}
+
+static void transfer(const struct insn_t *insn)
+{
+	if (insn->kind != INSN_OP)
+	{
+		/* join points, or something we don't understand */
+		forget_all();
+		return;
+	}
+
+	const char *op = insn->op;
+
+	/* no registers written */
+	if (op[0] == 'b' || strcmp(op, "j") == 0 || strcmp(op, "ret") == 0)
+		return;
+
+	if (strcmp(op, "call") == 0)
+	{
+		for (int32_t reg = 0; reg < REG_COUNT; ++reg)
+			if (is_caller_saved(reg))
+				forget(reg);
+		/* the callee owns the outgoing arguments */
+		forget_slots();
+		return;
+	}
+
+	if (strcmp(op, "sw") == 0)
+	{
+		int32_t slot = stack_slot(insn->args[1]);
+		int32_t src = asm_reg(insn->args[0]);
+
+		/* globals never alias the stack */
+		if (slot == SLOT_NONE)
+			return;
+
+		for (int32_t reg = 0; reg < REG_COUNT; ++reg)
+			if (m_state.slot[reg] == slot)
+				m_state.slot[reg] = SLOT_NONE;
+		if (src != REG_NONE)
+			m_state.slot[src] = slot;
+		return;
+	}
+
+	int32_t dest = insn->argc > 0 ? asm_reg(insn->args[0]) : REG_NONE;
+	if (dest == REG_NONE)
+	{
+		forget_all();
+		return;
+	}
+
+	/* the frame moves */
+	if (dest == 2)
+	{
+		forget_slots();
+		return;
+	}
+
+	if (strcmp(op, "li") == 0)
+	{
+		forget(dest);
+		m_state.known[dest] = true;
+		m_state.value[dest] = strtol(insn->args[1], NULL, 0);
+	}
+	else if (strcmp(op, "mv") == 0)
+	{
+		int32_t src = asm_reg(insn->args[1]);
+		forget(dest);
+		if (src != REG_NONE && dest != 0)
+		{
+			m_state.known[dest] = m_state.known[src];
+			m_state.value[dest] = m_state.value[src];
+			m_state.slot[dest] = m_state.slot[src];
+		}
+	}
+	else if (strcmp(op, "lw") == 0)
+	{
+		forget(dest);
+		if (dest != 0)
+			m_state.slot[dest] = stack_slot(insn->args[1]);
+	}
+	else
+		forget(dest);
+}
+
+/* public defn.s */
+void peephole(struct insn_t *insns, uint32_t len)
+{
+	m_insns = insns;
+	m_len = len;
+
+	forget_all();
+	for (uint32_t i = 0; i < m_len; ++i)
+	{
+		struct insn_t *insn = &m_insns[i];
+
+		for (uint32_t j = 0; m_enabled && j < RULE_COUNT; ++j)
+		{
+			if (insn->dead || insn->kind != INSN_OP)
+				break;
+			if (m_rules[j].disabled)
+				continue;
+
+			if (m_rules[j].apply(i))
+				++m_rules[j].hits;
+		}
+
+		if (!insn->dead)
+			transfer(insn);
+	}
+
+	m_insns = NULL;
+	m_len = 0;
+}
+
+void peephole_set_enabled(bool enabled)
+{
+	m_enabled = enabled;
+}
+
+bool peephole_disable(const char *name)
+{
+	for (uint32_t i = 0; i < RULE_COUNT; ++i)
+		if (strcmp(m_rules[i].name, name) == 0)
+		{
+			m_rules[i].disabled = true;
+			return true;
+		}
+
+	return false;
+}
+
+void peephole_report(FILE *output)
+{
+	fprintf(output, "peephole:\n");
+	for (uint32_t i = 0; i < RULE_COUNT; ++i)
+		fprintf(output, "  %-16s %8u%s\n", m_rules[i].name,
+			m_rules[i].hits,
+			m_rules[i].disabled ? " (disabled)" : "");
+}
@@ -0,0 +1,27 @@
+/**
+ * peephole.h
+ * Peephole optimizer over RISC-V assembly.
+ */
+
+#ifndef _PEEPHOLE_H_
+#define _PEEPHOLE_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "asm.h"
+
+/* Optimize assembly of one function. Removed lines are marked dead. */
+void peephole(struct insn_t *insns, uint32_t len);
+
+/* Turn the whole optimizer on or off. */
+void peephole_set_enabled(bool enabled);
+
+/* Disable rule of given name, for bisecting.
+ * @return false if there's no such rule. */
+bool peephole_disable(const char *name);
+
+/* Print number of times each rule has fired. */
+void peephole_report(FILE *output);
+
+#endif//_PEEPHOLE_H_
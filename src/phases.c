@@ -0,0 +1,259 @@
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "phases.h"
+
+#define ARENAS_MAX 64
+
+struct phase_t {
+	double wall;
+	double cpu;
+	size_t arena;
+	uint64_t mallocs;
+};
+
+/* what other threads working on behalf of one have used since it last
+ * switched phases */
+struct phases_lent_t {
+	_Atomic uint64_t cpu_ns;
+	_Atomic uint64_t mallocs;
+};
+
+/* options */
+static enum phases_report_e m_report;
+
+/* state variables */
+static _Thread_local struct phase_t m_phases[PHASE_COUNT];
+// PHASE_COUNT if none
+static _Thread_local enum phase_e m_current = PHASE_COUNT;
+static _Thread_local bump_t m_arenas[ARENAS_MAX];
+static _Thread_local uint32_t m_arenas_len;
+
+/* as of the last switch of phases */
+static _Thread_local double m_wall;
+static _Thread_local double m_cpu;
+static _Thread_local uint64_t m_mallocs_then;
+
+// heap allocations made by this thread
+static _Thread_local uint64_t m_mallocs;
+
+static _Thread_local struct phases_lent_t m_lent;
+
+static const char *const PHASE_NAMES[PHASE_COUNT] = {
+	"lexing", "parsing", "semantic", "irgen", "passes", "verify",
+	"codegen", "output",
+};
+
+/* heap allocations are sent through here by the linker, with
+ * `--wrap=malloc` and the like */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	++m_mallocs;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t num, size_t size)
+{
+	++m_mallocs;
+	return __real_calloc(num, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	++m_mallocs;
+	return __real_realloc(ptr, size);
+}
+
+/* tool functions */
+static double clock_of(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t arena_used(void)
+{
+	size_t used = 0;
+	for (uint32_t i = 0; i < m_arenas_len; ++i)
+		used += bump_used(m_arenas[i]);
+
+	return used;
+}
+
+/* everything since the last switch goes to the current phase */
+static void charge(void)
+{
+	double wall = clock_of(CLOCK_MONOTONIC);
+	double cpu = clock_of(CLOCK_THREAD_CPUTIME_ID);
+	uint64_t lent_cpu_ns = atomic_exchange(&m_lent.cpu_ns, 0);
+	uint64_t lent_mallocs = atomic_exchange(&m_lent.mallocs, 0);
+
+	if (m_current != PHASE_COUNT)
+	{
+		struct phase_t *phase = &m_phases[m_current];
+
+		phase->wall += wall - m_wall;
+		phase->cpu += cpu - m_cpu + lent_cpu_ns * 1e-9;
+		phase->mallocs += m_mallocs - m_mallocs_then + lent_mallocs;
+		size_t used = arena_used();
+		if (used > phase->arena)
+			phase->arena = used;
+	}
+
+	m_wall = wall;
+	m_cpu = cpu;
+	m_mallocs_then = m_mallocs;
+}
+
+static void print_string(FILE *output, const char *str)
+{
+	fputc('"', output);
+	for (; *str; ++str)
+		if (*str == '"' || *str == '\\')
+			fprintf(output, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(output, "\\u%04x", *str);
+		else
+			fputc(*str, output);
+	fputc('"', output);
+}
+
+static void report_text(FILE *output, const struct phase_t *total)
+{
+	fprintf(output, "phases:\n");
+	fprintf(output, "  %-16s %10s %10s %11s %8s\n", "phase", "wall (ms)",
+		"cpu (ms)", "arena (KiB)", "mallocs");
+
+	for (uint32_t i = 0; i < PHASE_COUNT; ++i)
+	{
+		const struct phase_t *phase = &m_phases[i];
+
+		fprintf(output, "  %-16s %10.3f %10.3f %11zu %8" PRIu64 "\n",
+			PHASE_NAMES[i], phase->wall * 1e3, phase->cpu * 1e3,
+			phase->arena / 1024, phase->mallocs);
+	}
+	fprintf(output, "  %-16s %10.3f %10.3f %11zu %8" PRIu64 "\n", "total",
+		total->wall * 1e3, total->cpu * 1e3, total->arena / 1024,
+		total->mallocs);
+}
+
+static void print_phase(FILE *output, const char *name,
+			const struct phase_t *phase)
+{
+	fprintf(output, "\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,"
+		"\"arena_bytes\":%zu,\"mallocs\":%" PRIu64 "}", name,
+		phase->wall * 1e3, phase->cpu * 1e3, phase->arena,
+		phase->mallocs);
+}
+
+static void report_json(FILE *output, const char *input,
+			const struct phase_t *total)
+{
+	fprintf(output, "{\"input\":");
+	print_string(output, input);
+	fprintf(output, ",\"phases\":{");
+	for (uint32_t i = 0; i < PHASE_COUNT; ++i)
+	{
+		print_phase(output, PHASE_NAMES[i], &m_phases[i]);
+		fputc(',', output);
+	}
+	print_phase(output, "total", total);
+	fprintf(output, "}}\n");
+}
+
+/* public defn.s */
+void phases_set_report(enum phases_report_e report)
+{
+	m_report = report;
+}
+
+enum phases_report_e phases_report_kind(void)
+{
+	return m_report;
+}
+
+void phases_begin(void)
+{
+	for (uint32_t i = 0; i < PHASE_COUNT; ++i)
+		m_phases[i] = (struct phase_t) {0};
+	m_current = PHASE_COUNT;
+	m_arenas_len = 0;
+}
+
+void phases_arena(bump_t bump)
+{
+	if (m_arenas_len < ARENAS_MAX)
+		m_arenas[m_arenas_len++] = bump;
+}
+
+void phases_enter(enum phase_e phase)
+{
+	if (m_report == PHASES_OFF)
+		return;
+
+	charge();
+	m_current = phase;
+}
+
+void phases_end(void)
+{
+	phases_enter(PHASE_COUNT);
+	// arenas may be gone by now
+	m_arenas_len = 0;
+}
+
+struct phases_lent_t *phases_lend(void)
+{
+	if (m_report == PHASES_OFF || m_current == PHASE_COUNT)
+		return NULL;
+
+	return &m_lent;
+}
+
+void phases_work_begin(struct phases_work_t *work,
+		       struct phases_lent_t *owner)
+{
+	*work = (struct phases_work_t) { .owner = owner, };
+	if (!owner)
+		return;
+
+	work->cpu = clock_of(CLOCK_THREAD_CPUTIME_ID);
+	work->mallocs = m_mallocs;
+}
+
+void phases_work_end(struct phases_work_t *work)
+{
+	if (!work->owner)
+		return;
+
+	double cpu = clock_of(CLOCK_THREAD_CPUTIME_ID) - work->cpu;
+	atomic_fetch_add(&work->owner->cpu_ns, (uint64_t)(cpu * 1e9));
+	atomic_fetch_add(&work->owner->mallocs, m_mallocs - work->mallocs);
+}
+
+void phases_report(FILE *output, const char *input)
+{
+	struct phase_t total = {0};
+	for (uint32_t i = 0; i < PHASE_COUNT; ++i)
+	{
+		total.wall += m_phases[i].wall;
+		total.cpu += m_phases[i].cpu;
+		total.mallocs += m_phases[i].mallocs;
+		if (m_phases[i].arena > total.arena)
+			total.arena = m_phases[i].arena;
+	}
+
+	if (m_report == PHASES_JSON)
+		report_json(output, input, &total);
+	else
+		report_text(output, &total);
+}
@@ -0,0 +1,68 @@
+/**
+ * phases.h
+ * Time and memory spent in each phase of compiling a unit.
+ */
+
+#ifndef _PHASES_H_
+#define _PHASES_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "bump.h"
+
+enum phase_e {
+	PHASE_LEXING,
+	PHASE_PARSING,
+	PHASE_SEMANTIC,
+	PHASE_IR,
+	PHASE_PASSES,
+	PHASE_VERIFY,
+	PHASE_CODEGEN,
+	PHASE_OUTPUT,
+	PHASE_COUNT,
+};
+
+enum phases_report_e {
+	PHASES_OFF,
+	PHASES_TEXT,
+	// one JSON object per line and unit
+	PHASES_JSON,
+};
+
+/* Nothing is measured unless reports are on. */
+void phases_set_report(enum phases_report_e report);
+enum phases_report_e phases_report_kind(void);
+
+/* Start measuring a unit in the calling thread. Time spent outside of any
+ * phase isn't counted. */
+void phases_begin(void);
+/* Count bytes in use in `bump` as well, for the rest of the unit. */
+void phases_arena(bump_t bump);
+/* Charge whatever comes next to `phase`, until another one is entered. */
+void phases_enter(enum phase_e phase);
+/* Stop measuring, before any arena given is deleted. */
+void phases_end(void);
+
+/* Work handed out to other threads, such as those of `pool_run()`, is
+ * charged to the phase the thread handing it out is in. It takes a handle
+ * by `phases_lend()`, NULL if it isn't measuring anything, and the threads
+ * working on its behalf bracket their share by `phases_work_begin()` and
+ * `phases_work_end()`. */
+struct phases_lent_t;
+struct phases_work_t {
+	struct phases_lent_t *owner;
+	double cpu;
+	uint64_t mallocs;
+};
+
+struct phases_lent_t *phases_lend(void);
+void phases_work_begin(struct phases_work_t *work,
+		       struct phases_lent_t *owner);
+void phases_work_end(struct phases_work_t *work);
+
+/* Print wall and CPU time, peak arena usage and heap allocations of each
+ * phase of the last unit measured in the calling thread. */
+void phases_report(FILE *output, const char *input);
+
+#endif//_PHASES_H_
@@ -0,0 +1,149 @@
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "phases.h"
+#include "pool.h"
+
+/* items of a worker are `first`, `first + jobs`, ..., and it's got the
+ * ones from `head` up to `tail` left, counted in those steps. both ends are
+ * packed in a word, so that the worker taking from the head and others
+ * stealing from the tail never take the same one */
+struct deque_t {
+	alignas(64) _Atomic uint64_t ends;
+	uint32_t first;
+};
+
+#define pack(head, tail) ((uint64_t)(head) << 32 | (tail))
+#define head_of(ends) ((uint32_t)((ends) >> 32))
+#define tail_of(ends) ((uint32_t)(ends))
+
+struct pool_t {
+	uint32_t jobs;
+	void (*work)(void *arg, uint32_t i);
+	void *arg;
+	struct deque_t *deques;
+	// hands out indices of workers to the spawned threads
+	_Atomic uint32_t next;
+	// what the caller is measuring, for the spawned threads to add to
+	struct phases_lent_t *owner;
+};
+
+/* state variables */
+// index of the worker of the innermost pool this thread is in
+static _Thread_local uint32_t m_worker;
+
+/* tool functions */
+static bool take(struct pool_t *pool, uint32_t w, uint32_t *i)
+{
+	struct deque_t *deque = &pool->deques[w];
+
+	uint64_t ends = deque->ends;
+	do
+		if (head_of(ends) == tail_of(ends))
+			return false;
+	while (!atomic_compare_exchange_weak(&deque->ends, &ends,
+		pack(head_of(ends) + 1, tail_of(ends))));
+
+	*i = deque->first + head_of(ends) * pool->jobs;
+	return true;
+}
+
+static bool steal(struct pool_t *pool, uint32_t w, uint32_t *i)
+{
+	struct deque_t *deque = &pool->deques[w];
+
+	uint64_t ends = deque->ends;
+	do
+		if (head_of(ends) == tail_of(ends))
+			return false;
+	while (!atomic_compare_exchange_weak(&deque->ends, &ends,
+		pack(head_of(ends), tail_of(ends) - 1)));
+
+	*i = deque->first + (tail_of(ends) - 1) * pool->jobs;
+	return true;
+}
+
+static void run(struct pool_t *pool, uint32_t w)
+{
+	uint32_t outer = m_worker;
+	m_worker = w;
+
+	/* its own items first, then the smallest ones of the others */
+	uint32_t i;
+	while (take(pool, w, &i))
+		pool->work(pool->arg, i);
+	for (uint32_t v = w + 1; v % pool->jobs != w; ++v)
+		while (steal(pool, v % pool->jobs, &i))
+			pool->work(pool->arg, i);
+
+	m_worker = outer;
+}
+
+static void *worker(void *arg)
+{
+	struct pool_t *pool = arg;
+
+	struct phases_work_t work;
+	phases_work_begin(&work, pool->owner);
+	run(pool, pool->next++);
+	phases_work_end(&work);
+	return NULL;
+}
+
+/* public defn.s */
+void pool_run(uint32_t len, uint32_t jobs,
+	      void (*work)(void *arg, uint32_t i), void *arg)
+{
+	if (jobs > len)
+		jobs = len;
+	if (jobs == 0)
+		return;
+
+	struct pool_t pool = {
+		.jobs = jobs,
+		.work = work,
+		.arg = arg,
+		.deques = aligned_alloc(alignof(struct deque_t),
+					sizeof(struct deque_t) * jobs),
+		.next = 1,
+		.owner = phases_lend(),
+	};
+	/* dealt out like cards, so that everyone gets some of the big ones */
+	for (uint32_t w = 0; w < jobs; ++w)
+	{
+		pool.deques[w].first = w;
+		pool.deques[w].ends = pack(0, (len - w + jobs - 1) / jobs);
+	}
+
+	/* the calling thread is worker 0, so failing to spawn some of the
+	 * others only slows things down: their items get stolen */
+	pthread_t *threads = malloc(sizeof(pthread_t) * jobs);
+	uint32_t spawned = 0;
+	for (uint32_t i = 1; i < jobs; ++i)
+		if (pthread_create(&threads[spawned], NULL, worker,
+				   &pool) == 0)
+			++spawned;
+
+	run(&pool, 0);
+
+	for (uint32_t i = 0; i < spawned; ++i)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	free(pool.deques);
+}
+
+uint32_t pool_worker(void)
+{
+	return m_worker;
+}
+
+uint32_t pool_default_jobs(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? n : 1;
+}
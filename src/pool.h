@@ -0,0 +1,27 @@
+/**
+ * pool.h
+ * Running independent work items on a pool of threads.
+ */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stdint.h>
+
+/* Call `work(arg, i)` for every `i` below `len` on at most `jobs` threads,
+ * the calling one included, and wait for all of them. Items are dealt out
+ * to the threads in turn, each of which goes through its own in increasing
+ * order, then steals the last ones left to others. Put the biggest ones
+ * first. */
+void pool_run(uint32_t len, uint32_t jobs,
+	      void (*work)(void *arg, uint32_t i), void *arg);
+
+/* @return index of the thread calling it among those of the innermost
+ * `pool_run()` it's in, below `jobs`; 0 for the calling thread of it, or
+ * outside of any. */
+uint32_t pool_worker(void);
+
+/* Number of online processors. */
+uint32_t pool_default_jobs(void);
+
+#endif//_POOL_H_
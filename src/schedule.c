@@ -0,0 +1,430 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+#include "schedule.h"
+
+// longer blocks are scheduled in pieces
+#define WINDOW 256
+#define NONE UINT32_MAX
+
+/* cycles until the result can be used */
+struct target_t {
+	const char *name;
+	int32_t load;
+	int32_t mul;
+	int32_t div;
+};
+
+/* rough numbers; only their relative sizes matter much */
+static const struct target_t TARGETS[] = {
+	{ .name = "generic", .load = 3, .mul = 3, .div = 20, },
+	{ .name = "rocket", .load = 3, .mul = 4, .div = 33, },
+	{ .name = "sifive-e31", .load = 2, .mul = 3, .div = 33, },
+	{ .name = "sifive-u74", .load = 3, .mul = 3, .div = 36, },
+};
+
+#define TARGET_COUNT (sizeof(TARGETS) / sizeof(TARGETS[0]))
+
+/* what an instruction does, as far as ordering is concerned */
+struct node_t {
+	struct insn_t insn;
+	enum {
+		NODE_ALU,
+		NODE_LOAD,
+		NODE_STORE,
+		NODE_MUL,
+		NODE_DIV,
+	} kind;
+	int32_t def;
+	int32_t uses[OPERAND_MAX];
+	// memory operand of loads & stores
+	int32_t base;
+	int32_t offset;
+
+	// longest latency path to the end of the block
+	int32_t height;
+	int32_t earliest;
+	uint32_t preds;
+	// first edge to those depending on it
+	uint32_t succs;
+	bool done;
+};
+
+/* `to` can't issue until `latency` cycles after the node it's out of */
+struct edge_t {
+	uint32_t to;
+	int32_t latency;
+	uint32_t next;
+};
+
+/* a reader of a register since it was last written */
+struct reader_t {
+	uint32_t node;
+	uint32_t next;
+};
+
+/* dependencies within a window. each node only gets edges from the nearest
+ * ones it depends on, as the rest are ordered before those already */
+struct graph_t {
+	struct node_t nodes[WINDOW];
+	uint32_t len;
+
+	struct edge_t *edges;
+	uint32_t edges_len;
+	uint32_t edges_cap;
+
+	/* registers */
+	uint32_t defs[REG_COUNT];
+	uint32_t readers[REG_COUNT];
+	struct reader_t reader_pool[WINDOW * OPERAND_MAX];
+	uint32_t readers_len;
+
+	// loads & stores in order
+	uint32_t mems[WINDOW];
+	uint32_t mems_len;
+};
+
+/* state variables */
+static const struct target_t *m_target = &TARGETS[0];
+static bool m_enabled = true;
+
+/* tool functions */
+static bool is_one_of(const char *op, const char *const *ops)
+{
+	for (; *ops; ++ops)
+		if (strcmp(op, *ops) == 0)
+			return true;
+
+	return false;
+}
+
+/* control flow, or something we don't understand */
+static bool is_barrier(const struct insn_t *insn)
+{
+	static const char *const OPS[] = {
+		"j", "jr", "jal", "jalr", "ret", "call", "tail", "ecall",
+		"ebreak", "fence", NULL,
+	};
+
+	if (insn->kind != INSN_OP)
+		return true;
+
+	return insn->argc == 0 || insn->op[0] == 'b'
+	       || is_one_of(insn->op, OPS);
+}
+
+static void classify(struct node_t *node)
+{
+	static const char *const LOADS[] = {
+		"lw", "lh", "lhu", "lb", "lbu", NULL,
+	};
+	static const char *const STORES[] = { "sw", "sh", "sb", NULL, };
+	static const char *const MULS[] = {
+		"mul", "mulh", "mulhu", "mulhsu", NULL,
+	};
+	static const char *const DIVS[] = {
+		"div", "divu", "rem", "remu", NULL,
+	};
+
+	const struct insn_t *insn = &node->insn;
+
+	node->kind = NODE_ALU;
+	node->def = REG_NONE;
+	for (uint32_t i = 0; i < OPERAND_MAX; ++i)
+		node->uses[i] = REG_NONE;
+	node->base = REG_NONE;
+
+	if (is_one_of(insn->op, STORES))
+	{
+		node->kind = NODE_STORE;
+		node->uses[0] = asm_reg(insn->args[0]);
+		node->uses[1] = node->base = asm_base(insn->args[1]);
+		node->offset = strtol(insn->args[1], NULL, 10);
+		return;
+	}
+
+	if (is_one_of(insn->op, LOADS))
+	{
+		node->kind = NODE_LOAD;
+		node->uses[1] = node->base = asm_base(insn->args[1]);
+		node->offset = strtol(insn->args[1], NULL, 10);
+	}
+	else
+	{
+		if (is_one_of(insn->op, MULS))
+			node->kind = NODE_MUL;
+		else if (is_one_of(insn->op, DIVS))
+			node->kind = NODE_DIV;
+
+		for (uint32_t i = 1; i < insn->argc; ++i)
+			node->uses[i] = asm_reg(insn->args[i]);
+	}
+
+	/* writes to `zero` go nowhere */
+	node->def = asm_reg(insn->args[0]);
+	if (node->def == 0)
+		node->def = REG_NONE;
+}
+
+static int32_t result_latency(const struct node_t *node)
+{
+	switch (node->kind)
+	{
+	case NODE_LOAD:
+		return m_target->load;
+	case NODE_MUL:
+		return m_target->mul;
+	case NODE_DIV:
+		return m_target->div;
+	default:
+		return 1;
+	}
+}
+
+static bool may_alias(const struct node_t *a, const struct node_t *b)
+{
+	/* distinct slots of the same frame */
+	if (a->base == 2 && b->base == 2)
+		return a->offset == b->offset;
+
+	return true;
+}
+
+static bool is_mem(const struct node_t *node)
+{
+	return node->kind == NODE_LOAD || node->kind == NODE_STORE;
+}
+
+static void add_edge(struct graph_t *graph, uint32_t from, uint32_t to,
+		     int32_t latency)
+{
+	if (graph->edges_len == graph->edges_cap)
+	{
+		graph->edges_cap *= 2;
+		graph->edges = realloc(graph->edges, sizeof(struct edge_t)
+						     * graph->edges_cap);
+	}
+
+	graph->edges[graph->edges_len] = (struct edge_t) {
+		.to = to,
+		.latency = latency,
+		.next = graph->nodes[from].succs,
+	};
+	graph->nodes[from].succs = graph->edges_len++;
+	++graph->nodes[to].preds;
+}
+
+/* a write is ordered after the last write and the reads since, and a read
+ * after the last write */
+static void add_reg_edges(struct graph_t *graph, uint32_t i)
+{
+	struct node_t *node = &graph->nodes[i];
+
+	for (uint32_t k = 0; k < OPERAND_MAX; ++k)
+	{
+		int32_t reg = node->uses[k];
+		if (reg == REG_NONE || graph->defs[reg] == NONE)
+			continue;
+
+		uint32_t writer = graph->defs[reg];
+		add_edge(graph, writer, i,
+			 result_latency(&graph->nodes[writer]));
+	}
+
+	int32_t def = node->def;
+	if (def != REG_NONE)
+	{
+		for (uint32_t r = graph->readers[def]; r != NONE;
+		     r = graph->reader_pool[r].next)
+			add_edge(graph, graph->reader_pool[r].node, i, 0);
+		if (graph->defs[def] != NONE)
+			add_edge(graph, graph->defs[def], i, 1);
+	}
+
+	for (uint32_t k = 0; k < OPERAND_MAX; ++k)
+	{
+		int32_t reg = node->uses[k];
+		if (reg == REG_NONE)
+			continue;
+
+		graph->reader_pool[graph->readers_len] = (struct reader_t) {
+			.node = i,
+			.next = graph->readers[reg],
+		};
+		graph->readers[reg] = graph->readers_len++;
+	}
+
+	if (def != REG_NONE)
+	{
+		graph->defs[def] = i;
+		graph->readers[def] = NONE;
+	}
+}
+
+/* a store is ordered after everything it may alias, and a load after the
+ * stores. looking back stops at a store that aliases at least as much, as
+ * all before it are ordered before that one */
+static void add_mem_edges(struct graph_t *graph, uint32_t i)
+{
+	const struct node_t *node = &graph->nodes[i];
+	if (!is_mem(node))
+		return;
+
+	for (uint32_t k = graph->mems_len; k-- > 0; )
+	{
+		uint32_t j = graph->mems[k];
+		const struct node_t *prev = &graph->nodes[j];
+		bool prev_store = prev->kind == NODE_STORE;
+
+		if ((!prev_store && node->kind != NODE_STORE)
+		    || !may_alias(prev, node))
+			continue;
+
+		add_edge(graph, j, i, prev_store ? 1 : 0);
+		if (prev_store && (prev->base != 2 || node->base == 2))
+			break;
+	}
+
+	graph->mems[graph->mems_len++] = i;
+}
+
+/* list scheduling */
+static void build(struct graph_t *graph)
+{
+	graph->edges_len = 0;
+	graph->readers_len = 0;
+	graph->mems_len = 0;
+	for (uint32_t r = 0; r < REG_COUNT; ++r)
+	{
+		graph->defs[r] = NONE;
+		graph->readers[r] = NONE;
+	}
+
+	for (uint32_t i = 0; i < graph->len; ++i)
+	{
+		struct node_t *node = &graph->nodes[i];
+
+		node->preds = 0;
+		node->earliest = 0;
+		node->succs = NONE;
+		node->done = false;
+		add_reg_edges(graph, i);
+		add_mem_edges(graph, i);
+	}
+
+	for (uint32_t i = graph->len; i-- > 0; )
+	{
+		struct node_t *node = &graph->nodes[i];
+
+		node->height = result_latency(node);
+		for (uint32_t e = node->succs; e != NONE;
+		     e = graph->edges[e].next)
+			node->height = max(node->height,
+					   graph->edges[e].latency
+					   + graph->nodes[graph->edges[e].to]
+						 .height);
+	}
+}
+
+/* is `a` a better pick than `b` at `cycle`? */
+static bool better(const struct node_t *a, const struct node_t *b,
+		   int32_t cycle)
+{
+	int32_t a_issue = max(a->earliest, cycle);
+	int32_t b_issue = max(b->earliest, cycle);
+
+	if (a_issue != b_issue)
+		return a_issue < b_issue;
+	return a->height > b->height;
+}
+
+static void schedule_window(struct graph_t *graph, struct insn_t *insns,
+			    const uint32_t *indices)
+{
+	build(graph);
+
+	struct node_t *nodes = graph->nodes;
+	int32_t cycle = 0;
+	for (uint32_t n = 0; n < graph->len; ++n)
+	{
+		// earlier in the original order wins ties
+		uint32_t pick = NONE;
+		for (uint32_t i = 0; i < graph->len; ++i)
+			if (!nodes[i].done && nodes[i].preds == 0
+			    && (pick == NONE
+				|| better(&nodes[i], &nodes[pick], cycle)))
+				pick = i;
+		assert(pick != NONE);
+
+		struct node_t *node = &nodes[pick];
+		int32_t issue = max(node->earliest, cycle);
+		node->done = true;
+		insns[indices[n]] = node->insn;
+
+		for (uint32_t e = node->succs; e != NONE;
+		     e = graph->edges[e].next)
+		{
+			const struct edge_t *edge = &graph->edges[e];
+
+			nodes[edge->to].earliest = max(nodes[edge->to].earliest,
+						       issue + edge->latency);
+			--nodes[edge->to].preds;
+		}
+		cycle = issue + 1;
+	}
+}
+
+/* public defn.s */
+void schedule(struct insn_t *insns, uint32_t len)
+{
+	if (!m_enabled)
+		return;
+
+	struct graph_t *graph = malloc(sizeof(struct graph_t));
+	graph->len = 0;
+	graph->edges_cap = WINDOW * 4;
+	graph->edges = malloc(sizeof(struct edge_t) * graph->edges_cap);
+
+	uint32_t indices[WINDOW];
+	for (uint32_t i = 0; i <= len; ++i)
+	{
+		bool end = i == len || is_barrier(&insns[i]);
+		if (i < len && !end && !insns[i].dead)
+		{
+			indices[graph->len] = i;
+			graph->nodes[graph->len].insn = insns[i];
+			classify(&graph->nodes[graph->len]);
+			++graph->len;
+		}
+
+		if (end || graph->len == WINDOW)
+		{
+			schedule_window(graph, insns, indices);
+			graph->len = 0;
+		}
+	}
+
+	free(graph->edges);
+	free(graph);
+}
+
+void schedule_set_enabled(bool enabled)
+{
+	m_enabled = enabled;
+}
+
+bool schedule_set_target(const char *core)
+{
+	for (uint32_t i = 0; i < TARGET_COUNT; ++i)
+		if (strcmp(TARGETS[i].name, core) == 0)
+		{
+			m_target = &TARGETS[i];
+			return true;
+		}
+
+	return false;
+}
@@ -0,0 +1,25 @@
+/**
+ * schedule.h
+ * Instruction scheduler for in-order pipelines.
+ */
+
+#ifndef _SCHEDULE_H_
+#define _SCHEDULE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "asm.h"
+
+/* Reorder instructions of one function within each basic block to hide
+ * latencies of loads, multiplications and divisions. */
+void schedule(struct insn_t *insns, uint32_t len);
+
+/* Turn the scheduler on or off. */
+void schedule_set_enabled(bool enabled);
+
+/* Select the latency model of given core.
+ * @return false if there's no such core. */
+bool schedule_set_target(const char *core);
+
+#endif//_SCHEDULE_H_
@@ -5,7 +5,7 @@
 #include <stdio.h>
 #include <string.h>
 
-#include "globals.h"
+#include "context.h"
 #include "hashtable.h"
 #include "semantic.h"
 #include "symbols.h"
@@ -22,144 +22,356 @@ struct option_t {
 };
 
 /* state variables */
-static bool m_constexpr;
-static bool m_while;
-static const struct node_t *m_this_node;
+// scratch of the call in progress, see context.h
+static _Thread_local bool m_constexpr;
+static _Thread_local bool m_while;
+static _Thread_local const struct node_t *m_this_node;
+
+static const char *const TAG_NAMES[] = {
+	"constant", "variable", "function",
+};
 
 /* thrower */
-static void error(const char *fmt, ...)
+static void error(struct context_t *ctx, const char *fmt, ...)
 {
-	fprintf(stderr, "Line %d: ", m_this_node->data.lineno);
+	fprintf(ctx->errors, "Line %d: ", m_this_node->data.lineno);
 
 	va_list args;
 	va_start(args, fmt);
-	vfprintf(stderr, fmt, args);
+	vfprintf(ctx->errors, fmt, args);
 	va_end(args);
 
-	fprintf(stderr, "\n");
+	fprintf(ctx->errors, "\n");
 
-	longjmp(g_exception_env, 3);
+	longjmp(ctx->env, 3);
 }
 
 /* accessor decl.s */
-static void CompUnit(const struct node_t *node);
-static void FuncDef(const struct node_t *node);
-static enum symbol_type_e Type(const struct node_t *node);
-static void Block(const struct node_t *node);
-static void Stmt(const struct node_t *node);
-static int32_t Number(const struct node_t *node);
-
-static int32_t Exp(const struct node_t *node);
-static int32_t UnaryExp(const struct node_t *node);
-static int32_t PrimaryExp(const struct node_t *node);
-
-static void Decl(const struct node_t *node);
-static void ConstDecl(const struct node_t *node);
-static void ConstDef(const struct node_t *node);
-static int32_t ConstInitVal(const struct node_t *node);
-static void VarDecl(const struct node_t *node);
-static void VarDef(const struct node_t *node);
-#if 0
-/* will be evaluated later in IR generation phase */
-static int32_t InitVal(const struct node_t *node);
-#endif
-static void BlockItem(const struct node_t *node);
-static char *LVal(const struct node_t *node);
-static int32_t ConstExp(const struct node_t *node);
-static void ConstDefList(const struct node_t *node);
-static void VarDefList(const struct node_t *node);
-static void BlockItemList(const struct node_t *node);
-
-static struct vector_typ_t *FuncFParamList(const struct node_t *node);
-static enum symbol_type_e FuncFParam(const struct node_t *node);
-static void FuncRParamList(const struct node_t *node);
-static void FuncRParam(const struct node_t *node);
-static void GlobalList(const struct node_t *node);
-static void Global(const struct node_t *node);
+static void CompUnit(struct context_t *ctx, const struct node_t *node);
+static void FuncDef(struct context_t *ctx, const struct node_t *node);
+static enum symbol_type_e Type(struct context_t *ctx,
+			       const struct node_t *node);
+static void Block(struct context_t *ctx, const struct node_t *node);
+static void Stmt(struct context_t *ctx, const struct node_t *node);
+static int32_t Number(struct context_t *ctx, const struct node_t *node);
+
+static struct option_t Exp(struct context_t *ctx, const struct node_t *node);
+static struct option_t UnaryExp(struct context_t *ctx,
+				const struct node_t *node);
+static struct option_t PrimaryExp(struct context_t *ctx,
+				  const struct node_t *node);
+
+static void Decl(struct context_t *ctx, const struct node_t *node);
+static void ConstDecl(struct context_t *ctx, const struct node_t *node);
+static void ConstDef(struct context_t *ctx, const struct node_t *node);
+static int32_t ConstInitVal(struct context_t *ctx, const struct node_t *node);
+static void VarDecl(struct context_t *ctx, const struct node_t *node);
+static void VarDef(struct context_t *ctx, const struct node_t *node);
+static void InitVal(struct context_t *ctx, const struct node_t *node);
+static void BlockItem(struct context_t *ctx, const struct node_t *node);
+static char *LVal(struct context_t *ctx, const struct node_t *node);
+static int32_t ConstExp(struct context_t *ctx, const struct node_t *node);
+static void ConstDefList(struct context_t *ctx, const struct node_t *node);
+static void VarDefList(struct context_t *ctx, const struct node_t *node);
+static void BlockItemList(struct context_t *ctx, const struct node_t *node);
+
+static struct vector_typ_t *FuncFParamList(struct context_t *ctx,
+					   const struct node_t *node);
+static enum symbol_type_e FuncFParam(struct context_t *ctx,
+				     const struct node_t *node);
+static void FuncRParamList(struct context_t *ctx, const struct node_t *node);
+static void FuncRParam(struct context_t *ctx, const struct node_t *node);
+static void GlobalList(struct context_t *ctx, const struct node_t *node);
+static void Global(struct context_t *ctx, const struct node_t *node);
 
 /* tool functions */
-static void init_lib(void)
+static void init_lib(struct context_t *ctx)
 {
-	symbols_add(g_symbols, "getint", symbol_function(NULL, INT));
-	symbols_add(g_symbols, "getch", symbol_function(NULL, INT));
-	symbols_add(g_symbols, "getarray",
+	symbols_add(ctx->symbols, "getint", symbol_function(NULL, INT));
+	symbols_add(ctx->symbols, "getch", symbol_function(NULL, INT));
+	symbols_add(ctx->symbols, "getarray",
 		    symbol_function(vector_typ_init(1, POINTER), INT));
-	symbols_add(g_symbols, "putint",
+	symbols_add(ctx->symbols, "putint",
 		    symbol_function(vector_typ_init(1, INT), VOID));
-	symbols_add(g_symbols, "putch",
+	symbols_add(ctx->symbols, "putch",
 		    symbol_function(vector_typ_init(1, INT), VOID));
-	symbols_add(g_symbols, "putarray",
+	symbols_add(ctx->symbols, "putarray",
 		    symbol_function(vector_typ_init(2, INT, POINTER), VOID));
-	symbols_add(g_symbols, "starttime", symbol_function(NULL, VOID));
-	symbols_add(g_symbols, "stoptime", symbol_function(NULL, VOID));
+	symbols_add(ctx->symbols, "starttime", symbol_function(NULL, VOID));
+	symbols_add(ctx->symbols, "stoptime", symbol_function(NULL, VOID));
 
 #if 1
-	symbols_add(g_symbols, "usleep",
+	symbols_add(ctx->symbols, "usleep",
 		    symbol_function(vector_typ_init(1, INT), VOID));
 #endif
 }
 
+static struct option_t some(int32_t value)
+{
+	return (struct option_t) { .tag = SOME, .value = value };
+}
+
+static struct option_t none(void)
+{
+	return (struct option_t) { .tag = NONE };
+}
+
+/* arithmetic wraps around, just as it does on the target */
+static struct option_t wrap(uint32_t value)
+{
+	return some((int32_t)value);
+}
+
+/* every expression is only ever evaluated in a single context, so the first
+ * result holds for good */
+static struct option_t cache(const struct node_t *node, struct option_t value)
+{
+	struct node_data_t *data = &((struct node_t *)node)->data;
+	data->fold = value.tag == SOME ? FOLD_CONSTANT : FOLD_VARIABLE;
+	data->folded = value.value;
+
+	return value;
+}
+
+static struct option_t cached(const struct node_t *node)
+{
+	return node->data.fold == FOLD_CONSTANT ? some(node->data.folded)
+						: none();
+}
+
+/* the same goes for what a name refers to, so that IR generation doesn't
+ * have to look it up again in the right scope. when fused, locals are gone
+ * with their scopes, so only globals are kept */
+static struct symbol_t *resolve(struct context_t *ctx,
+				const struct node_t *node,
+				struct symbol_t *symbol)
+{
+	if (!ctx->fused || symbol->meta.level == 0)
+		((struct node_t *)node)->data.symbol = symbol;
+
+	return symbol;
+}
+
+static struct option_t binary(struct context_t *ctx, const struct node_t *op,
+			      struct option_t lhs,
+			      struct option_t rhs)
+{
+	const char *op_token = op->data.value.s;
+	int32_t l = lhs.value, r = rhs.value;
+
+	/* logical operators are kinda naughty: a side that is never evaluated
+	 * doesn't have to be constant */
+	switch (op->data.kind)
+	{
+	case AST_LOR:
+		if (lhs.tag == SOME && l)
+			return some(1);
+		return lhs.tag == SOME && rhs.tag == SOME ? some(r != 0)
+							  : none();
+	case AST_LAND:
+		if (lhs.tag == SOME && !l)
+			return some(0);
+		return lhs.tag == SOME && rhs.tag == SOME ? some(r != 0)
+							  : none();
+	default:
+		/* fallthrough */;
+	}
+
+	if (lhs.tag == NONE || rhs.tag == NONE)
+		return none();
+
+	switch (op->data.kind)
+	{
+	case AST_EQOP:
+		if (strcmp(op_token, "!=") == 0)
+			return some(l != r);
+		if (strcmp(op_token, "==") == 0)
+			return some(l == r);
+		panic("unknown equity operator");
+	case AST_RELOP:
+		if (strcmp(op_token, ">") == 0)
+			return some(l > r);
+		if (strcmp(op_token, "<") == 0)
+			return some(l < r);
+		if (strcmp(op_token, ">=") == 0)
+			return some(l >= r);
+		if (strcmp(op_token, "<=") == 0)
+			return some(l <= r);
+		panic("unknown relational operator");
+	case AST_SHOP:
+		/* only the low 5 bits of the amount count */
+		if (strcmp(op_token, ">>") == 0)
+			return some(l >> (r & 31));
+		if (strcmp(op_token, "<<") == 0)
+			return wrap((uint32_t)l << (r & 31));
+		panic("unknown shift operator");
+	case AST_ADDOP:
+		if (strcmp(op_token, "+") == 0)
+			return wrap((uint32_t)l + r);
+		if (strcmp(op_token, "-") == 0)
+			return wrap((uint32_t)l - r);
+		panic("unknown additive operator");
+	case AST_MULOP:
+		if (strcmp(op_token, "*") == 0)
+			return wrap((uint32_t)l * r);
+		/* left to the target to do whatever it does */
+		if (r == 0)
+		{
+			if (m_constexpr)
+				error(ctx, "Division by zero in constant "
+				      "expression");
+			return none();
+		}
+		/* the only quotient that overflows */
+		if (l == INT32_MIN && r == -1)
+			return some(strcmp(op_token, "/") == 0 ? INT32_MIN : 0);
+		if (strcmp(op_token, "/") == 0)
+			return some(l / r);
+		if (strcmp(op_token, "%") == 0)
+			return some(l % r);
+		panic("unknown multiplicative operator");
+	default:
+		todo();
+	}
+}
+
+/* anything that isn't constant is reported on the way */
+static int32_t constant(struct context_t *ctx, const struct node_t *node)
+{
+	bool this_constexpr = m_constexpr;
+	// "push"
+	m_constexpr = true;
+	struct option_t ret = Exp(ctx, node);
+	// "pop"
+	m_constexpr = this_constexpr;
+
+	assert(ret.tag == SOME);
+	return ret.value;
+}
+
+static struct symbol_t *define(struct context_t *ctx, const struct node_t *node,
+			       char *ident,
+			       struct symbol_t symbol)
+{
+	m_this_node = node;
+
+	struct symbol_t *it;
+	struct view_t view = symbols_lookup(ctx->symbols, ident);
+	while ((it = view.next(&view)))
+		if (symbols_here(ctx->symbols, it))
+			error(ctx, "Redefinition of %s: `%s`",
+			      TAG_NAMES[symbol.tag], ident);
+
+	return resolve(ctx, node, symbols_add(ctx->symbols, ident, symbol));
+}
+
+static struct symbol_t *lookup_value(struct context_t *ctx,
+				     const struct node_t *node, char *ident)
+{
+	m_this_node = node;
+
+	struct symbol_t *symbol = symbols_get(ctx->symbols, ident);
+	if (!symbol)
+		error(ctx, "Undefined symbol: `%s`", ident);
+	if (symbol->tag == FUNCTION)
+		error(ctx, "Function as variable is not supported: `%s`",
+		      ident);
+
+	return resolve(ctx, node, symbol);
+}
+
+static struct symbol_t *lookup_variable(struct context_t *ctx,
+					const struct node_t *node,
+					char *ident)
+{
+	m_this_node = node;
+
+	struct symbol_t *symbol = symbols_get(ctx->symbols, ident);
+	if (!symbol)
+		error(ctx, "Undefined symbol: `%s`", ident);
+	if (symbol->tag != VARIABLE)
+		error(ctx, "Assignee must be a variable: `%s`", ident);
+
+	return resolve(ctx, node, symbol);
+}
+
+static struct symbol_t *lookup_function(struct context_t *ctx,
+					const struct node_t *node,
+					char *ident)
+{
+	m_this_node = node;
+
+	struct symbol_t *symbol = symbols_get(ctx->symbols, ident);
+	if (!symbol)
+		error(ctx, "Undefined function: `%s`", ident);
+
+	return resolve(ctx, node, symbol);
+}
+
+static void jump(struct context_t *ctx, const struct node_t *node,
+		 bool in_while)
+{
+	m_this_node = node;
+
+	if (!in_while)
+		error(ctx, "`break` and `continue` statements are only allowe"
+		      "d in body of `while`");
+}
+
 /* accessor defn.s */
-static void CompUnit(const struct node_t *node)
+static void CompUnit(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_CompUnit);
 	m_this_node = node;
 
-	init_lib();
-
-	GlobalList(node->children[0]);
+	GlobalList(ctx, node->children[0]);
 }
 
-static void FuncDef(const struct node_t *node)
+static void FuncDef(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_FuncDef);
 	m_this_node = node;
 
 	char *name = node->children[1]->data.value.s;
 
-	struct symbol_t *it;
-	struct view_t view = symbols_lookup(g_symbols, name);
-	while ((it = view.next(&view)))
-		if (symbols_here(g_symbols, it))
-			error("Redefinition of function: `%s`", name);
-
-	enum symbol_type_e type = Type(node->children[0]);
-	struct symbol_t *symbol = symbols_add(g_symbols, name,
-					      symbol_function(0, type));
-	symbols_indent(g_symbols);
+	enum symbol_type_e type = Type(ctx, node->children[0]);
+	struct symbol_t *symbol = define(ctx, node, name,
+					 symbol_function(0, type));
+	symbols_indent(ctx->symbols);
 	if (node->size == 4)
 	{
-		symbol->function.params = FuncFParamList(node->children[2]);
-		Block(node->children[3]);
+		symbol->function.params = FuncFParamList(ctx,
+							 node->children[2]);
+		Block(ctx, node->children[3]);
 	}
 	else
-		Block(node->children[2]);
-	symbols_leave(g_symbols);
+		Block(ctx, node->children[2]);
+	symbols_leave(ctx->symbols);
 }
 
-static void GlobalList(const struct node_t *node)
+static void GlobalList(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_GlobalList);
 	m_this_node = node;
 
-	for (int i = node->size - 1; i >= 0; --i)
-		Global(node->children[i]);
+	for (int i = 0; i < node->size; ++i)
+		Global(ctx, node->children[i]);
 }
 
-static void Global(const struct node_t *node)
+static void Global(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Global);
 	m_this_node = node;
 
 	if (node->children[0]->data.kind == AST_FuncDef)
-		return FuncDef(node->children[0]);
+		return FuncDef(ctx, node->children[0]);
 	if (node->children[0]->data.kind == AST_Decl)
-		return Decl(node->children[0]);
+		return Decl(ctx, node->children[0]);
 
 	panic("Unsupported global item");
 }
 
-static enum symbol_type_e Type(const struct node_t *node)
+static enum symbol_type_e Type(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Type);
 	m_this_node = node;
@@ -174,17 +386,17 @@ static enum symbol_type_e Type(const struct node_t *node)
 	panic("unknown Type");
 }
 
-static void Block(const struct node_t *node)
+static void Block(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Block);
 	m_this_node = node;
 
-	symbols_indent(g_symbols);
-	BlockItemList(node->children[0]);
-	symbols_leave(g_symbols);
+	symbols_indent(ctx->symbols);
+	BlockItemList(ctx, node->children[0]);
+	symbols_leave(ctx->symbols);
 }
 
-static void Stmt(const struct node_t *node)
+static void Stmt(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Stmt);
 	m_this_node = node;
@@ -196,54 +408,46 @@ static void Stmt(const struct node_t *node)
 		/* do nothing */
 		break;
 	case AST_Exp:
-		Exp(node->children[0]);
+		Exp(ctx, node->children[0]);
 		break;
 	case AST_LVal:
-	{
-		char *ident = LVal(node->children[0]);
-
-		struct symbol_t *symbol = symbols_get(g_symbols, ident);
-		if (!symbol)
-			error("Undefined symbol: `%s`", ident);
-		if (symbol->tag != VARIABLE)
-			error("Assignee must be a variable: `%s`", ident);
+		lookup_variable(ctx, node->children[0],
+				LVal(ctx, node->children[0]));
+		Exp(ctx, node->children[1]);
 		break;
-	}
 	case AST_Block:
-		Block(node->children[0]);
+		Block(ctx, node->children[0]);
 		break;
 	case AST_RETURN:
 		/* RETURN [Exp] SEMI */
 		if (node->size == 2)
-			Exp(node->children[1]);
+			Exp(ctx, node->children[1]);
 		break;
 	case AST_IF:
 		/* IF (LP) Exp (RP) Stmt [(ELSE) Stmt] */
-		Exp(node->children[1]);
-		Stmt(node->children[2]);
+		Exp(ctx, node->children[1]);
+		Stmt(ctx, node->children[2]);
 		if (node->size == 4)
-			Stmt(node->children[3]);
+			Stmt(ctx, node->children[3]);
 		break;
 	case AST_WHILE:
-		Exp(node->children[1]);
+		Exp(ctx, node->children[1]);
 		// "push"
 		m_while = true;
-		Stmt(node->children[2]);
+		Stmt(ctx, node->children[2]);
 		// "pop"
 		m_while = this_while;
 		break;
 	case AST_BREAK:
 	case AST_CONTINUE:
-		if (!m_while)
-			error("`break` and `continue` statements are only allow"
-			      "ed in body of `while`");
+		jump(ctx, node, m_while);
 		break;
 	default:
 		todo();
 	}
 }
 
-static int32_t Number(const struct node_t *node)
+static int32_t Number(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Number);
 	m_this_node = node;
@@ -251,245 +455,207 @@ static int32_t Number(const struct node_t *node)
 	return node->children[0]->data.value.i;
 }
 
-static int32_t Exp(const struct node_t *node)
+static struct option_t Exp(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Exp);
 	m_this_node = node;
 
+	if (node->data.fold != FOLD_UNKNOWN)
+		return cached(node);
+
 	/* unary expression, propagate */
 	if (node->size == 1)
-		return UnaryExp(node->children[0]);
+		return cache(node, UnaryExp(ctx, node->children[0]));
 
-	/* otherwise, binary expression */
-	char *op_token = node->children[1]->data.value.s;
-	uint32_t lhs = Exp(node->children[0]);
-	uint32_t rhs = Exp(node->children[2]);
+	/* otherwise, binary expression. both sides are checked, even the one
+	 * that may never be evaluated */
+	struct option_t lhs = Exp(ctx, node->children[0]);
+	struct option_t rhs = Exp(ctx, node->children[2]);
+	m_this_node = node;
 
-	/* logical operators are kinda naughty */
-	switch (node->children[1]->data.kind)
-	{
-	case AST_LOR:
-		return lhs || rhs;
-	case AST_LAND:
-		return lhs && rhs;
-	case AST_EQOP:
-		if (strcmp(op_token, "!=") == 0)
-			return lhs != rhs;
-		if (strcmp(op_token, "==") == 0)
-			return lhs == rhs;
-		panic("unknown equity operator");
-	case AST_RELOP:
-		if (strcmp(op_token, ">") == 0)
-			return lhs > rhs;
-		if (strcmp(op_token, "<") == 0)
-			return lhs < rhs;
-		if (strcmp(op_token, ">=") == 0)
-			return lhs >= rhs;
-		if (strcmp(op_token, "<=") == 0)
-			return lhs <= rhs;
-		panic("unknown relational operator");
-	case AST_SHOP:
-		if (strcmp(op_token, ">>") == 0)
-			return lhs >> rhs;
-		if (strcmp(op_token, "<<") == 0)
-			return lhs << rhs;
-		panic("unknown shift operator");
-	case AST_ADDOP:
-		if (strcmp(op_token, "+") == 0)
-			return lhs + rhs;
-		if (strcmp(op_token, "-") == 0)
-			return lhs - rhs;
-		panic("unknown additive operator");
-	case AST_MULOP:
-		if (strcmp(op_token, "*") == 0)
-			return lhs * rhs;
-		if (strcmp(op_token, "/") == 0)
-			return lhs / rhs;
-		if (strcmp(op_token, "%") == 0)
-			return lhs % rhs;
-		panic("unknown multiplicative operator");
-	default:
-		todo();
-	}
+	return cache(node, binary(ctx, node->children[1], lhs, rhs));
 }
 
-static int32_t UnaryExp(const struct node_t *node)
+static struct option_t UnaryExp(struct context_t *ctx,
+				const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_UnaryExp);
 	m_this_node = node;
 
+	if (node->data.fold != FOLD_UNKNOWN)
+		return cached(node);
+
 	/* already computed expressions (fixed point) */
 	switch (node->children[0]->data.kind)
 	{
 	case AST_PrimaryExp:
-		return PrimaryExp(node->children[0]);
+		return cache(node, PrimaryExp(ctx, node->children[0]));
 	case AST_IDENT:
 		/* function calls.
 		 * IDENT (LP) [FuncRParams] (RP) */
 		{
 		char *ident = node->children[0]->data.value.s;
-
-		struct symbol_t *symbol = symbols_get(g_symbols, ident);
-		if (!symbol)
-			error("Undefined function: `%s`", ident);
+		lookup_function(ctx, node, ident);
 
 		if (node->size == 2)
-			FuncRParamList(node->children[1]);
+			FuncRParamList(ctx, node->children[1]);
+
+		m_this_node = node;
+		if (m_constexpr)
+			error(ctx, "Constants must be evaluated at compile ti"
+			      "me, while `%s` is a function", ident);
 		}
-		// TODO make it optional
-		return 1;
+		return cache(node, none());
 	default:
 		/* fallthrough */;
 	}
 
 	/* otherwise, continguous unary expression */
 	char op_token = node->children[0]->data.value.s[0];
-	uint32_t operand = UnaryExp(node->children[1]);
+	struct option_t operand = UnaryExp(ctx, node->children[1]);
+	if (operand.tag == NONE)
+		return cache(node, none());
 
 	switch (op_token)
 	{
 	case '+':
-		return +operand;
+		return cache(node, operand);
 	case '-':
-		return -operand;
+		return cache(node, wrap(0u - operand.value));
 	case '!':
-		return !operand;
+		return cache(node, some(!operand.value));
 	default:
 		panic("unknown unary operator");
 	}
 }
 
-static int32_t PrimaryExp(const struct node_t *node)
+static struct option_t PrimaryExp(struct context_t *ctx,
+				  const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_PrimaryExp);
 	m_this_node = node;
 
 	if (node->children[0]->data.kind == AST_Exp)
-		return Exp(node->children[0]);
+		return Exp(ctx, node->children[0]);
 	if (node->children[0]->data.kind == AST_Number)
-		return Number(node->children[0]);
+		return some(Number(ctx, node->children[0]));
 	if (node->children[0]->data.kind == AST_LVal)
 	{
-		char *ident = LVal(node->children[0]);
+		char *ident = LVal(ctx, node->children[0]);
 
-		struct symbol_t *symbol = symbols_get(g_symbols, ident);
-		if (!symbol)
-			error("Undefined symbol: `%s`", ident);
-		
-		switch (symbol->tag)
-		{
-		case CONSTANT:
-			return symbol->constant.value;
-		case VARIABLE:
-			if (m_constexpr)
-				error("Constants must be evaluated at compile t"
-				      "ime, while `%s` is a variable", ident);
-			// TODO make it optional
-			return 1;
-		case FUNCTION:
-			error("Function as variable is not supported", ident);
-		}
+		struct symbol_t *symbol = lookup_value(ctx, node->children[0],
+						       ident);
+		if (symbol->tag == CONSTANT)
+			return some(symbol->constant.value);
+
+		if (m_constexpr)
+			error(ctx, "Constants must be evaluated at compile ti"
+			      "me, while `%s` is a variable", ident);
+		return none();
 	}
 
 	unreachable();
 }
 
-static void Decl(const struct node_t *node)
+static void Decl(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_Decl);
 	m_this_node = node;
 
 	/* indent only when not in global scope */
-	if (symbols_level(g_symbols) > 0)
-		symbols_indent(g_symbols);
+	if (symbols_level(ctx->symbols) > 0)
+		symbols_indent(ctx->symbols);
 
 	if (node->children[0]->data.kind == AST_ConstDecl)
-		ConstDecl(node->children[0]);
+		ConstDecl(ctx, node->children[0]);
 	else if (node->children[0]->data.kind == AST_VarDecl)
-		VarDecl(node->children[0]);
+		VarDecl(ctx, node->children[0]);
 	else
 		unreachable();
 
 	// no need to `leave()` here, we'll clean it up when we exit this block
 }
 
-static void ConstDecl(const struct node_t *node)
+static void ConstDecl(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_ConstDecl);
 	m_this_node = node;
 
 	m_constexpr = true;
 
-	Type(node->children[0]);
-	ConstDefList(node->children[1]);
+	Type(ctx, node->children[0]);
+	ConstDefList(ctx, node->children[1]);
 
 	m_constexpr = false;
 }
 
-static void ConstDef(const struct node_t *node)
+static void ConstDef(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_ConstDef);
 	m_this_node = node;
 
 	char *ident = node->children[0]->data.value.s;
 
-	struct symbol_t *it;
-	struct view_t view = symbols_lookup(g_symbols, ident);
-	while ((it = view.next(&view)))
-		if (symbols_here(g_symbols, it))
-			error("Redefinition of constant: `%s`", ident);
-
-	int32_t value = ConstInitVal(node->children[1]);
-	symbols_add(g_symbols, ident, symbol_constant(value));
+	int32_t value = ConstInitVal(ctx, node->children[1]);
+	define(ctx, node, ident, symbol_constant(value));
 }
 
-static int32_t ConstInitVal(const struct node_t *node)
+static int32_t ConstInitVal(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_ConstInitVal);
 	m_this_node = node;
 
-	return ConstExp(node->children[0]);
+	return ConstExp(ctx, node->children[0]);
 }
 
-static void VarDecl(const struct node_t *node)
+static void VarDecl(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_VarDecl);
 	m_this_node = node;
 
-	Type(node->children[0]);
-	VarDefList(node->children[1]);
+	Type(ctx, node->children[0]);
+	VarDefList(ctx, node->children[1]);
 }
 
-static void VarDef(const struct node_t *node)
+static void VarDef(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_VarDef);
 	m_this_node = node;
 
 	char *ident = node->children[0]->data.value.s;
 
-	struct symbol_t *it;
-	struct view_t view = symbols_lookup(g_symbols, ident);
-	while ((it = view.next(&view)))
-		if (symbols_here(g_symbols, it))
-			error("Redefinition of variable: `%s`", ident);
+	/* always treat as uninitialized, since `InitVal` is an `Exp` that is
+	 * generally only known at runtime */
+	define(ctx, node, ident, symbol_variable());
 
-	/* always treat as uninitialized, since `InitVal` can only be evaluated
-	 * in IR phase because `InitVal` is an `Exp` */
-	symbols_add(g_symbols, ident, symbol_variable());
+	if (node->size == 2)
+		InitVal(ctx, node->children[1]);
 }
 
-static void BlockItem(const struct node_t *node)
+static void InitVal(struct context_t *ctx, const struct node_t *node)
+{
+	assert(node && node->data.kind == AST_InitVal);
+	m_this_node = node;
+
+	/* globals start off with what's in the data section */
+	if (symbols_level(ctx->symbols) == 0)
+		constant(ctx, node->children[0]);
+	else
+		Exp(ctx, node->children[0]);
+}
+
+static void BlockItem(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_BlockItem);
 	m_this_node = node;
 
 	if (node->children[0]->data.kind == AST_Decl)
-		Decl(node->children[0]);
+		Decl(ctx, node->children[0]);
 	if (node->children[0]->data.kind == AST_Stmt)
-		Stmt(node->children[0]);
+		Stmt(ctx, node->children[0]);
 }
 
-static char *LVal(const struct node_t *node)
+static char *LVal(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_LVal);
 	m_this_node = node;
@@ -497,86 +663,148 @@ static char *LVal(const struct node_t *node)
 	return node->children[0]->data.value.s;
 }
 
-static int32_t ConstExp(const struct node_t *node)
+static int32_t ConstExp(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_ConstExp);
 	m_this_node = node;
 
-	return Exp(node->children[0]);
+	return constant(ctx, node->children[0]);
 }
 
-static void ConstDefList(const struct node_t *node)
+static void ConstDefList(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_ConstDefList);
 	m_this_node = node;
 	
-	for (int i = node->size - 1; i >= 0; --i)
-		ConstDef(node->children[i]);
+	for (int i = 0; i < node->size; ++i)
+		ConstDef(ctx, node->children[i]);
 }
 
-static void VarDefList(const struct node_t *node)
+static void VarDefList(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_VarDefList);
 	m_this_node = node;
 
-	for (int i = node->size - 1; i >= 0; --i)
-		VarDef(node->children[i]);
+	for (int i = 0; i < node->size; ++i)
+		VarDef(ctx, node->children[i]);
 }
 
-static void BlockItemList(const struct node_t *node)
+static void BlockItemList(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_BlockItemList);
 	m_this_node = node;
 
-	for (int i = node->size - 1; i >= 0; --i)
-		BlockItem(node->children[i]);
+	for (int i = 0; i < node->size; ++i)
+		BlockItem(ctx, node->children[i]);
 }
 
-static void FuncRParamList(const struct node_t *node)
+static void FuncRParamList(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_FuncRParamList);
 	m_this_node = node;
 
-	for (int i = node->size - 1; i >= 0; --i)
-		FuncRParam(node->children[i]);
+	for (int i = 0; i < node->size; ++i)
+		FuncRParam(ctx, node->children[i]);
 }
 
-static void FuncRParam(const struct node_t *node)
+static void FuncRParam(struct context_t *ctx, const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_FuncRParam);
 	m_this_node = node;
 
-	Exp(node->children[0]);
+	Exp(ctx, node->children[0]);
 }
 
-static struct vector_typ_t *FuncFParamList(const struct node_t *node)
+static struct vector_typ_t *FuncFParamList(struct context_t *ctx,
+					   const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_FuncFParamList);
 	m_this_node = node;
 
 	struct vector_typ_t *vec = vector_typ_new(node->size);
 
-	for (int i = node->size - 1; i >= 0; --i)
-		vector_typ_push(vec, FuncFParam(node->children[i]));
+	for (int i = 0; i < node->size; ++i)
+		vector_typ_push(vec, FuncFParam(ctx, node->children[i]));
 
 	return vec;
 }
 
-static enum symbol_type_e FuncFParam(const struct node_t *node)
+static enum symbol_type_e FuncFParam(struct context_t *ctx,
+				     const struct node_t *node)
 {
 	assert(node && node->data.kind == AST_FuncFParam);
 	m_this_node = node;
 
-	enum symbol_type_e type = Type(node->children[0]);
+	enum symbol_type_e type = Type(ctx, node->children[0]);
 	char *ident = node->children[1]->data.value.s;
-	symbols_add(g_symbols, ident, symbol_variable());
+	resolve(ctx, node, symbols_add(ctx->symbols, ident, symbol_variable()));
 
 	return type;
 }
 
-void semantic(const struct node_t *comp_unit)
+/* public defn.s */
+void semantic(struct context_t *ctx)
+{
+	semantic_begin(ctx);
+
+	CompUnit(ctx, ctx->comp_unit);
+}
+
+void semantic_begin(struct context_t *ctx)
+{
+	ctx->symbols = symbols_new();
+	/* a unit that failed may have left these behind */
+	m_constexpr = false;
+	m_while = false;
+
+	init_lib(ctx);
+}
+
+struct symbol_t *semantic_define(struct context_t *ctx,
+				 const struct node_t *node, char *ident,
+				 struct symbol_t symbol)
+{
+	return define(ctx, node, ident, symbol);
+}
+
+struct symbol_t *semantic_value(struct context_t *ctx,
+				const struct node_t *node, char *ident)
+{
+	return lookup_value(ctx, node, ident);
+}
+
+struct symbol_t *semantic_variable(struct context_t *ctx,
+				   const struct node_t *node, char *ident)
+{
+	return lookup_variable(ctx, node, ident);
+}
+
+struct symbol_t *semantic_function(struct context_t *ctx,
+				   const struct node_t *node, char *ident)
+{
+	return lookup_function(ctx, node, ident);
+}
+
+void semantic_jump(struct context_t *ctx, const struct node_t *node,
+		   bool in_while)
+{
+	jump(ctx, node, in_while);
+}
+
+int32_t semantic_const(struct context_t *ctx, const struct node_t *node)
+{
+	if (node->data.kind == AST_ConstExp)
+		return ConstExp(ctx, node);
+
+	return constant(ctx, node);
+}
+
+bool semantic_fold(struct context_t *ctx, const struct node_t *node,
+		   int32_t *value)
 {
-	g_symbols = symbols_new();
+	struct option_t ret = node->data.kind == AST_Exp ? Exp(ctx, node)
+							 : UnaryExp(ctx, node);
+	*value = ret.value;
 
-	CompUnit(comp_unit);
+	return ret.tag == SOME;
 }
@@ -6,8 +6,44 @@
 #ifndef _SEMANTIC_H_
 #define _SEMANTIC_H_
 
+#include <stdbool.h>
+
+#include "context.h"
 #include "node.h"
+#include "symbols.h"
+
+/* Analyse `ctx->comp_unit`, leaving its symbols in `ctx->symbols`. Errors
+ * are thrown to `ctx->env`. */
+void semantic(struct context_t *ctx);
+
+/* Pieces of the analysis, for IR generation to run on the fly when the two
+ * phases are fused. Errors are thrown to `ctx->env`, as in `semantic()`. */
 
-void semantic(const struct node_t *comp_unit);
+/* Set up `ctx->symbols` with the library functions in it. */
+void semantic_begin(struct context_t *ctx);
+/* Add `symbol` to the current scope.
+ * @return symbol added. */
+struct symbol_t *semantic_define(struct context_t *ctx,
+				 const struct node_t *node, char *ident,
+				 struct symbol_t symbol);
+/* @return constant or variable read as `ident`. */
+struct symbol_t *semantic_value(struct context_t *ctx,
+				const struct node_t *node, char *ident);
+/* @return variable assigned to as `ident`. */
+struct symbol_t *semantic_variable(struct context_t *ctx,
+				   const struct node_t *node, char *ident);
+/* @return function called as `ident`. */
+struct symbol_t *semantic_function(struct context_t *ctx,
+				   const struct node_t *node, char *ident);
+/* Check a `break` or `continue`. */
+void semantic_jump(struct context_t *ctx, const struct node_t *node,
+		   bool in_while);
+/* @return value of a `ConstExp`, or of an `Exp` that has to be constant. */
+int32_t semantic_const(struct context_t *ctx, const struct node_t *node);
+/* Evaluate an `Exp` or a `UnaryExp` at compile time, if it's been analysed
+ * already or else while analysing it.
+ * @return whether it's constant, with `value` set if so. */
+bool semantic_fold(struct context_t *ctx, const struct node_t *node,
+		   int32_t *value);
 
 #endif//_SEMANTIC_H_
@@ -0,0 +1,273 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "driver.h"
+#include "pool.h"
+#include "serve.h"
+
+// requests between two trims of the cache
+#define TRIM_INTERVAL 256
+
+#define FIELDS 4
+
+struct request_t {
+	uint32_t lens[FIELDS];
+};
+
+struct reply_t {
+	int32_t status;
+	uint32_t errors_len;
+	double time;
+};
+
+/* state variables */
+static const char *m_path;
+static int m_listener;
+static _Atomic uint32_t m_served;
+
+/* tool functions */
+static void on_signal(int signum)
+{
+	(void) signum;
+
+	unlink(m_path);
+	_exit(0);
+}
+
+static bool make_address(struct sockaddr_un *addr, const char *path)
+{
+	if (strlen(path) >= sizeof(addr->sun_path))
+	{
+		fprintf(stderr, "socket path too long: %s\n", path);
+		return false;
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+/* both ends send a header and what it has the lengths of, then wait */
+static bool read_all(int fd, void *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = read(fd, data, len);
+		if (n <= 0)
+			return false;
+		data = (char *)data + n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static bool write_all(int fd, const void *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write(fd, data, len);
+		if (n <= 0)
+			return false;
+		data = (const char *)data + n;
+		len -= n;
+	}
+
+	return true;
+}
+
+/* fields are split into `fields`, each ending with a NUL */
+static bool read_request(int fd, char *fields, const char *split[FIELDS])
+{
+	struct request_t request;
+	if (!read_all(fd, &request, sizeof(request)))
+		return false;
+
+	size_t len = 0;
+	for (int i = 0; i < FIELDS; ++i)
+		len += request.lens[i] + 1;
+	if (len > SERVE_REQUEST_MAX)
+		return false;
+
+	for (int i = 0; i < FIELDS; ++i)
+	{
+		if (!read_all(fd, fields, request.lens[i]))
+			return false;
+		fields[request.lens[i]] = '\0';
+		split[i] = fields;
+		fields += request.lens[i] + 1;
+	}
+
+	return true;
+}
+
+static void handle(int fd)
+{
+	char fields[SERVE_REQUEST_MAX];
+	const char *split[FIELDS];
+	bool ok = read_request(fd, fields, split);
+
+	char *errors = NULL;
+	size_t errors_len;
+	struct unit_t unit = {
+		.errors = open_memstream(&errors, &errors_len),
+		.status = 1,
+	};
+	if (ok && (strcmp(split[0], "-koopa") == 0
+		   || strcmp(split[0], "-riscv") == 0))
+	{
+		unit.mode = split[0];
+		unit.input = split[1];
+		unit.middle = split[2];
+		unit.output = split[3];
+		driver_compile(&unit);
+		fprintf(stderr, "serve: %10.3f ms %6s  %s\n", unit.time * 1e3,
+			unit.status == 0 ? "ok" : "failed", unit.input);
+	}
+	else
+	{
+		fprintf(stderr, "serve: bad request\n");
+		fprintf(unit.errors, "bad request\n");
+	}
+	fclose(unit.errors);
+
+	struct reply_t reply = {
+		.status = unit.status,
+		.errors_len = errors_len,
+		.time = unit.time * 1e3,
+	};
+	if (write_all(fd, &reply, sizeof(reply)))
+		write_all(fd, errors, errors_len);
+	free(errors);
+
+	if (cache_enabled() && ++m_served % TRIM_INTERVAL == 0)
+		cache_trim();
+}
+
+static void accept_loop(void *arg, uint32_t i)
+{
+	(void) arg;
+	(void) i;
+
+	while (true)
+	{
+		int fd = accept(m_listener, NULL, NULL);
+		if (fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("accept");
+			return;
+		}
+
+		handle(fd);
+		close(fd);
+	}
+}
+
+/* public defn.s */
+int serve(const char *path, uint32_t jobs)
+{
+	struct sockaddr_un addr;
+	if (!make_address(&addr, path))
+		return 1;
+
+	/* a socket left behind by a server that was killed is in the way */
+	unlink(path);
+	m_listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_listener < 0
+	    || bind(m_listener, (struct sockaddr *)&addr, sizeof(addr)) != 0
+	    || listen(m_listener, SOMAXCONN) != 0)
+	{
+		perror(path);
+		return 1;
+	}
+
+	m_path = path;
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	// clients that hang up early are none of our business
+	signal(SIGPIPE, SIG_IGN);
+
+	fprintf(stderr, "serve: listening on %s with %u jobs\n", path, jobs);
+	/* every worker accepts connections of its own */
+	pool_run(jobs, jobs, accept_loop, NULL);
+
+	unlink(path);
+	return 1;
+}
+
+int serve_request(const char *path, const char *mode, const char *input,
+		  const char *middle, const char *output)
+{
+	struct sockaddr_un addr;
+	if (!make_address(&addr, path))
+		return 1;
+
+	char cwd[4096];
+	if (!getcwd(cwd, sizeof(cwd)))
+	{
+		perror("getcwd");
+		return 1;
+	}
+
+	/* the server runs elsewhere */
+	const char *paths[FIELDS] = { mode, input, middle, output };
+	char fields[SERVE_REQUEST_MAX];
+	struct request_t request;
+	size_t len = 0;
+	for (int i = 0; i < FIELDS; ++i)
+	{
+		bool relative = i > 0 && paths[i][0] != '/'
+				&& strcmp(paths[i], "-o") != 0;
+		int n = snprintf(fields + len, sizeof(fields) - len, "%s%s%s",
+				 relative ? cwd : "", relative ? "/" : "",
+				 paths[i]);
+		// room for the NULs the server puts after each
+		if (n < 0 || len + n + FIELDS >= SERVE_REQUEST_MAX)
+		{
+			fprintf(stderr, "request too long\n");
+			return 1;
+		}
+		request.lens[i] = n;
+		len += n;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0
+	    || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	}
+
+	struct reply_t reply;
+	char *errors = NULL;
+	bool ok = write_all(fd, &request, sizeof(request))
+		  && write_all(fd, fields, len)
+		  && read_all(fd, &reply, sizeof(reply))
+		  && (errors = malloc(reply.errors_len + 1))
+		  && read_all(fd, errors, reply.errors_len);
+	close(fd);
+	if (!ok)
+	{
+		fprintf(stderr, "%s: no reply\n", path);
+		free(errors);
+		return 1;
+	}
+
+	fwrite(errors, 1, reply.errors_len, stderr);
+	free(errors);
+	return reply.status;
+}
@@ -0,0 +1,29 @@
+/**
+ * serve.h
+ * Compile server over a Unix domain socket, and its client.
+ */
+
+#ifndef _SERVE_H_
+#define _SERVE_H_
+
+#include <stdint.h>
+
+/* a request is the lengths of `<mode> <input> <middle> <output>`, with
+ * absolute paths, followed by those. the reply is `<status> <milliseconds>`
+ * and the length of what the unit printed to stderr, followed by that. both
+ * ends are on the same machine, so numbers are sent as they are in memory */
+#define SERVE_REQUEST_MAX (4 * 4096)
+
+/* Serve requests on the socket at `path` with `jobs` threads until
+ * interrupted.
+ * @return exit status if the socket can't be set up. */
+int serve(const char *path, uint32_t jobs);
+
+/* Send a single request to the server at `path` and wait for the reply,
+ * which has its diagnostics printed to stderr. Relative paths are taken
+ * from the current directory.
+ * @return exit status of the request. */
+int serve_request(const char *path, const char *mode, const char *input,
+		  const char *middle, const char *output);
+
+#endif//_SERVE_H_
@@ -0,0 +1,231 @@
+#pragma clang diagnostic ignored \
+	"-Wincompatible-pointer-types-discards-qualifiers"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "koopaext.h"
+#include "macros.h"
+#include "strength.h"
+#include "vector.h"
+
+/* state variables */
+// instructions of the basic block being rewritten
+static _Thread_local struct vector_ptr_t *m_insts;
+
+/* tool functions */
+static bool as_const(koopa_raw_value_t value, int32_t *constant)
+{
+	if (value->kind.tag != KOOPA_RVT_INTEGER)
+		return false;
+
+	*constant = value->kind.data.integer.value;
+	return true;
+}
+
+static bool is_pow2(uint32_t value)
+{
+	return value != 0 && (value & (value - 1)) == 0;
+}
+
+static koopa_raw_value_t binary(koopa_raw_binary_op_t op,
+				koopa_raw_value_t lhs, koopa_raw_value_t rhs)
+{
+	koopa_raw_value_t value = koopa_raw_binary(op, lhs, rhs);
+	vector_ptr_push(m_insts, (void *)value);
+
+	return value;
+}
+
+/* `x << shift`, or `x` itself */
+static koopa_raw_value_t shl(koopa_raw_value_t x, uint32_t shift)
+{
+	if (shift == 0)
+		return x;
+
+	return binary(KOOPA_RBO_SHL, x, koopa_raw_integer(shift));
+}
+
+/* turn `value` into the last instruction of the sequence, so that its users
+ * needn't be touched */
+static void retarget(koopa_raw_value_data_t *value, koopa_raw_binary_op_t op,
+		     koopa_raw_value_t lhs, koopa_raw_value_t rhs)
+{
+	koopa_raw_binary_t *binary = &value->kind.data.binary;
+
+	slice_remove(&binary->lhs->used_by, value);
+	slice_remove(&binary->rhs->used_by, value);
+
+	binary->op = op;
+	binary->lhs = lhs;
+	binary->rhs = rhs;
+
+	slice_append(&lhs->used_by, value);
+	slice_append(&rhs->used_by, value);
+}
+
+/* `x + (x < 0 ? 2^shift - 1 : 0)`, which makes arithmetic right shifts round
+ * towards zero like `div` does */
+static koopa_raw_value_t round_bias(koopa_raw_value_t x, uint32_t shift)
+{
+	koopa_raw_value_t bias;
+	if (shift == 1)
+		bias = binary(KOOPA_RBO_SHR, x, koopa_raw_integer(31));
+	else
+		bias = binary(KOOPA_RBO_SHR,
+			      binary(KOOPA_RBO_SAR, x, koopa_raw_integer(31)),
+			      koopa_raw_integer(32 - shift));
+
+	return binary(KOOPA_RBO_ADD, x, bias);
+}
+
+/* reducers */
+static bool reduce_mul(koopa_raw_value_data_t *value, koopa_raw_value_t x,
+		       int32_t c)
+{
+	uint32_t abs_c = c < 0 ? -(uint32_t)c : (uint32_t)c;
+	koopa_raw_value_t zero = koopa_raw_integer(0);
+
+	if (c == 0)
+		retarget(value, KOOPA_RBO_AND, x, zero);
+	else if (c == 1)
+		retarget(value, KOOPA_RBO_ADD, x, zero);
+	else if (c == -1)
+		retarget(value, KOOPA_RBO_SUB, zero, x);
+	else if (is_pow2(c))
+		retarget(value, KOOPA_RBO_SHL, x,
+			 koopa_raw_integer(__builtin_ctz(c)));
+	else if (c < 0 && is_pow2(abs_c))
+		retarget(value, KOOPA_RBO_SUB, zero,
+			 shl(x, __builtin_ctz(abs_c)));
+	/* 2^a + 2^b */
+	else if (c > 0 && __builtin_popcount(c) == 2)
+	{
+		uint32_t low = __builtin_ctz(c);
+		uint32_t high = 31 - __builtin_clz(c);
+		retarget(value, KOOPA_RBO_ADD, shl(x, high), shl(x, low));
+	}
+	/* 2^a - 2^b */
+	else if (c > 0 && is_pow2((uint32_t)c + (c & -c)))
+	{
+		uint32_t low = __builtin_ctz(c);
+		uint32_t high = __builtin_ctz((uint32_t)c + (c & -c));
+		retarget(value, KOOPA_RBO_SUB, shl(x, high), shl(x, low));
+	}
+	else
+		return false;
+
+	return true;
+}
+
+static bool reduce_div(koopa_raw_value_data_t *value, koopa_raw_value_t x,
+		       int32_t c)
+{
+	uint32_t abs_c = c < 0 ? -(uint32_t)c : (uint32_t)c;
+	koopa_raw_value_t zero = koopa_raw_integer(0);
+
+	if (c == 1)
+		retarget(value, KOOPA_RBO_ADD, x, zero);
+	else if (c == -1)
+		retarget(value, KOOPA_RBO_SUB, zero, x);
+	else if (c != INT32_MIN && is_pow2(abs_c))
+	{
+		uint32_t shift = __builtin_ctz(abs_c);
+		koopa_raw_value_t biased = round_bias(x, shift);
+		koopa_raw_value_t amount = koopa_raw_integer(shift);
+
+		if (c > 0)
+			retarget(value, KOOPA_RBO_SAR, biased, amount);
+		else
+			retarget(value, KOOPA_RBO_SUB, zero,
+				 binary(KOOPA_RBO_SAR, biased, amount));
+	}
+	else
+		return false;
+
+	return true;
+}
+
+static bool reduce_mod(koopa_raw_value_data_t *value, koopa_raw_value_t x,
+		       int32_t c)
+{
+	uint32_t abs_c = c < 0 ? -(uint32_t)c : (uint32_t)c;
+
+	if (c == 1 || c == -1)
+		retarget(value, KOOPA_RBO_AND, x, koopa_raw_integer(0));
+	/* x - (x / 2^k) * 2^k; the sign of the divisor doesn't matter */
+	else if (c != INT32_MIN && is_pow2(abs_c))
+	{
+		uint32_t shift = __builtin_ctz(abs_c);
+		koopa_raw_value_t biased = round_bias(x, shift);
+		koopa_raw_value_t mask = koopa_raw_integer(-(int32_t)abs_c);
+
+		retarget(value, KOOPA_RBO_SUB, x,
+			 binary(KOOPA_RBO_AND, biased, mask));
+	}
+	else
+		return false;
+
+	return true;
+}
+
+static bool reduce(koopa_raw_value_data_t *value)
+{
+	if (value->kind.tag != KOOPA_RVT_BINARY)
+		return false;
+
+	koopa_raw_binary_t *binary = &value->kind.data.binary;
+	int32_t c;
+
+	switch (binary->op)
+	{
+	case KOOPA_RBO_MUL:
+		if (as_const(binary->rhs, &c))
+			return reduce_mul(value, binary->lhs, c);
+		if (as_const(binary->lhs, &c))
+			return reduce_mul(value, binary->rhs, c);
+		return false;
+	case KOOPA_RBO_DIV:
+		return as_const(binary->rhs, &c)
+		       && reduce_div(value, binary->lhs, c);
+	case KOOPA_RBO_MOD:
+		return as_const(binary->rhs, &c)
+		       && reduce_mod(value, binary->lhs, c);
+	default:
+		return false;
+	}
+}
+
+static void basic_block(koopa_raw_basic_block_data_t *basic_block)
+{
+	koopa_raw_slice_t *insts = &basic_block->insts;
+	bool changed = false;
+
+	m_insts->size = 0;
+	for (uint32_t i = 0; i < insts->len; ++i)
+	{
+		koopa_raw_value_data_t *value = insts->buffer[i];
+
+		changed |= reduce(value);
+		vector_ptr_push(m_insts, value);
+	}
+
+	if (!changed)
+		return;
+
+	*insts = slice_new(m_insts->size, KOOPA_RSIK_VALUE);
+	for (uint32_t i = 0; i < m_insts->size; ++i)
+		insts->buffer[i] = m_insts->data[i];
+}
+
+/* public defn.s */
+void strength(koopa_raw_function_t function)
+{
+	m_insts = vector_ptr_new(64);
+
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+		basic_block(function->bbs.buffer[i]);
+
+	vector_ptr_delete(m_insts);
+}
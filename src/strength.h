@@ -0,0 +1,15 @@
+/**
+ * strength.h
+ * Strength reduction of multiplications and divisions by constants.
+ */
+
+#ifndef _STRENGTH_H_
+#define _STRENGTH_H_
+
+#include "koopa.h"
+
+/* Rewrite `mul`, `div` and `mod` by constants into shifts and additions in
+ * place. New values are allocated with the current Koopa raw allocator. */
+void strength(koopa_raw_function_t function);
+
+#endif//_STRENGTH_H_
@@ -38,7 +38,6 @@
 #include <stddef.h>
 #include <stdlib.h>
 
-#include "globals.h"
 #include "hashtable.h"
 #include "symbols.h"
 #include "vector.h"
@@ -74,10 +73,6 @@ struct _symbols_t {
 struct symbol_t symbol_constant(int32_t value)
 {
 	struct symbol_t symbol = {
-		.meta = {
-			.level = symbols_level(g_symbols),
-			.scope = symbols_scope(g_symbols),
-		},
 		.tag = CONSTANT,
 		.constant = {
 			.value = value,
@@ -90,10 +85,6 @@ struct symbol_t symbol_constant(int32_t value)
 struct symbol_t symbol_variable(void)
 {
 	struct symbol_t symbol = {
-		.meta = {
-			.level = symbols_level(g_symbols),
-			.scope = symbols_scope(g_symbols),
-		},
 		.tag = VARIABLE,
 		.variable = {
 			.raw = NULL,
@@ -106,10 +97,6 @@ struct symbol_t symbol_function(struct vector_typ_t *params,
 				enum symbol_type_e type)
 {
 	struct symbol_t symbol = {
-		.meta = {
-			.level = symbols_level(g_symbols),
-			.scope = symbols_scope(g_symbols),
-		},
 		.tag = FUNCTION,
 		.function = {
 			.raw = NULL,
@@ -152,6 +139,13 @@ static bool level_empty(const struct level_t *level)
 	return level->begin == level->end;
 }
 
+static void level_reset(struct level_t *level)
+{
+	level->begin = 0;
+	level->end = 0;
+	level->scope = -1;
+}
+
 static struct level_t *level_offer(struct level_t *level,
 				   struct _htable_strsym_item_t *item)
 {
@@ -194,9 +188,16 @@ symbols_t symbols_new(void)
 
 void symbols_delete(symbols_t symbols)
 {
-	// global level
-	symbols_dedent(symbols);
-
+	/* everything that's left, including what a unit bailing out halfway
+	 * has never got to visit */
+	for (size_t i = 0; i < HASHTABLE_SIZE; ++i)
+		for (struct _htable_strsym_item_t *it = symbols->table->data[i];
+		     it; it = it->next)
+			if (it->value.tag == FUNCTION)
+				vector_typ_delete(it->value.function.params);
+
+	for (uint16_t i = 0; i < symbols->depth; ++i)
+		level_delete(symbols->levels->data[i]);
 	vector_ptr_delete(symbols->levels);
 	htable_strsym_delete(symbols->table);
 	free(symbols);
@@ -251,6 +252,10 @@ struct symbol_t *symbols_add(symbols_t symbols, char *ident,
 {
 	struct level_t *level = symbols->levels->data[symbols->level];
 	struct pair_t *scope = &level->scopes[level->scope];
+	symbol.meta = (struct symbol_meta_t) {
+		.level = symbols->level,
+		.scope = level->scope,
+	};
 	struct symbol_t *new = htable_insert(symbols->table, ident, symbol);
 	struct _htable_strsym_item_t *new_item =
 		container_of(new, struct _htable_strsym_item_t, value);
@@ -270,11 +275,10 @@ struct view_t symbols_lookup(const symbols_t symbols, char *ident)
 }
 
 /* scope controllers' basic workflow:
- * indent() => leave() => enter() => leave()
- *                     => enter() => leave() 
- *                              ...
- *                     => enter() => leave() => enter() => dedent()
- * |-----buildup-----|    |-----visit------|    |-----destroy-----| */
+ * indent() => leave()
+ * keeps symbols of the scope around until `symbols_delete()`, for whoever
+ * still refers to them. or, when nothing does:
+ * indent() => dedent() */
 void symbols_indent(symbols_t symbols)
 {
 	if (++symbols->level == symbols->depth)
@@ -300,14 +304,6 @@ void symbols_leave(symbols_t symbols)
 	while (symbols->level > 0 && level_at(level) != NULL);
 }
 
-void symbols_enter(symbols_t symbols)
-{
-	++symbols->level;
-
-	struct level_t *level = symbols->levels->data[symbols->level];
-	level->scope = (level->scope + 1) % level->end;
-}
-
 void symbols_dedent(symbols_t symbols)
 {
 	bool outside = false;
@@ -343,8 +339,9 @@ void symbols_dedent(symbols_t symbols)
 			free(this);
 		}
 
+		/* the level may be indented again once it's drained */
 		if (level_empty(level))
-			level_delete(level);
+			level_reset(level);
 	}
 	while (symbols->level > 0 && !outside);
 }
@@ -47,7 +47,8 @@ struct symbol_t {
 	};
 };
 
-/* ctor. of symbols */
+/* ctor. of symbols. their level and scope are those of where
+ * `symbols_add()` puts them */
 struct symbol_t symbol_constant(int32_t value);
 struct symbol_t symbol_variable(void);
 struct symbol_t symbol_function(struct vector_typ_t *params,
@@ -66,7 +67,6 @@ int16_t symbols_scope(const symbols_t symbols);
 /* scope actions */
 void symbols_indent(symbols_t symbols);
 void symbols_leave(symbols_t symbols);
-void symbols_enter(symbols_t symbols);
 void symbols_dedent(symbols_t symbols);
 
 /* symbol operations */
@@ -1,46 +1,76 @@
 %locations
+%define api.pure full
+%param {yyscan_t scanner}
+%parse-param {struct context_t *ctx}
 
-%{
+%code requires {
+typedef void *yyscan_t;
+
+#include "context.h"
+}
+
+%code {
 #include <stdio.h>
 
 #include "ast.h"
+#include "phases.h"
 
-/* yacc variables */
-extern int yylineno;
-extern int yylex();
-extern int yyerror(char *);
-extern char *yytext;
+/* yacc functions */
+extern int yylex(YYSTYPE *lval, YYLTYPE *lloc, yyscan_t scanner);
+extern char *yyget_text(yyscan_t scanner);
+static void yyerror(YYLTYPE *loc, yyscan_t scanner, struct context_t *ctx,
+		    const char *msg);
 
-/* state variables */
-extern bool error;
-struct node_t *comp_unit;
+/* the lexer runs on demand, so its time is told apart token by token */
+static int lex(YYSTYPE *lval, YYLTYPE *lloc, yyscan_t scanner)
+{
+	phases_enter(PHASE_LEXING);
+	int token = yylex(lval, lloc, scanner);
+	phases_enter(PHASE_PARSING);
 
-/* helper function */
-static void vfree(int count, ...)
+	return token;
+}
+#define yylex lex
+
+/* nodes are tagged with the line of the last token read */
+#define nterm(...) ast_nterm(yylloc.first_line, __VA_ARGS__)
+
+/* with `ctx->global` set, a global is gone once it's been handed over.
+ * @return the list, or NULL if it's been thrown away as well */
+static struct node_t *add_global(struct context_t *ctx, struct node_t *list,
+				 struct node_t *global)
 {
-	va_list args;
-	va_start(args, count);
-	for (int i = 0; i < count; ++i)
-		free(va_arg(args, void *));
-	va_end(args);
+	if (!ctx->global)
+		return node_add_child(list, global);
+
+	bool ok = ctx->global(ctx, global);
+	node_delete(global);
+	if (ok)
+		return list;
+
+	// symbols of the rule that aborts aren't destructed
+	ctx->error = true;
+	node_delete(list);
+	return NULL;
+}
 }
-%}
 
 /* TODO maybe add float support? */
 %union {
 	int i;
-	char *s;
+	const char *s;
 	struct node_t *n;
 }
 
-/* tokens */
+/* tokens. identifiers are interned and operators point to static
+ * strings, so none of them are freed; punctuation carries nothing */
 %token <i> INT_CONST
-%token <s> IDENT SEMI TYPE LP RP LC RC RETURN
-	   RELOP EQOP SHOP ADDOP UNARYOP MULOP LAND LOR
-	   CONST ASSIGN COMMA
-	   IF ELSE
-	   WHILE BREAK CONTINUE
-	   LB RB
+%token <s> IDENT TYPE RELOP EQOP SHOP ADDOP UNARYOP MULOP
+%token SEMI LP RP LC RC RETURN LAND LOR
+       CONST ASSIGN COMMA
+       IF ELSE
+       WHILE BREAK CONTINUE
+       LB RB
 
 /* nonterminals */
 %type <n> CompUnit FuncDef Type Block Stmt Number
@@ -49,6 +79,11 @@ static void vfree(int count, ...)
 	  BlockItem LVal ConstExp ConstDefList VarDefList BlockItemList
 	  FuncFParamList FuncFParam FuncRParamList FuncRParam GlobalList Global
 
+/* subtrees thrown away on syntax errors. the comp unit outlives the
+ * parser in `ctx`, so it's spared on accept */
+%destructor { node_delete($$); } <n>
+%destructor { } CompUnit
+
 /* association and precedence */
 %left LOR
 %left LAND
@@ -68,347 +103,316 @@ static void vfree(int count, ...)
 CompUnit
 	: GlobalList {
 		// FIXME yylineno reporting wrong line number
-		$$ = ast_nterm(AST_CompUnit, 1, $1);
-		comp_unit = $$;
+		$$ = nterm(AST_CompUnit, 1, $1);
+		ctx->comp_unit = $$;
 	}
 	;
 
+/* lists are left-recursive, so that each item is reduced as soon as it's
+ * parsed. the parser stack stays shallow however long a list gets, and
+ * children are appended in source order */
 GlobalList
 	: Global {
-		$$ = ast_nterm(AST_GlobalList, 1, $1);
+		if (!($$ = add_global(ctx, nterm(AST_GlobalList, 0), $1)))
+			YYABORT;
 	}
-	| Global GlobalList {
-		$$ = node_add_child($2, $1);
+	| GlobalList Global {
+		if (!($$ = add_global(ctx, $1, $2)))
+			YYABORT;
 	}
 	;
 
 Global
 	: Decl {
-		$$ = ast_nterm(AST_Global, 1, $1);
+		$$ = nterm(AST_Global, 1, $1);
 	}
 	| FuncDef {
-		$$ = ast_nterm(AST_Global, 1, $1);
+		$$ = nterm(AST_Global, 1, $1);
 	}
 	;
 
 FuncDef
 	: Type IDENT LP RP Block {
-		$$ = ast_nterm(AST_FuncDef, 3,
-			       $1, ast_term(AST_IDENT, $2), $5);
-		vfree(3, $2, $3, $4);
+		$$ = nterm(AST_FuncDef, 3,
+			   $1, ast_term(AST_IDENT, $2), $5);
 	}
 	| Type IDENT LP FuncFParamList RP Block {
-		$$ = ast_nterm(AST_FuncDef, 4,
-			       $1, ast_term(AST_IDENT, $2), $4, $6);
-		vfree(3, $2, $3, $5);
+		$$ = nterm(AST_FuncDef, 4,
+			   $1, ast_term(AST_IDENT, $2), $4, $6);
 	}
 	;
 
 FuncFParamList
 	: FuncFParam {
-		$$ = ast_nterm(AST_FuncFParamList, 1, $1);
+		$$ = nterm(AST_FuncFParamList, 1, $1);
 	}
-	| FuncFParam COMMA FuncFParamList {
-		$$ = node_add_child($3, $1);
-		free($2);
+	| FuncFParamList COMMA FuncFParam {
+		$$ = node_add_child($1, $3);
 	}
 	;
 
 FuncFParam
 	: Type IDENT {
-		$$ = ast_nterm(AST_FuncFParam, 2, $1, 
-			       ast_term(AST_IDENT, $2));
-		free($2);
+		$$ = nterm(AST_FuncFParam, 2, $1, 
+			   ast_term(AST_IDENT, $2));
 	}
 	;
 
 /* context-sensitive Type (rather than BType and FuncType) */
 Type
 	: TYPE {
-		$$ = ast_nterm(AST_Type, 1,
-			       ast_term(AST_TYPE, $1));
-		free($1);
+		$$ = nterm(AST_Type, 1,
+			   ast_term(AST_TYPE, $1));
 	}
 	;
 
 Block
 	: LC BlockItemList RC {
-		$$ = ast_nterm(AST_Block, 1, $2);
-		vfree(2, $1, $3);
+		$$ = nterm(AST_Block, 1, $2);
 	}
 	;
 
 /* define a nullable list in BNF */
 BlockItemList
 	: /* empty */ {
-		$$ = ast_nterm(AST_BlockItemList, 0);
+		$$ = nterm(AST_BlockItemList, 0);
 	}
-	| BlockItem BlockItemList {
-		$$ = node_add_child($2, $1);
+	| BlockItemList BlockItem {
+		$$ = node_add_child($1, $2);
 	}
 	;
 
 BlockItem
 	: Decl {
-		$$ = ast_nterm(AST_BlockItem, 1, $1);
+		$$ = nterm(AST_BlockItem, 1, $1);
 	}
 	| Stmt {
-		$$ = ast_nterm(AST_BlockItem, 1, $1);
+		$$ = nterm(AST_BlockItem, 1, $1);
 	}
 	;
 
 Stmt
 	: LVal ASSIGN Exp SEMI {
-		$$ = ast_nterm(AST_Stmt, 2, $1, $3);
-		vfree(2, $2, $4);
+		$$ = nterm(AST_Stmt, 2, $1, $3);
 	}
 	| SEMI {
-		$$ = ast_nterm(AST_Stmt, 1, ast_term(AST_SEMI, $1));
-		free($1);
+		$$ = nterm(AST_Stmt, 1, ast_term(AST_SEMI, ";"));
 	}
 	| Exp SEMI {
-		$$ = ast_nterm(AST_Stmt, 1, $1);
-		free($2);
+		$$ = nterm(AST_Stmt, 1, $1);
 	}
 	| Block {
-		$$ = ast_nterm(AST_Stmt, 1, $1);
+		$$ = nterm(AST_Stmt, 1, $1);
 	}
         | IF LP Exp RP Stmt %prec LOWER_THAN_ELSE {
-		$$ = ast_nterm(AST_Stmt, 3,
-			       ast_term(AST_IF, $1), $3, $5);
-		vfree(3, $1, $2, $4);
+		$$ = nterm(AST_Stmt, 3,
+			   ast_term(AST_IF, "if"), $3, $5);
 	}
 	| IF LP Exp RP Stmt ELSE Stmt {
-		$$ = ast_nterm(AST_Stmt, 4,
-			       ast_term(AST_IF, $1), $3, $5, $7);
-		vfree(4, $1, $2, $4, $6);
+		$$ = nterm(AST_Stmt, 4,
+			   ast_term(AST_IF, "if"), $3, $5, $7);
 	}
 	| WHILE LP Exp RP Stmt {
-		$$ = ast_nterm(AST_Stmt, 3,
-			       ast_term(AST_WHILE, $1), $3, $5);
-		vfree(3, $1, $2, $4);
+		$$ = nterm(AST_Stmt, 3,
+			   ast_term(AST_WHILE, "while"), $3, $5);
 	}
 	| BREAK SEMI {
-		$$ = ast_nterm(AST_Stmt, 1, ast_term(AST_BREAK, $1));
-		vfree(2, $1, $2);
+		$$ = nterm(AST_Stmt, 1, ast_term(AST_BREAK, "break"));
 	}
 	| CONTINUE SEMI {
-		$$ = ast_nterm(AST_Stmt, 1,
-			       ast_term(AST_CONTINUE, $1));
-		vfree(2, $1, $2);
+		$$ = nterm(AST_Stmt, 1,
+			   ast_term(AST_CONTINUE, "continue"));
 	}
 	| RETURN SEMI {
-		$$ = ast_nterm(AST_Stmt, 1, ast_term(AST_RETURN, $1));
-		vfree(2, $1, $2);
+		$$ = nterm(AST_Stmt, 1, ast_term(AST_RETURN, "return"));
 	}
 	| RETURN Exp SEMI {
-		$$ = ast_nterm(AST_Stmt, 2,
-			       ast_term(AST_RETURN, $1), $2);
-		vfree(2, $1, $3);
+		$$ = nterm(AST_Stmt, 2,
+			   ast_term(AST_RETURN, "return"), $2);
 	}
 	;
 
 Number
 	: INT_CONST {
-		$$ = ast_nterm(AST_Number, 1,
-			       ast_term(AST_INT_CONST, $1));
+		$$ = nterm(AST_Number, 1,
+			   ast_term(AST_INT_CONST, $1));
 	}
 	;
 
 Exp
 	: Exp LOR Exp {
-		$$ = ast_nterm(AST_Exp, 3, $1,
-			       ast_term(AST_LOR, $2), $3);
-		free($2);
+		$$ = nterm(AST_Exp, 3, $1,
+			   ast_term(AST_LOR, "||"), $3);
 	}
 	| Exp LAND Exp {
-		$$ = ast_nterm(AST_Exp, 3, $1,
-			       ast_term(AST_LAND, $2), $3);
-		free($2);
+		$$ = nterm(AST_Exp, 3, $1,
+			   ast_term(AST_LAND, "&&"), $3);
 	}
 	| Exp EQOP Exp {
-		$$ = ast_nterm(AST_Exp, 3, $1,
-			       ast_term(AST_EQOP, $2), $3);
-		free($2);
+		$$ = nterm(AST_Exp, 3, $1,
+			   ast_term(AST_EQOP, $2), $3);
 	}
 	| Exp RELOP Exp {
-		$$ = ast_nterm(AST_Exp, 3, $1,
-			       ast_term(AST_RELOP, $2), $3);
-		free($2);
+		$$ = nterm(AST_Exp, 3, $1,
+			   ast_term(AST_RELOP, $2), $3);
 	}
 	| Exp SHOP Exp {
-		$$ = ast_nterm(AST_Exp, 3, $1,
-			       ast_term(AST_SHOP, $2), $3);
-		free($2);
+		$$ = nterm(AST_Exp, 3, $1,
+			   ast_term(AST_SHOP, $2), $3);
 	}
 	| Exp ADDOP Exp {
-		$$ = ast_nterm(AST_Exp, 3, $1,
-			       ast_term(AST_ADDOP, $2), $3);
-		free($2);
+		$$ = nterm(AST_Exp, 3, $1,
+			   ast_term(AST_ADDOP, $2), $3);
 	}
 	| Exp MULOP Exp {
-		$$ = ast_nterm(AST_Exp, 3, $1,
-			       ast_term(AST_MULOP, $2), $3);
-		free($2);
+		$$ = nterm(AST_Exp, 3, $1,
+			   ast_term(AST_MULOP, $2), $3);
 	}
 	| UnaryExp {
-		$$ = ast_nterm(AST_Exp, 1, $1);
+		$$ = nterm(AST_Exp, 1, $1);
 	}
 	;
 
 PrimaryExp
 	: LP Exp RP {
-		$$ = ast_nterm(AST_PrimaryExp, 1, $2);
-		vfree(2, $1, $3);
+		$$ = nterm(AST_PrimaryExp, 1, $2);
 	}
 	| LVal {
-		$$ = ast_nterm(AST_PrimaryExp, 1, $1);
+		$$ = nterm(AST_PrimaryExp, 1, $1);
 	}
 	| Number {
-		$$ = ast_nterm(AST_PrimaryExp, 1, $1);
+		$$ = nterm(AST_PrimaryExp, 1, $1);
 	}
 	;
 
 UnaryExp
 	: PrimaryExp {
-		$$ = ast_nterm(AST_UnaryExp, 1, $1);
+		$$ = nterm(AST_UnaryExp, 1, $1);
 	}
 	| UNARYOP UnaryExp {
-		$$ = ast_nterm(AST_UnaryExp, 2,
-			       ast_term(AST_UNARYOP, $1), $2);
-		free($1);
+		$$ = nterm(AST_UnaryExp, 2,
+			   ast_term(AST_UNARYOP, $1), $2);
 	}
 	| ADDOP UnaryExp {
 		// basically every ADDOP is also a UNARYOP
-		$$ = ast_nterm(AST_UnaryExp, 2,
-			       ast_term(AST_UNARYOP, $1), $2);
-		free($1);
+		$$ = nterm(AST_UnaryExp, 2,
+			   ast_term(AST_UNARYOP, $1), $2);
 	}
 	| IDENT LP FuncRParamList RP {
-		$$ = ast_nterm(AST_UnaryExp, 2,
-			       ast_term(AST_IDENT, $1), $3);
-		vfree(3, $1, $2, $4);
+		$$ = nterm(AST_UnaryExp, 2,
+			   ast_term(AST_IDENT, $1), $3);
 	}
 	| IDENT LP RP {
-		$$ = ast_nterm(AST_UnaryExp, 1,
-			       ast_term(AST_IDENT, $1));
-		vfree(3, $1, $2, $3);
+		$$ = nterm(AST_UnaryExp, 1,
+			   ast_term(AST_IDENT, $1));
 	}
 	;
 
 FuncRParamList
 	: FuncRParam {
-		$$ = ast_nterm(AST_FuncRParamList, 1, $1);
+		$$ = nterm(AST_FuncRParamList, 1, $1);
 	}
-	| FuncRParam COMMA FuncRParamList {
-		$$ = node_add_child($3, $1);
-		free($2);
+	| FuncRParamList COMMA FuncRParam {
+		$$ = node_add_child($1, $3);
 	}
 	;
 
 FuncRParam
 	: Exp {
-		$$ = ast_nterm(AST_FuncRParam, 1, $1);
+		$$ = nterm(AST_FuncRParam, 1, $1);
 	}
 	;
 
 Decl
 	: ConstDecl {
-		$$ = ast_nterm(AST_Decl, 1, $1);
+		$$ = nterm(AST_Decl, 1, $1);
 	}
 	| VarDecl {
-		$$ = ast_nterm(AST_Decl, 1, $1);
+		$$ = nterm(AST_Decl, 1, $1);
 	}
 	;
 
 ConstDecl
 	: CONST Type ConstDefList SEMI {
-		$$ = ast_nterm(AST_ConstDecl, 2, $2, $3);
-		vfree(2, $1, $4);
+		$$ = nterm(AST_ConstDecl, 2, $2, $3);
 	}
 	;
 
 /* define a non-empty list in BNF */
 ConstDefList
 	: ConstDef {
-		$$ = ast_nterm(AST_ConstDefList, 1, $1);
+		$$ = nterm(AST_ConstDefList, 1, $1);
 	}
-	| ConstDef COMMA ConstDefList {
-		$$ = node_add_child($3, $1);
-		free($2);
+	| ConstDefList COMMA ConstDef {
+		$$ = node_add_child($1, $3);
 	}
 	;
 
 ConstDef
 	: IDENT ASSIGN ConstInitVal {
-		$$ = ast_nterm(AST_ConstDef, 2,
-			       ast_term(AST_IDENT, $1), $3);
-		vfree(2, $1, $2);
+		$$ = nterm(AST_ConstDef, 2,
+			   ast_term(AST_IDENT, $1), $3);
 	}
 	;
 
 ConstInitVal
 	: ConstExp {
-		$$ = ast_nterm(AST_ConstInitVal, 1, $1);
+		$$ = nterm(AST_ConstInitVal, 1, $1);
 	}
 	;
 
 VarDecl
 	: Type VarDefList SEMI {
-		$$ = ast_nterm(AST_VarDecl, 2, $1, $2);
-		free($3);
+		$$ = nterm(AST_VarDecl, 2, $1, $2);
 	}
 	;
 
 VarDefList
 	: VarDef {
-		$$ = ast_nterm(AST_VarDefList, 1, $1);
+		$$ = nterm(AST_VarDefList, 1, $1);
 	}
-	| VarDef COMMA VarDefList {
-		$$ = node_add_child($3, $1);
-		free($2);
+	| VarDefList COMMA VarDef {
+		$$ = node_add_child($1, $3);
 	}
 	;
 
 VarDef
 	: IDENT {
-		$$ = ast_nterm(AST_VarDef, 1,
-			       ast_term(AST_IDENT, $1));
-		free($1);
+		$$ = nterm(AST_VarDef, 1,
+			   ast_term(AST_IDENT, $1));
 	}
 	| IDENT ASSIGN InitVal {
-		$$ = ast_nterm(AST_VarDef, 2,
-			       ast_term(AST_IDENT, $1), $3);
-		vfree(2, $1, $2);
+		$$ = nterm(AST_VarDef, 2,
+			   ast_term(AST_IDENT, $1), $3);
 	}
 	;
 
 InitVal
 	: Exp {
-		$$ = ast_nterm(AST_InitVal, 1, $1);
+		$$ = nterm(AST_InitVal, 1, $1);
 	}
 	;
 
 LVal
 	: IDENT {
-		$$ = ast_nterm(AST_LVal, 1, ast_term(AST_IDENT, $1));
-		free($1);
+		$$ = nterm(AST_LVal, 1, ast_term(AST_IDENT, $1));
 	}
 	;
 
 ConstExp
 	: Exp {
-		$$ = ast_nterm(AST_ConstExp, 1, $1);
+		$$ = nterm(AST_ConstExp, 1, $1);
 	}
 	;
 
 %%
 
-int yyerror(char *msg)
+static void yyerror(YYLTYPE *loc, yyscan_t scanner, struct context_t *ctx,
+		    const char *msg)
 {
 	(void) msg;
 
-	error = true;
-	return fprintf(stderr, "Syntax error at line %d: unexpected `%s`\n",
-		       yylineno, yytext);
+	ctx->error = true;
+	fprintf(ctx->errors, "Syntax error at line %d: unexpected `%s`\n",
+		loc->first_line, yyget_text(scanner));
 }
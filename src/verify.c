@@ -0,0 +1,450 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hashtable.h"
+#include "macros.h"
+#include "verify.h"
+
+// problems reported per call, the rest are only counted
+#define PROBLEMS_MAX 16
+
+/* state variables */
+static _Thread_local const char *m_input;
+static _Thread_local FILE *m_errors;
+static _Thread_local koopa_raw_function_t m_function;
+static _Thread_local koopa_raw_basic_block_t m_bb;
+static _Thread_local uint32_t m_problems;
+// basic blocks and instructions of the function being checked
+static _Thread_local htable_ptru32_t m_local;
+
+static const char *const KIND_NAMES[] = {
+	"integer", "zeroinit", "undef", "aggregate", "function argument",
+	"block argument", "alloc", "global alloc", "load", "store", "getptr",
+	"getelemptr", "binary", "br", "jump", "call", "ret",
+};
+
+/* tool functions */
+static void problem(const char *fmt, ...)
+{
+	if (m_problems++ >= PROBLEMS_MAX)
+		return;
+
+	flockfile(m_errors);
+	fprintf(m_errors, "%s: ", m_input);
+	if (m_function)
+		fprintf(m_errors, "%s: ", m_function->name);
+	if (m_bb)
+		fprintf(m_errors, "%s: ", m_bb->name ? m_bb->name : "%?");
+
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(m_errors, fmt, args);
+	va_end(args);
+
+	fprintf(m_errors, "\n");
+	funlockfile(m_errors);
+}
+
+static bool same_type(koopa_raw_type_t lhs, koopa_raw_type_t rhs)
+{
+	if (lhs == rhs)
+		return true;
+	if (!lhs || !rhs || lhs->tag != rhs->tag)
+		return false;
+
+	switch (lhs->tag)
+	{
+	case KOOPA_RTT_INT32:
+	case KOOPA_RTT_UNIT:
+		return true;
+	case KOOPA_RTT_ARRAY:
+		return lhs->data.array.len == rhs->data.array.len
+		       && same_type(lhs->data.array.base,
+				    rhs->data.array.base);
+	case KOOPA_RTT_POINTER:
+		return same_type(lhs->data.pointer.base,
+				 rhs->data.pointer.base);
+	case KOOPA_RTT_FUNCTION:
+	{
+		const koopa_raw_slice_t *l = &lhs->data.function.params;
+		const koopa_raw_slice_t *r = &rhs->data.function.params;
+		if (l->len != r->len)
+			return false;
+		for (uint32_t i = 0; i < l->len; ++i)
+			if (!same_type(l->buffer[i], r->buffer[i]))
+				return false;
+
+		return same_type(lhs->data.function.ret,
+				 rhs->data.function.ret);
+		}
+	}
+
+	unreachable();
+}
+
+static bool is_int32(koopa_raw_value_t value)
+{
+	return value && value->ty && value->ty->tag == KOOPA_RTT_INT32;
+}
+
+static bool is_pointer(koopa_raw_value_t value)
+{
+	return value && value->ty && value->ty->tag == KOOPA_RTT_POINTER;
+}
+
+static bool listed(const koopa_raw_slice_t *used_by, const void *user)
+{
+	for (uint32_t i = 0; i < used_by->len; ++i)
+		if (used_by->buffer[i] == user)
+			return true;
+
+	return false;
+}
+
+static bool is_local(const void *ptr)
+{
+	return htable_lookup(m_local, (void *)ptr) != NULL;
+}
+
+/* @return whether `user` has `value` as an operand */
+static bool uses(koopa_raw_value_t user, const void *value)
+{
+	const koopa_raw_value_kind_t *kind = &user->kind;
+
+	switch (kind->tag)
+	{
+	case KOOPA_RVT_GLOBAL_ALLOC:
+		return kind->data.global_alloc.init == value;
+	case KOOPA_RVT_LOAD:
+		return kind->data.load.src == value;
+	case KOOPA_RVT_STORE:
+		return kind->data.store.value == value
+		       || kind->data.store.dest == value;
+	case KOOPA_RVT_GET_PTR:
+		return kind->data.get_ptr.src == value
+		       || kind->data.get_ptr.index == value;
+	case KOOPA_RVT_GET_ELEM_PTR:
+		return kind->data.get_elem_ptr.src == value
+		       || kind->data.get_elem_ptr.index == value;
+	case KOOPA_RVT_BINARY:
+		return kind->data.binary.lhs == value
+		       || kind->data.binary.rhs == value;
+	case KOOPA_RVT_BRANCH:
+		return kind->data.branch.cond == value
+		       || kind->data.branch.true_bb == value
+		       || kind->data.branch.false_bb == value
+		       || listed(&kind->data.branch.true_args, value)
+		       || listed(&kind->data.branch.false_args, value);
+	case KOOPA_RVT_JUMP:
+		return kind->data.jump.target == value
+		       || listed(&kind->data.jump.args, value);
+	case KOOPA_RVT_CALL:
+		return listed(&kind->data.call.args, value);
+	case KOOPA_RVT_RETURN:
+		return kind->data.ret.value == value;
+	default:
+		return false;
+	}
+}
+
+/* values are only ever used inside of the function they're defined in, and
+ * know all of their users */
+static void check_operand(koopa_raw_value_t user, koopa_raw_value_t operand,
+			  const char *what)
+{
+	const char *name = KIND_NAMES[user->kind.tag];
+	if (!operand)
+	{
+		problem("%s without its %s", name, what);
+		return;
+	}
+
+	switch (operand->kind.tag)
+	{
+	case KOOPA_RVT_INTEGER:
+	case KOOPA_RVT_ZERO_INIT:
+	case KOOPA_RVT_UNDEF:
+	case KOOPA_RVT_AGGREGATE:
+	case KOOPA_RVT_BLOCK_ARG_REF:
+	case KOOPA_RVT_GLOBAL_ALLOC:
+		break;
+	case KOOPA_RVT_FUNC_ARG_REF:
+		if (!listed(&m_function->params, operand))
+			problem("%s of %s is an argument of another function",
+				what, name);
+		break;
+	default:
+		if (!is_local(operand))
+			problem("%s of %s is in no basic block of this "
+				"function", what, name);
+	}
+
+	if (!listed(&operand->used_by, user))
+		problem("%s of %s isn't used by it", what, name);
+}
+
+static void check_target(koopa_raw_value_t user,
+			 koopa_raw_basic_block_t target,
+			 const koopa_raw_slice_t *args)
+{
+	const char *name = KIND_NAMES[user->kind.tag];
+	if (!target || !is_local(target))
+	{
+		problem("%s to a basic block of another function", name);
+		return;
+	}
+
+	if (!listed(&target->used_by, user))
+		problem("target of %s isn't used by it", name);
+	if (args->len != target->params.len)
+		problem("%s with %u arguments to %s with %u parameters", name,
+			args->len, target->name, target->params.len);
+	for (uint32_t i = 0; i < args->len; ++i)
+		check_operand(user, args->buffer[i], "argument");
+}
+
+static void check_inst(koopa_raw_value_t value)
+{
+	const koopa_raw_value_kind_t *kind = &value->kind;
+	koopa_raw_type_t ret = m_function->ty->data.function.ret;
+
+	switch (kind->tag)
+	{
+	case KOOPA_RVT_ALLOC:
+		if (!is_pointer(value))
+			problem("alloc of a non-pointer");
+		break;
+	case KOOPA_RVT_LOAD:
+	{
+		koopa_raw_value_t src = kind->data.load.src;
+		check_operand(value, src, "source");
+		if (!is_pointer(src)
+		    || !same_type(value->ty, src->ty->data.pointer.base))
+			problem("load of mismatched types");
+		break;
+		}
+	case KOOPA_RVT_STORE:
+	{
+		koopa_raw_value_t dest = kind->data.store.dest;
+		check_operand(value, kind->data.store.value, "value");
+		check_operand(value, dest, "destination");
+		if (!kind->data.store.value || !is_pointer(dest)
+		    || !same_type(kind->data.store.value->ty,
+				  dest->ty->data.pointer.base))
+			problem("store of mismatched types");
+		break;
+		}
+	case KOOPA_RVT_GET_PTR:
+		check_operand(value, kind->data.get_ptr.src, "source");
+		check_operand(value, kind->data.get_ptr.index, "index");
+		if (!is_pointer(kind->data.get_ptr.src)
+		    || !is_int32(kind->data.get_ptr.index))
+			problem("getptr of mismatched types");
+		break;
+	case KOOPA_RVT_GET_ELEM_PTR:
+		check_operand(value, kind->data.get_elem_ptr.src, "source");
+		check_operand(value, kind->data.get_elem_ptr.index, "index");
+		if (!is_pointer(kind->data.get_elem_ptr.src)
+		    || !is_int32(kind->data.get_elem_ptr.index))
+			problem("getelemptr of mismatched types");
+		break;
+	case KOOPA_RVT_BINARY:
+		check_operand(value, kind->data.binary.lhs, "lhs");
+		check_operand(value, kind->data.binary.rhs, "rhs");
+		if (!is_int32(value) || !is_int32(kind->data.binary.lhs)
+		    || !is_int32(kind->data.binary.rhs))
+			problem("binary of a non-integer");
+		break;
+	case KOOPA_RVT_BRANCH:
+		check_operand(value, kind->data.branch.cond, "condition");
+		if (!is_int32(kind->data.branch.cond))
+			problem("br on a non-integer");
+		check_target(value, kind->data.branch.true_bb,
+			     &kind->data.branch.true_args);
+		check_target(value, kind->data.branch.false_bb,
+			     &kind->data.branch.false_args);
+		break;
+	case KOOPA_RVT_JUMP:
+		check_target(value, kind->data.jump.target,
+			     &kind->data.jump.args);
+		break;
+	case KOOPA_RVT_CALL:
+	{
+		koopa_raw_function_t callee = kind->data.call.callee;
+		const koopa_raw_slice_t *args = &kind->data.call.args;
+		if (!callee || !callee->ty
+		    || callee->ty->tag != KOOPA_RTT_FUNCTION)
+		{
+			problem("call of a non-function");
+			break;
+		}
+
+		const koopa_raw_slice_t *params =
+			&callee->ty->data.function.params;
+		if (args->len != params->len)
+			problem("call of %s with %u arguments instead of %u",
+				callee->name, args->len, params->len);
+		for (uint32_t i = 0; i < args->len; ++i)
+		{
+			koopa_raw_value_t arg = args->buffer[i];
+			check_operand(value, arg, "argument");
+			if (arg && i < params->len
+			    && !same_type(arg->ty, params->buffer[i]))
+				problem("argument %u of call of %s of "
+					"mismatched type", i, callee->name);
+		}
+		if (!same_type(value->ty, callee->ty->data.function.ret))
+			problem("call of %s of mismatched type", callee->name);
+		break;
+		}
+	case KOOPA_RVT_RETURN:
+		if (!kind->data.ret.value)
+		{
+			if (ret->tag != KOOPA_RTT_UNIT)
+				problem("ret without a value");
+			break;
+		}
+		check_operand(value, kind->data.ret.value, "value");
+		if (!same_type(kind->data.ret.value->ty, ret))
+			problem("ret of mismatched type");
+		break;
+	default:
+		problem("%s in place of an instruction",
+			KIND_NAMES[kind->tag]);
+	}
+}
+
+/* anything that claims to use a value has to */
+static void check_users(const koopa_raw_slice_t *used_by, const void *value,
+			const char *what)
+{
+	for (uint32_t i = 0; i < used_by->len; ++i)
+	{
+		koopa_raw_value_t user = used_by->buffer[i];
+		if (!is_local(user) || !uses(user, value))
+			problem("stale user of %s", what);
+	}
+}
+
+static void check_function(koopa_raw_function_t function)
+{
+	m_function = function;
+	m_bb = NULL;
+
+	if (!function->ty || function->ty->tag != KOOPA_RTT_FUNCTION)
+	{
+		problem("function of a non-function type");
+		return;
+	}
+
+	/* declarations have nothing more to them */
+	if (function->bbs.len == 0)
+		return;
+
+	if (function->params.len != function->ty->data.function.params.len)
+		problem("parameters of mismatched type");
+	for (uint32_t i = 0; i < function->params.len; ++i)
+	{
+		koopa_raw_value_t param = function->params.buffer[i];
+		if (param->kind.tag != KOOPA_RVT_FUNC_ARG_REF
+		    || param->kind.data.func_arg_ref.index != i)
+			problem("parameter %u out of place", i);
+	}
+
+	m_local = htable_ptru32_new();
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		koopa_raw_basic_block_t bb = function->bbs.buffer[i];
+
+		htable_insert(m_local, (void *)bb, true);
+		for (uint32_t j = 0; j < bb->insts.len; ++j)
+			htable_insert(m_local, (void *)bb->insts.buffer[j],
+				      true);
+	}
+
+	for (uint32_t i = 0; i < function->bbs.len; ++i)
+	{
+		m_bb = function->bbs.buffer[i];
+
+		if (m_bb->insts.len == 0)
+			problem("empty basic block");
+		check_users(&m_bb->used_by, m_bb, "basic block");
+		for (uint32_t j = 0; j < m_bb->insts.len; ++j)
+		{
+			koopa_raw_value_t inst = m_bb->insts.buffer[j];
+			bool terminator = inst->kind.tag == KOOPA_RVT_BRANCH
+					  || inst->kind.tag == KOOPA_RVT_JUMP
+					  || inst->kind.tag == KOOPA_RVT_RETURN;
+
+			/* exactly one, at the very end */
+			if (terminator && j + 1 < m_bb->insts.len)
+				problem("%s in the middle of a basic block",
+					KIND_NAMES[inst->kind.tag]);
+			if (!terminator && j + 1 == m_bb->insts.len)
+				problem("basic block without a terminator");
+
+			check_inst(inst);
+			check_users(&inst->used_by, inst,
+				    KIND_NAMES[inst->kind.tag]);
+		}
+	}
+
+	htable_ptru32_delete(m_local);
+	m_local = NULL;
+}
+
+static void check_global(koopa_raw_value_t global)
+{
+	if (global->kind.tag != KOOPA_RVT_GLOBAL_ALLOC)
+	{
+		problem("%s in place of a global alloc",
+			KIND_NAMES[global->kind.tag]);
+		return;
+	}
+
+	koopa_raw_value_t init = global->kind.data.global_alloc.init;
+	const char *name = global->name ? global->name : "@?";
+	if (!init || !is_pointer(global)
+	    || !same_type(init->ty, global->ty->data.pointer.base))
+		problem("%s initialized with mismatched type", name);
+	else if (!listed(&init->used_by, global))
+		problem("initializer of %s isn't used by it", name);
+}
+
+/* public defn.s */
+bool verify(const koopa_raw_program_t *program, const char *input,
+	    FILE *errors)
+{
+	m_input = input;
+	m_errors = errors;
+	m_function = NULL;
+	m_bb = NULL;
+	m_problems = 0;
+
+	for (uint32_t i = 0; i < program->values.len; ++i)
+		check_global(program->values.buffer[i]);
+	for (uint32_t i = 0; i < program->funcs.len; ++i)
+		check_function(program->funcs.buffer[i]);
+
+	if (m_problems > PROBLEMS_MAX)
+		fprintf(errors, "%s: %u more problems\n", input,
+			m_problems - PROBLEMS_MAX);
+	return m_problems == 0;
+}
+
+bool verify_function(koopa_raw_function_t function, const char *input,
+		     FILE *errors)
+{
+	m_input = input;
+	m_errors = errors;
+	m_problems = 0;
+
+	check_function(function);
+
+	if (m_problems > PROBLEMS_MAX)
+		fprintf(errors, "%s: %u more problems\n", input,
+			m_problems - PROBLEMS_MAX);
+	return m_problems == 0;
+}
@@ -0,0 +1,25 @@
+/**
+ * verify.h
+ * Integrity checks of memory IR.
+ */
+
+#ifndef _VERIFY_H_
+#define _VERIFY_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "koopa.h"
+
+/* Check terminators of basic blocks, types of operands, targets of branches
+ * and `used_by` of every value in `program`. Problems are reported to
+ * `errors`, prefixed with `input`.
+ * @return whether there's none. */
+bool verify(const koopa_raw_program_t *program, const char *input,
+	    FILE *errors);
+
+/* Check a single function, as `verify()` does. */
+bool verify_function(koopa_raw_function_t function, const char *input,
+		     FILE *errors);
+
+#endif//_VERIFY_H_
@@ -8,18 +8,15 @@
 
 #define YIELD_MAX 2
 
-static struct {
-	struct {
-		int32_t reg_idx;
-	} m_bb;
+static _Thread_local struct {
 	uint8_t m_yield_end;
 	struct variant_t *variant;
 } m_yield_vars[YIELD_MAX];
 
-static uint8_t m_yield_begin;
-static uint8_t m_yield_end;
-static jmp_buf m_yield[YIELD_MAX];
-static jmp_buf m_next[YIELD_MAX];
+static _Thread_local uint8_t m_yield_begin;
+static _Thread_local uint8_t m_yield_end;
+static _Thread_local jmp_buf m_yield[YIELD_MAX];
+static _Thread_local jmp_buf m_next[YIELD_MAX];
 
 #define def(name) (m_yield_vars[m_yield_end].name = (name))
 #define use(name) (m_yield_vars[m_yield_begin].name)